@@ -22,133 +22,360 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
-#include "vec.h"
+#include <string>
+#include <vector>
+#include "vec++.hh"
+#include "vecexpr.hh"
+#include "vecpool.hh"
 
 static bool binary_input = false;
+static bool binary_float_input = false;
 static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
 
 static bool stop_parsing_options = false;
 static bool verbose = false;
 static bool add_all = false;
 static bool negative = false;
+static bool sparse = false;
+static pid::expression::opcode operation = pid::expression::op_add;
+static size_t threads = 1;
 
 void help() {
-  std::cerr << "usage: add [-v] [-a] [-n] [-b] [-B] {FILENAME1} {FILENAME2}\n"
-    "\tadd reads vectorstream files {FILENAME1} and {FILENAME2} and add each\n"
-    "\telements of the arrays.\n";
+  std::cerr << "usage: add [-v] [-a] [-n] [-o{OPERATION}] [-z] [-j[N]] [-b[s]] [-B[s|d]] [-P]\n"
+    "\t{FILENAME1} {FILENAME2} [{FILENAME}...]\n"
+    "\tadd reads vectorstream files {FILENAME1}, {FILENAME2}, ... and add each\n"
+    "\telements of the arrays, in one pass over all of them.\n"
+    "\tFiles of the same length, or without dimension hints, are added\n"
+    "\telement by element up to the shortest.  Otherwise they are broadcast\n"
+    "\tby their hints: a file of records of one element is repeated over\n"
+    "\tthe components, and a file of one record over the records; other\n"
+    "\tshapes are an error.  The hints are read from pipes too; binary\n"
+    "\tinput has none.\n"
+    "\t-a: Adds the shorter files to each record of the longest ones,\n"
+    "\twhatever their hints are.\n"
+    "\t-n: Negates {FILENAME1} first.\n"
+    "\t-o{OPERATION}: add (default), sub, mul, div, min or max, from left\n"
+    "\tto right.\n"
+    "\t-j[N]: Computes on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-z: Sparse. Adds only the nonzero elements, and writes the sum\n"
+    "\tsparse unless it is dense. Only for two files, and not with -a or\n"
+    "\t-o.\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
 }
 
-void process_vectors(size_t N1, double *v1, size_t N2, double *v2) {
-  size_t N, n;
-  double *v_out = 0;
-	
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+template <typename real> void put_sparse_vector(size_t n, size_t nnz,
+					       const size_t *index,
+					       const real *v) {
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::put_sparse_vector(n, nnz, index, v, stdout);
+  }
+  else if (binary_float_output) {
+    std::vector<float> w(v, v + nnz);
+    pid::put_sparse_vector_binary(n, nnz, index, nnz > 0 ? &w[0] : 0, stdout);
+  }
+  else if (binary_double_output) {
+    std::vector<double> w(v, v + nnz);
+    pid::put_sparse_vector_binary(n, nnz, index, nnz > 0 ? &w[0] : 0, stdout);
+  }
+  else {
+    pid::put_sparse_vector_binary(n, nnz, index, v, stdout);
+  }
+}
+
+// Adds two sparse vectors.  If either is more than half full, it is
+// expanded and the other is added into it; otherwise the sum is merged
+// and written sparse.
+template <typename real>
+void process_sparse_vectors(size_t N1, size_t nnz1, size_t *index1, real *v1,
+			    size_t N2, size_t nnz2, size_t *index2, real *v2) {
+  if (N1 == static_cast<size_t>(-1) || N2 == static_cast<size_t>(-1)) {
+    pid::put_nil(stdout);
+    return;
+  }
+  size_t n = std::min(N1, N2);
+  nnz1 = std::lower_bound(index1, index1 + nnz1, n) - index1;
+  nnz2 = std::lower_bound(index2, index2 + nnz2, n) - index2;
   if (negative) {
-    for (size_t i = 0; i < N1; ++i) {
+    pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+    for (size_t i = 0; i < nnz1; ++i) {
       v1[i] = -v1[i];
     }
+    pid::vec_profile_end(VEC_PROFILE_COMPUTE, nnz1, 2 * nnz1 * sizeof(real));
   }
-  if (add_all) {
-    double *V, *v;
-    if (N1 < N2) {
-      n = N1;
-      N = N2;
-      v = v1;
-      V = v2;
+
+  if (n > 0 && 2 * std::max(nnz1, nnz2) > n) {
+    if (nnz1 < nnz2) {
+      std::swap(nnz1, nnz2);
+      std::swap(index1, index2);
+      std::swap(v1, v2);
     }
-    else {
-      n = N2;
-      N = N1;
-      v = v2;
-      V = v1;
+    std::vector<real> a(n);
+    for (size_t i = 0; i < nnz1; ++i) {
+      a[index1[i]] = v1[i];
     }
-    v_out = new double[N];
-    pid::vec_add_double_single_vector_to_multi_vector(v_out, n, n, v, N, V);
+    pid::add_sparse_vector_to_vector(&a[0], n, &a[0], nnz2, index2, v2);
+    pid::vec_set_sparse_output(1);
     if (!binary_output) {
       pid::vec_put_header_to_file(stdout);
-      pid::vec_put_double_vector_to_file(N, v_out, n, stdout);
+      pid::put_vector(n, &a[0], 0, stdout);
     }
     else {
-      pid::vec_put_double_vector_to_file_binary(N, v_out, stdout);
+      put_vector_binary(n, &a[0]);
     }
   }
   else {
-    if (N1 < N2) {
-      n = N1;
-      N = N2;
-    }
-    else {
-      n = N2;
-      N = N1;
-    }
-    v_out = new double[n];
-    pid::vec_add_double_multi_vector_to_multi_vector(v_out, n, n, v1, n, v2);
-    if (!binary_output) {
-      pid::vec_put_header_to_file(stdout);
-      pid::vec_put_double_vector_to_file(n, v_out, 0, stdout);
-    }
-    else {
-      pid::vec_put_double_vector_to_file_binary(n, v_out, stdout);
-    }
+    std::vector<size_t> index(std::max<size_t>(nnz1 + nnz2, 1));
+    std::vector<real> a(index.size());
+    size_t nnz;
+    pid::add_sparse_vector_to_sparse_vector(&nnz, &index[0], &a[0], nnz1,
+					    index1, v1, nnz2, index2, v2);
+    put_sparse_vector(n, nnz, &index[0], &a[0]);
   }
-  
   std::fflush(stdout);
-  delete[] v_out;
 }
 
-void process_files(FILE *fin1, FILE *fin2) {
-  size_t N1, N2;
-  double *v1, *v2;
+template <typename real> void process_sparse_files(FILE *fin1, FILE *fin2) {
+  size_t N1, N2, nnz1, nnz2, *index1, *index2;
+  real *v1, *v2;
   if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N1, &v1, fin1);
-    pid::vec_new_double_vector_from_file(&N2, &v2, fin2);
+    pid::new_sparse_vector(&N1, &nnz1, &index1, &v1, fin1);
+    pid::new_sparse_vector(&N2, &nnz2, &index2, &v2, fin2);
   }
   else {
-    pid::vec_new_double_vector_from_file_binary(&N1, &v1, fin1);
-    pid::vec_new_double_vector_from_file_binary(&N2, &v2, fin2);
+    pid::new_sparse_vector_binary(&N1, &nnz1, &index1, &v1, fin1);
+    pid::new_sparse_vector_binary(&N2, &nnz2, &index2, &v2, fin2);
   }
-  process_vectors(N1, v1, N2, v2);
+  process_sparse_vectors(N1, nnz1, index1, v1, N2, nnz2, index2, v2);
   pid::vec_scan_messages_from_file_and_put_to_file(fin1, stdout);
   pid::vec_scan_messages_from_file_and_put_to_file(fin2, stdout);
+  pid::delete_sparse_index(index1);
+  pid::delete_sparse_index(index2);
   std::free(v1);
   std::free(v2);
 }
 
-void process(const char *filename1, const char *filename2) {
-  if (filename1[0] == '-' && filename1[1] == '\0') {
-    FILE *fin2;
-    fin2 = std::fopen(filename2, "r");
-    if (!fin2) {
-      std::cerr << "add: error: can't open: " << filename2 << '\n';
-      std::exit(1);
+// Shapes of the files: input k has its record r, component j at
+// v[r * records[k] + j * components[k]].
+struct shape {
+  size_t s;			// components of an output record
+  size_t n;			// output elements
+  std::vector<size_t> records;
+  std::vector<size_t> components;
+};
+
+// Lays the shorter files over the records of the longest ones for -a.
+shape shape_all(const std::vector<size_t> &N) {
+  shape sh;
+  size_t k = N.size();
+  sh.s = *std::min_element(N.begin(), N.end());
+  sh.n = static_cast<size_t>(-1);
+  sh.records.resize(k);
+  sh.components.assign(k, 1);
+  for (size_t i = 0; i < k; ++i) {
+    if (N[i] > sh.s) {
+      sh.n = std::min(sh.n, N[i]);
     }
-    process_files(stdin, fin2);
-    std::fclose(fin2);
   }
-  else if (filename2[0] == '-' && filename2[1] == '\0') {
-    FILE *fin1;
-    fin1 = std::fopen(filename1, "r");
-    if (!fin1) {
-      std::cerr << "add: error: can't open: " << filename1 << '\n';
+  if (sh.n == static_cast<size_t>(-1)) {
+    sh.n = sh.s;
+  }
+  for (size_t i = 0; i < k; ++i) {
+    sh.records[i] = N[i] < sh.n ? 0 : sh.s;
+  }
+  return sh;
+}
+
+// Adds the files element by element, up to the shortest, as records of
+// s components.
+shape shape_elementwise(const std::vector<size_t> &N, size_t s) {
+  shape sh;
+  size_t k = N.size();
+  sh.s = s;
+  sh.n = *std::min_element(N.begin(), N.end());
+  sh.records.assign(k, s);
+  sh.components.assign(k, 1);
+  return sh;
+}
+
+// Broadcasts the files by their dimension hints (0 if none): a file of
+// one record goes to every record, and a file of records of one element
+// to every component.  Files of the same length, or without hints, are
+// added element by element.
+shape shape_broadcast(const std::vector<size_t> &N,
+		      const std::vector<size_t> &hints) {
+  size_t k = N.size();
+  bool same_length = true, hinted = true, same_hint = true;
+  for (size_t i = 0; i < k; ++i) {
+    same_length = same_length && N[i] == N[0];
+    hinted = hinted && hints[i] > 0 && N[i] % hints[i] == 0;
+    same_hint = same_hint && hints[i] == hints[0];
+  }
+  if (same_length || !hinted) {
+    return shape_elementwise(N, same_length && hinted && same_hint ?
+			     hints[0] : 1);
+  }
+
+  shape sh;
+  sh.s = *std::max_element(hints.begin(), hints.end());
+  size_t R = 1;
+  for (size_t i = 0; i < k; ++i) {
+    R = std::max(R, N[i] / hints[i]);
+  }
+  for (size_t i = 0; i < k; ++i) {
+    size_t r = N[i] / hints[i];
+    if ((hints[i] != 1 && hints[i] != sh.s) || (r != 1 && r != R)) {
+      std::cerr << "add: error: can't broadcast " << r << " records of "
+		<< hints[i] << " to " << R << " records of " << sh.s << '\n';
       std::exit(1);
     }
-    process_files(fin1, stdin);
-    std::fclose(fin1);
+  }
+  sh.records.resize(k);
+  sh.components.resize(k);
+  for (size_t i = 0; i < k; ++i) {
+    sh.records[i] = N[i] == hints[i] ? 0 : hints[i];
+    sh.components[i] = hints[i] == 1 && sh.s > 1 ? 0 : 1;
+  }
+  sh.n = R * sh.s;
+  return sh;
+}
+
+template <typename real>
+void process_vectors(const std::vector<size_t> &N,
+		     const std::vector<size_t> &hints,
+		     const std::vector<real *> &v) {
+  shape sh = add_all ? shape_all(N) : shape_broadcast(N, hints);
+  pid::expression e;
+  e.reduce(operation, v.size(), negative);
+
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "add: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t n = sh.n;
+  size_t piece = (n + 4 * threads - 1) / (4 * threads);
+  piece = std::max<size_t>(piece, 16 * pid::expression::block);
+  piece -= piece % pid::expression::block;
+  size_t parts = (n + piece - 1) / piece;
+  // Left untouched here, so that each part is placed on the node of the
+  // worker that computes it.
+  real *a = static_cast<real *>(std::malloc(std::max<size_t>(n, 1) *
+					    sizeof(real)));
+  std::vector<const real *> w(v.begin(), v.end());
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+  pid::parallel_for(threads, parts, [&](size_t part) {
+      pid::expression_evaluator<real> ev(e);
+      size_t first = part * piece;
+      ev.run_broadcast(0, &w[0], &sh.records[0], &sh.components[0], sh.s,
+		       first, std::min(piece, n - first), &a[first]);
+    });
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, n,
+		       (v.size() + 1) * n * sizeof(real));
+
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    if (sh.s > 1) {
+      pid::vec_put_hint_to_file("dimension", sh.s, stdout);
+    }
+    pid::put_vector(n, &a[0], sh.s > 1 ? sh.s : 0, stdout);
   }
   else {
-    FILE *fin1, *fin2;
-    fin1 = std::fopen(filename1, "r");
-    fin2 = std::fopen(filename2, "r");
-    if (!fin1) {
-      std::cerr << "add: error: can't open: " << filename1 << '\n';
-      std::exit(1);
+    put_vector_binary(n, &a[0]);
+  }
+  std::fflush(stdout);
+  std::free(a);
+}
+
+template <typename real> void process_files(const std::vector<FILE *> &fins) {
+  size_t k = fins.size();
+  std::vector<size_t> N(k), hints(k, 0);
+  std::vector<real *> v(k);
+  bool nil = false;
+  pid::interleave_shared_vectors(threads);
+  for (size_t i = 0; i < k; ++i) {
+    if (!binary_input) {
+      hints[i] = pid::dimension_hint(fins[i]);
+      pid::new_vector(&N[i], &v[i], fins[i]);
+    }
+    else {
+      pid::new_vector_binary(&N[i], &v[i], fins[i]);
+    }
+    if (N[i] == static_cast<size_t>(-1)) {
+      nil = true;
+    }
+  }
+  if (nil) {
+    pid::put_nil(stdout);
+  }
+  else {
+    process_vectors(N, hints, v);
+  }
+  for (size_t i = 0; i < k; ++i) {
+    pid::vec_scan_messages_from_file_and_put_to_file(fins[i], stdout);
+    std::free(v[i]);
+  }
+}
+
+void process_files(const std::vector<FILE *> &fins) {
+  if (sparse && (add_all || fins.size() != 2 ||
+		 operation != pid::expression::op_add)) {
+    std::cerr << "add: warning: -z is only for two files, without -a or -o\n";
+    sparse = false;
+  }
+  if (sparse && binary_float_input) {
+    process_sparse_files<float>(fins[0], fins[1]);
+  }
+  else if (sparse) {
+    process_sparse_files<double>(fins[0], fins[1]);
+  }
+  else if (binary_float_input) {
+    process_files<float>(fins);
+  }
+  else {
+    process_files<double>(fins);
+  }
+}
+
+void process(const std::vector<const char *> &filenames) {
+  std::vector<FILE *> fins;
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    const char *filename = filenames[i];
+    if (filename[0] == '-' && filename[1] == '\0') {
+      fins.push_back(stdin);
+      continue;
     }
-    if (!fin2) {
-      std::cerr << "add: error: can't open: " << filename2 << '\n';
+    FILE *fin = pid::open_file(filename);
+    if (!fin) {
+      std::cerr << "add: error: can't open: " << filename << '\n';
       std::exit(1);
     }
-    process_files(fin1, fin2);
-    std::fclose(fin1);
-    std::fclose(fin2);
+    fins.push_back(fin);
+  }
+  process_files(fins);
+  for (size_t i = 0; i < fins.size(); ++i) {
+    if (fins[i] != stdin) {
+      std::fclose(fins[i]);
+    }
   }
 }
 
@@ -166,11 +393,57 @@ void parse_option(const char *option) {
   case 'n':
     negative = true;
     break;
+  case 'o': {
+    static const struct {
+      const char *name;
+      pid::expression::opcode op;
+    } operations[] = {
+      { "add", pid::expression::op_add },
+      { "sub", pid::expression::op_subtract },
+      { "mul", pid::expression::op_multiply },
+      { "div", pid::expression::op_divide },
+      { "min", pid::expression::op_min },
+      { "max", pid::expression::op_max },
+      { 0, pid::expression::op_add }
+    };
+    size_t i = 0;
+    while (operations[i].name &&
+	   std::string(option + 1) != operations[i].name) {
+      ++i;
+    }
+    if (!operations[i].name) {
+      std::cerr << "add: error: unknown operation: " << option + 1 << '\n';
+      std::exit(1);
+    }
+    operation = operations[i].op;
+    break;
+  }
+  case 'z':
+    sparse = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
   case 'b':
     binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
     break;
   case 'B':
     binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("add");
     break;
   default:
     std::cerr << "add: warning: ignoring option: " << option << '\n';
@@ -179,31 +452,27 @@ void parse_option(const char *option) {
 }
 
 int main(int argc, char **argv) {
-  char *filenames[2];
-  int fnc = 0;
+  std::vector<const char *> filenames;
 	
   if (argc < 3) {
     help();
     std::exit(0);
   }
   
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
       parse_option(*argv + 1);
     }
     else {
-      if (fnc < 2) {
-	filenames[fnc] = *argv;
-	++fnc;
-      }
-      else {
-	std::cerr << "add: warning: ignoring filename: " << *argv << '\n';
-      }
+      filenames.push_back(*argv);
     }
   }
-  process(filenames[0], filenames[1]);
+  if (filenames.size() < 2) {
+    help();
+    std::exit(1);
+  }
+  process(filenames);
   return 0;
 }
-
-  
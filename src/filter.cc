@@ -0,0 +1,329 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static size_t size_of_vector = 1;
+static bool size_given = false;
+static int method = VEC_FILTER_AUTO;
+static bool centered = false;
+static bool continued = false;
+static size_t threads = 1;
+
+static std::vector<double> kernel;
+// The last records of the signal, carried from file to file with -c.
+static std::vector<double> carried;
+
+void help() {
+  std::cerr << "usage: filter [-s{SIZE_OF_VECTOR}] [-d|-f] [-C|-c] [-j[N]] [-b[s]]\n"
+    "\t[-B[s|d]] [-P] [--] {KERNEL} [{FILENAME}...]\n"
+    "\tfilter convolves each component of the vectors with the vector\n"
+    "\t{KERNEL}: output t is KERNEL[0] x[t] + KERNEL[1] x[t - 1] + ...,\n"
+    "\twith zeros before the start of the signal. Short kernels are\n"
+    "\tapplied directly, long ones by FFT (overlap-save).\n"
+    "\t-s{SIZE_OF_VECTOR}: Number of components. (Default: the dimension\n"
+    "\thint of the file, or 1)\n"
+    "\t-d: Applies the kernel directly, whatever its length.\n"
+    "\t-f: Applies the kernel by FFT, whatever its length.\n"
+    "\t-C: Centers the kernel, so that smoothing doesn't delay the signal.\n"
+    "\tThe output is as long as the input.\n"
+    "\t-c: Continues the signal from file to file, as if the files were\n"
+    "\tone long vector.\n"
+    "\t-j[N]: Filters on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+template <typename real> std::vector<real> read_vector(FILE *fin) {
+  size_t N;
+  real *v;
+  if (!binary_input) {
+    pid::new_vector(&N, &v, fin);
+  }
+  else {
+    pid::new_vector_binary(&N, &v, fin);
+  }
+  std::vector<real> w;
+  if (N != static_cast<size_t>(-1)) {
+    w.assign(v, v + N);
+  }
+  std::free(v);
+  return w;
+}
+
+// Filters the n elements of v into a, starting from history.  On more
+// than one thread the records are split into blocks; the history of
+// each block is the end of the block before it, so the output does not
+// depend on the number of threads (apart from the FFT rounding).
+template <typename real> void filter_vector(real *a, size_t n, const real *v,
+					    size_t s, const real *k,
+					    real *history) {
+  size_t nk = kernel.size();
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "filter: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t records = n / s;
+  size_t rows = (records + 4 * threads - 1) / (4 * threads);
+  rows = std::max(rows, std::max<size_t>(nk, 4096));
+  size_t blocks = (records + rows - 1) / rows;
+  if (threads <= 1 || blocks <= 1) {
+    pid::filter_multi_vector(a, s, n, v, nk, k, history, method);
+    return;
+  }
+
+  size_t keep = (nk - 1) * s;
+  std::vector<real> histories(blocks * keep);
+  std::copy(history, history + keep, histories.begin());
+  for (size_t b = 1; b < blocks; ++b) {
+    std::copy(v + b * rows * s - keep, v + b * rows * s,
+	      histories.begin() + b * keep);
+  }
+  pid::parallel_for(threads, blocks, [&](size_t b) {
+      size_t m = std::min(rows, records - b * rows) * s;
+      pid::filter_multi_vector(a + b * rows * s, s, m, v + b * rows * s, nk,
+			       k, keep > 0 ? &histories[b * keep] : 0, method);
+    });
+  std::copy(histories.end() - keep, histories.end(), history);
+}
+
+template <typename real> void process_file(FILE *fin) {
+  if (centered && continued) {
+    std::cerr << "filter: error: -C and -c can't be used together.\n";
+    std::exit(1);
+  }
+  size_t s = size_of_vector;
+  if (!binary_input) {
+    size_t hint = pid::dimension_hint(fin);
+    if (!size_given && hint > 0) {
+      s = hint;
+    }
+  }
+  std::vector<real> v = read_vector<real>(fin);
+  if (v.size() % s != 0) {
+    std::cerr << "filter: error: " << v.size()
+	      << " elements are not records of " << s << '\n';
+    std::exit(1);
+  }
+
+  size_t nk = kernel.size();
+  size_t keep = (nk - 1) * s;
+  if (!continued || carried.size() != keep) {
+    if (continued && !carried.empty()) {
+      std::cerr << "filter: error: can't continue " << carried.size() / (nk - 1)
+		<< " components with " << s << '\n';
+      std::exit(1);
+    }
+    carried.assign(keep, 0);
+  }
+  std::vector<real> k(kernel.begin(), kernel.end());
+  std::vector<real> history(carried.begin(), carried.end());
+  // With -C, the output is delayed by half the kernel and the signal is
+  // followed by as many zero records.
+  size_t delay = centered ? (nk - 1) / 2 * s : 0;
+  std::vector<real> a(v.size() + delay);
+  real *hp = keep > 0 ? &history[0] : 0;
+  if (!v.empty()) {
+    filter_vector(&a[0], v.size(), &v[0], s, &k[0], hp);
+  }
+  if (delay > 0) {
+    std::vector<real> zeros(delay);
+    filter_vector(&a[v.size()], delay, &zeros[0], s, &k[0], hp);
+  }
+  if (continued) {
+    carried.assign(history.begin(), history.end());
+  }
+
+  size_t n = v.size();
+  const real *out = a.empty() ? 0 : &a[delay];
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", s, stdout);
+    pid::put_vector(n, out, s, stdout);
+  }
+  else {
+    put_vector_binary(n, out);
+  }
+  pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
+  std::fflush(stdout);
+}
+
+void process_file(FILE *fin) {
+  if (binary_float_input) {
+    process_file<float>(fin);
+  }
+  else {
+    process_file<double>(fin);
+  }
+}
+
+void process(const char *filename) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    process_file(stdin);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "filter: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_file(fin);
+  std::fclose(fin);
+}
+
+void read_kernel(const char *filename) {
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "filter: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  if (binary_float_input) {
+    std::vector<float> k = read_vector<float>(fin);
+    kernel.assign(k.begin(), k.end());
+  }
+  else {
+    kernel = read_vector<double>(fin);
+  }
+  std::fclose(fin);
+  if (kernel.empty()) {
+    std::cerr << "filter: error: empty kernel: " << filename << '\n';
+    std::exit(1);
+  }
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    size_given = true;
+    if (size_of_vector < 1) {
+      std::cerr << "filter: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'd':
+    method = VEC_FILTER_DIRECT;
+    break;
+  case 'f':
+    method = VEC_FILTER_FFT;
+    break;
+  case 'C':
+    centered = true;
+    break;
+  case 'c':
+    continued = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("filter");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "filter: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  int file_count = 0;
+  if (argc < 2) {
+    help();
+    std::exit(0);
+  }
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else if (kernel.empty()) {
+      read_kernel(*argv);
+    }
+    else {
+      ++file_count;
+      process(*argv);
+    }
+  }
+  if (kernel.empty()) {
+    help();
+    std::exit(1);
+  }
+  if (file_count == 0) {
+    process_file(stdin);
+  }
+  return 0;
+}
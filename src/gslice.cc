@@ -4,10 +4,13 @@
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
-#include "vec.h"
+#include "vec++.hh"
 
 static bool binary_input = false;
+static bool binary_float_input = false;
 static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
 
 static bool stop_parsing_options = false;
 
@@ -16,8 +19,8 @@ static std::valarray<size_t> *lengths = 0;
 static std::valarray<size_t> *strides = 0;
 
 void help() {
-  std::cerr << "usage: gslice [-o{OFFSET}] [-L{LENGTHS}] [-S{STRIDES}] [-b]\n"
-    "\t[-B] [--] {FILENAME}\n"
+  std::cerr << "usage: gslice [-o{OFFSET}] [-L{LENGTHS}] [-S{STRIDES}] [-b[s]]\n"
+    "\t[-B[s|d]] [-P] [--] {FILENAME}\n"
     "\tslice slices vectorstream file {FILENAME} with offset {OFFSET},\n"
     "\tlength {LENGTH}, and stride {STRIDE}.\n"
     "\t-o{OFFSET}: Specifies offset. {OFFSET} must be equal to or greater\n"
@@ -27,53 +30,120 @@ void help() {
     "\t-S{STRIDES}: Specifies strides. {STRIDES} must be separated by ':',\n"
     "\te.g. -S2:3:5. Each stride must be greater than 0.\n"
     "\t-b: Binary input.\n"
-    "\t-B: DO NOT USE. Binary output. Machine dependent.\n";
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
 }
 
-void process_vector(size_t N, double *v) {
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+template <typename real> void process_vector(size_t N, real *v, size_t o) {
   if ((*lengths)[0] == 0) {
     (*lengths)[0] = N / (*strides)[0];
   }
 
-  std::valarray<double> va(v, N);
-  std::valarray<double> sliced(va[std::gslice(offset, *lengths, *strides)]);
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+  std::valarray<real> va(v, N);
+  std::valarray<real> sliced(va[std::gslice(o, *lengths, *strides)]);
 
-  double *vf = static_cast<double *>(calloc(sliced.size(), sizeof(double)));
+  real *vf = static_cast<real *>(calloc(sliced.size(), sizeof(real)));
   for (size_t i = 0; i < sliced.size(); ++i) {
     vf[i] = sliced[i];
   }
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, sliced.size(),
+		       (N + 2 * sliced.size()) * sizeof(real));
   if (!binary_output) {
     pid::vec_put_header_to_file(stdout);
-    pid::vec_put_double_vector_to_file(sliced.size(), vf, 0, stdout);
+    pid::put_vector(sliced.size(), vf, 0, stdout);
   }
   else {
-    pid::vec_put_double_vector_to_file_binary(sliced.size(), vf, stdout);
+    put_vector_binary(sliced.size(), vf);
   }
   std::fflush(stdout);
+  std::free(vf);
 }
 
-void process_file(FILE *fin) {
+template <typename real> void process_file(FILE *fin) {
   size_t N;
-  double *v;
+  real *v;
   if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N, &v, fin);
+    pid::new_vector(&N, &v, fin);
   }
   else {
-    pid::vec_new_double_vector_from_file_binary(&N, &v, fin);
+    pid::new_vector_binary(&N, &v, fin);
   }
-  process_vector(N, v);
+  process_vector(N, v, offset);
   pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
   std::free(v);
 }
 
+// Reads only the elements the slice touches from a chunk-indexed file.
+template <typename real> void process_chunked_file(FILE *fin) {
+  size_t N;
+  pid::vec_get_chunked_vector_length(fin, &N);
+  if ((*lengths)[0] == 0) {
+    (*lengths)[0] = N / (*strides)[0];
+  }
+  size_t span = 1;
+  for (size_t k = 0; k < lengths->size() && k < strides->size(); ++k) {
+    if ((*lengths)[k] == 0) {
+      span = 0;
+      break;
+    }
+    span += ((*lengths)[k] - 1) * (*strides)[k];
+  }
+
+  size_t n;
+  real *v;
+  pid::new_vector_range_chunked(offset, span, &n, &v, fin);
+  if (n < span) {
+    std::cerr << "gslice: error: the slice exceeds the vector\n";
+    std::exit(1);
+  }
+  process_vector(n, v, 0);
+  std::free(v);
+}
+
+void process_file(FILE *fin) {
+  if (binary_float_input) {
+    process_file<float>(fin);
+  }
+  else {
+    process_file<double>(fin);
+  }
+}
+
 void process(const char *filename) {
   FILE *fin;
-  fin = std::fopen(filename, "r");
+  fin = pid::open_file(filename);
   if (!fin) {
     std::cerr << "gslice: error: can't open: " << filename << '\n';
     std::exit(1);
   }
-  process_file(fin);
+  if (pid::vec_is_chunked_file(fin)) {
+    if (binary_float_input) {
+      process_chunked_file<float>(fin);
+    }
+    else {
+      process_chunked_file<double>(fin);
+    }
+  }
+  else {
+    process_file(fin);
+  }
   std::fclose(fin);
 }
 
@@ -114,9 +184,21 @@ void parse_option(char *option) {
     break;
   case 'b':
     binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
     break;
   case 'B':
     binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("gslice");
     break;
   case 'h':
     help();
@@ -133,6 +215,7 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   int file_count = 0;
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-') {
@@ -0,0 +1,419 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static size_t size_of_vector = 1;
+static bool size_given = false;
+static size_t bins = 10;
+static bool range_given = false;
+static double range_min = 0;
+static double range_max = 0;
+static bool log_bins = false;
+static const char *edges_filename = 0;
+static bool sum_all = false;
+static size_t threads = 1;
+
+static std::vector<double> edges;
+// The counts of all files with -a.
+static std::vector<size_t> total;
+static size_t total_components = 0;
+
+// Elements read from a chunk-indexed file at a time.
+static const size_t piece_length = 1 << 22;
+
+void help() {
+  std::cerr << "usage: histogram [-s{SIZE_OF_VECTOR}] [-n{BINS}] [-r{MIN}:{MAX}] [-l]\n"
+    "\t[-e{EDGES}] [-a] [-j[N]] [-b[s]] [-B[s|d]] [-P] [--] [{FILENAME}...]\n"
+    "\thistogram counts the elements of each component of the vectors in\n"
+    "\tbins, and writes the counts as a vector of dimension BINS, one row\n"
+    "\tper component. Histograms with the same bins can be summed by add.\n"
+    "\tBin i is [EDGE_i, EDGE_i+1), the last bin includes MAX, and the\n"
+    "\telements out of range are not counted.\n"
+    "\t-s{SIZE_OF_VECTOR}: Number of components. (Default: the dimension\n"
+    "\thint of the file, or 1)\n"
+    "\t-n{BINS}: Number of bins. (Default: 10)\n"
+    "\t-r{MIN}:{MAX}: Range of the bins. (Default: the range of each file)\n"
+    "\t-l: Logarithmic bins. MIN must be positive.\n"
+    "\t-e{EDGES}: The edges of the bins, ascending, from vector file {EDGES}.\n"
+    "\t-a: Sums the histograms of all files. Needs -r or -e.\n"
+    "\t-j[N]: Counts on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision).\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+void put_counts(const std::vector<size_t> &counts, size_t nb) {
+  std::vector<double> v(counts.begin(), counts.end());
+  const double *p = v.empty() ? 0 : &v[0];
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", nb, stdout);
+    pid::put_vector(v.size(), p, nb, stdout);
+  }
+  else if (binary_float_output) {
+    pid::put_vector_binary_as<float>(v.size(), p, stdout);
+  }
+  else {
+    pid::put_vector_binary(v.size(), p, stdout);
+  }
+  std::fflush(stdout);
+}
+
+// Sets up the edges of the bins for [lo, hi]; empty for uniform bins.
+void set_bins(double lo, double hi) {
+  if (!(lo < hi)) {
+    // a single value, or no elements; one unit around it
+    lo = lo == lo ? lo - 0.5 : 0;
+    hi = lo + 1;
+  }
+  range_min = lo;
+  range_max = hi;
+  if (log_bins) {
+    if (lo <= 0) {
+      std::cerr << "histogram: error: logarithmic bins need a positive minimum\n";
+      std::exit(1);
+    }
+    edges.resize(bins + 1);
+    for (size_t i = 0; i <= bins; ++i) {
+      edges[i] = lo * std::pow(hi / lo, static_cast<double>(i) / bins);
+    }
+    edges[bins] = hi;
+  }
+}
+
+// Adds the histograms of the n elements of v to counts, each thread
+// counting a part of the records into its own counters.
+template <typename real> void count(std::vector<size_t> &counts, size_t n,
+				    const real *v, size_t s) {
+  size_t nb = edges.empty() ? bins : edges.size() - 1;
+  std::vector<real> e(edges.begin(), edges.end());
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "histogram: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t records = n / s;
+  size_t parts = std::min(threads, (records + 65535) / 65536);
+  if (parts < 1) {
+    parts = 1;
+  }
+  size_t rows = (records + parts - 1) / parts;
+  std::vector<std::vector<size_t> > local(parts,
+					  std::vector<size_t>(nb * s));
+  pid::parallel_for(parts, parts, [&](size_t t) {
+      size_t first = std::min(records, t * rows);
+      size_t m = (std::min(records, first + rows) - first) * s;
+      if (e.empty()) {
+	pid::histogram_uniform(&local[t][0], nb, static_cast<real>(range_min),
+			       static_cast<real>(range_max), s, m,
+			       v + first * s);
+      }
+      else {
+	pid::histogram_edges(&local[t][0], nb, &e[0], s, m, v + first * s);
+      }
+    });
+  for (size_t t = 0; t < parts; ++t) {
+    for (size_t i = 0; i < counts.size(); ++i) {
+      counts[i] += local[t][i];
+    }
+  }
+}
+
+void finish(std::vector<size_t> &counts, size_t s) {
+  size_t nb = edges.empty() ? bins : edges.size() - 1;
+  if (!sum_all) {
+    put_counts(counts, nb);
+    return;
+  }
+  if (total.empty()) {
+    total.resize(counts.size());
+    total_components = s;
+  }
+  if (s != total_components) {
+    std::cerr << "histogram: error: can't sum " << total_components
+	      << " components with " << s << '\n';
+    std::exit(1);
+  }
+  for (size_t i = 0; i < counts.size(); ++i) {
+    total[i] += counts[i];
+  }
+}
+
+// Reads a chunk-indexed file piece by piece.  Without -r, the range
+// comes from the chunk index.
+template <typename real> void process_chunked_file(FILE *fin) {
+  size_t N, element_size, chunks;
+  struct pid::vec_chunk *index;
+  pid::vec_new_chunk_index_from_file(fin, &N, &element_size, &chunks, &index);
+  if (!range_given && edges_filename == 0) {
+    double lo = 0, hi = 0;
+    for (size_t i = 0; i < chunks; ++i) {
+      if (i == 0 || index[i].min < lo) {
+	lo = index[i].min;
+      }
+      if (i == 0 || index[i].max > hi) {
+	hi = index[i].max;
+      }
+    }
+    set_bins(lo, hi);
+  }
+  pid::vec_delete_chunk_index(index);
+
+  size_t s = size_of_vector;
+  if (N % s != 0) {
+    std::cerr << "histogram: error: " << N << " elements are not records of "
+	      << s << '\n';
+    std::exit(1);
+  }
+  size_t nb = edges.empty() ? bins : edges.size() - 1;
+  std::vector<size_t> counts(nb * s);
+  size_t piece = std::max<size_t>(piece_length - piece_length % s, s);
+  for (size_t first = 0; first < N; first += piece) {
+    size_t n;
+    real *v;
+    pid::new_vector_range_chunked(first, std::min(piece, N - first), &n, &v,
+				  fin);
+    count(counts, n - n % s, v, s);
+    std::free(v);
+  }
+  finish(counts, s);
+}
+
+template <typename real> void process_file(FILE *fin) {
+  size_t s = size_of_vector;
+  size_t N;
+  real *v;
+
+  if (!binary_input) {
+    size_t hint = pid::dimension_hint(fin);
+    if (!size_given && hint > 0) {
+      s = hint;
+    }
+    pid::new_vector(&N, &v, fin);
+  }
+  else {
+    pid::new_vector_binary(&N, &v, fin);
+  }
+  if (N == static_cast<size_t>(-1)) {
+    N = 0;
+  }
+  if (N % s != 0) {
+    std::cerr << "histogram: error: " << N << " elements are not records of "
+	      << s << '\n';
+    std::exit(1);
+  }
+  if (!range_given && edges_filename == 0) {
+    double lo = 0, hi = 0;
+    for (size_t i = 0; i < N; ++i) {
+      if (i == 0 || v[i] < lo) {
+	lo = v[i];
+      }
+      if (i == 0 || v[i] > hi) {
+	hi = v[i];
+      }
+    }
+    set_bins(lo, hi);
+  }
+  size_t nb = edges.empty() ? bins : edges.size() - 1;
+  std::vector<size_t> counts(nb * s);
+  count(counts, N, v, s);
+  std::free(v);
+  finish(counts, s);
+}
+
+void process_file(FILE *fin) {
+  if (binary_input && pid::vec_is_chunked_file(fin)) {
+    if (binary_float_input) {
+      process_chunked_file<float>(fin);
+    }
+    else {
+      process_chunked_file<double>(fin);
+    }
+  }
+  else if (binary_float_input) {
+    process_file<float>(fin);
+  }
+  else {
+    process_file<double>(fin);
+  }
+}
+
+void process(const char *filename) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    process_file(stdin);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "histogram: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_file(fin);
+  std::fclose(fin);
+}
+
+void read_edges(const char *filename) {
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "histogram: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  size_t N;
+  double *v;
+  pid::new_vector(&N, &v, fin);
+  std::fclose(fin);
+  if (N == static_cast<size_t>(-1) || N < 2) {
+    std::cerr << "histogram: error: need two edges or more: " << filename
+	      << '\n';
+    std::exit(1);
+  }
+  edges.assign(v, v + N);
+  std::free(v);
+  for (size_t i = 1; i < N; ++i) {
+    if (!(edges[i - 1] < edges[i])) {
+      std::cerr << "histogram: error: edges must ascend: " << filename << '\n';
+      std::exit(1);
+    }
+  }
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    size_given = true;
+    if (size_of_vector < 1) {
+      std::cerr << "histogram: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'n':
+    bins = std::atoi(option + 1);
+    if (bins < 1) {
+      std::cerr << "histogram: error: number of bins must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'r':
+    if (std::sscanf(option + 1, "%lf:%lf", &range_min, &range_max) != 2 ||
+	!(range_min < range_max)) {
+      std::cerr << "histogram: error: bad range: " << option + 1 << '\n';
+      std::exit(1);
+    }
+    range_given = true;
+    break;
+  case 'l':
+    log_bins = true;
+    break;
+  case 'e':
+    edges_filename = option + 1;
+    break;
+  case 'a':
+    sum_all = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("histogram");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "histogram: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> files;
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      files.push_back(*argv);
+    }
+  }
+  if (files.empty()) {
+    files.push_back("-");
+  }
+  if (edges_filename) {
+    read_edges(edges_filename);
+  }
+  else if (range_given) {
+    set_bins(range_min, range_max);
+  }
+  else if (sum_all) {
+    std::cerr << "histogram: error: -a needs -r or -e\n";
+    std::exit(1);
+  }
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    process(files[i]);
+  }
+  if (sum_all) {
+    put_counts(total, edges.empty() ? bins : edges.size() - 1);
+  }
+  return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <vector>
+#include "vec++.hh"
+#include "veckdtree.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static bool verbose = false;
+static bool put_indices = true;
+static bool put_distances = true;
+static size_t neighbours = 1;
+static double radius = -1;
+static size_t threads = 1;
+
+void help() {
+  std::cerr << "usage: kdquery [-k{K}|-r{RADIUS}] [-I|-D] [-j[N]] [-b[s]]\n"
+    "\t[-B[s|d]] [-P] [--] {INDEX} {QUERIES}\n"
+    "\tkdquery looks up the points of vector file {QUERIES} in the k-d tree\n"
+    "\t{INDEX} built by kdtree.\n"
+    "\t-k{K}: Finds the {K} nearest points of each query. Writes their\n"
+    "\tindices, nearest first, and then their distances, as two vectors\n"
+    "\tof dimension {K}. (Default: 1)\n"
+    "\t-r{RADIUS}: Finds the points within {RADIUS} of each query.\n"
+    "\tWrites the number of points found for each query, and then their\n"
+    "\tindices and distances, nearest first, as three vectors.\n"
+    "\t-I: Writes only the indices (and numbers).\n"
+    "\t-D: Writes only the distances (and numbers).\n"
+    "\t-j[N]: Computes on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision).\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
+}
+
+void put_result(size_t n, const double *v, size_t dimension) {
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", dimension, stdout);
+    pid::put_vector(n, v, dimension, stdout);
+  }
+  else if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+// Runs job(i) for each query i on the threads, in blocks.
+template <typename Job> void for_each_query(size_t nq, Job job) {
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "kdquery: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t queries = (nq + 4 * threads - 1) / (4 * threads);
+  if (queries < 64) {
+    queries = 64;
+  }
+  size_t blocks = (nq + queries - 1) / queries;
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+  pid::parallel_for(threads, blocks, [&](size_t b) {
+      std::vector<pid::kdtree::neighbour> result;
+      for (size_t i = b * queries; i < std::min(nq, (b + 1) * queries); ++i) {
+	job(i, result);
+      }
+    });
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, nq, 0);
+}
+
+void process_queries(const pid::kdtree &tree, size_t nq, const double *q) {
+  size_t d = tree.dimension();
+  if (radius < 0) {
+    size_t k = std::min(neighbours, tree.size());
+    std::vector<double> index(nq * k), distance(nq * k);
+    for_each_query(nq, [&](size_t i,
+			   std::vector<pid::kdtree::neighbour> &result) {
+	tree.nearest(q + i * d, k, result);
+	for (size_t j = 0; j < k; ++j) {
+	  index[i * k + j] = result[j].second;
+	  distance[i * k + j] = std::sqrt(result[j].first);
+	}
+      });
+    if (put_indices) {
+      put_result(index.size(), index.empty() ? 0 : &index[0], k);
+    }
+    if (put_distances) {
+      put_result(distance.size(), distance.empty() ? 0 : &distance[0], k);
+    }
+  }
+  else {
+    std::vector<std::vector<pid::kdtree::neighbour> > found(nq);
+    for_each_query(nq, [&](size_t i,
+			   std::vector<pid::kdtree::neighbour> &) {
+	tree.within(q + i * d, radius, found[i]);
+      });
+    std::vector<double> count(nq), index, distance;
+    for (size_t i = 0; i < nq; ++i) {
+      count[i] = found[i].size();
+      for (size_t j = 0; j < found[i].size(); ++j) {
+	index.push_back(found[i][j].second);
+	distance.push_back(std::sqrt(found[i][j].first));
+      }
+    }
+    put_result(count.size(), count.empty() ? 0 : &count[0], 1);
+    if (put_indices) {
+      put_result(index.size(), index.empty() ? 0 : &index[0], 1);
+    }
+    if (put_distances) {
+      put_result(distance.size(), distance.empty() ? 0 : &distance[0], 1);
+    }
+  }
+  std::fflush(stdout);
+}
+
+void process_files(const pid::kdtree &tree, FILE *fin) {
+  size_t N;
+  std::vector<double> v;
+  if (binary_float_input) {
+    float *w;
+    pid::new_vector_binary(&N, &w, fin);
+    if (N != static_cast<size_t>(-1)) {
+      v.assign(w, w + N);
+    }
+    std::free(w);
+  }
+  else {
+    double *w;
+    if (!binary_input) {
+      pid::new_vector(&N, &w, fin);
+    }
+    else {
+      pid::new_vector_binary(&N, &w, fin);
+    }
+    if (N != static_cast<size_t>(-1)) {
+      v.assign(w, w + N);
+    }
+    std::free(w);
+  }
+  if (v.size() % tree.dimension() != 0) {
+    std::cerr << "kdquery: error: the number of elements is not a multiple of "
+	      << tree.dimension() << '\n';
+    std::exit(1);
+  }
+  process_queries(tree, v.size() / tree.dimension(),
+		  v.empty() ? 0 : &v[0]);
+}
+
+void process(const char *index_filename, const char *filename) {
+  int fd = open(index_filename, O_RDONLY);
+  pid::kdtree tree;
+  if (fd < 0 || !tree.map(fd)) {
+    std::cerr << "kdquery: error: not a k-d tree index: " << index_filename
+	      << '\n';
+    std::exit(1);
+  }
+  close(fd);
+  if (verbose) {
+    std::cerr << "kdquery: " << tree.size() << " points of dimension "
+	      << tree.dimension() << '\n';
+  }
+  if (filename[0] == '-' && filename[1] == '\0') {
+    process_files(tree, stdin);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "kdquery: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_files(tree, fin);
+  std::fclose(fin);
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 'k':
+    neighbours = std::atoi(option + 1);
+    radius = -1;
+    if (neighbours < 1) {
+      std::cerr << "kdquery: error: number of neighbours must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'r':
+    radius = std::atof(option + 1);
+    if (radius < 0) {
+      std::cerr << "kdquery: error: radius must not be negative.\n";
+      std::exit(1);
+    }
+    break;
+  case 'I':
+    put_indices = true;
+    put_distances = false;
+    break;
+  case 'D':
+    put_indices = false;
+    put_distances = true;
+    break;
+  case 'v':
+    verbose = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("kdquery");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "kdquery: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  char *filenames[2];
+  int fnc = 0;
+
+  if (argc < 3) {
+    help();
+    std::exit(0);
+  }
+
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      if (fnc < 2) {
+	filenames[fnc] = *argv;
+	++fnc;
+      }
+      else {
+	std::cerr << "kdquery: warning: ignoring filename: " << *argv << '\n';
+      }
+    }
+  }
+  if (fnc < 2) {
+    help();
+    std::exit(1);
+  }
+  process(filenames[0], filenames[1]);
+  return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "vec++.hh"
+#include "veckdtree.hh"
+
+static bool stop_parsing_options = false;
+
+static bool verbose = false;
+static bool binary_input = false;
+static bool binary_float_input = false;
+static size_t size_of_vector = 0;
+static size_t leaf_size = pid::kdtree::default_leaf_size;
+static const char *output_filename = 0;
+
+void help() {
+  std::cerr << "usage: kdtree [-v] [-s{SIZE_OF_VECTOR}] [-l{LEAF}] [-o{INDEX}]\n"
+    "\t[-b[s]] [-P] [--] {FILENAME}...\n"
+    "\tkdtree builds a k-d tree index of the points in vector file\n"
+    "\t{FILENAME} and writes it to {FILENAME}.kdt, for kdquery. The\n"
+    "\tindex is mapped into memory as it is, so that loading it costs\n"
+    "\tnothing. It is machine dependent.\n"
+    "\t-v: Verbose mode.\n"
+    "\t-s{SIZE_OF_VECTOR}: Dimension of the points. (Default: the\n"
+    "\tdimension hint of {FILENAME}, or 3)\n"
+    "\t-l{LEAF}: Points per leaf. (Default: 8)\n"
+    "\t-o{INDEX}: Writes the index to {INDEX}. Needed for stdin.\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+void process_file(FILE *fin, const std::string &index_filename) {
+  size_t N;
+  std::vector<double> v;
+  size_t d = size_of_vector;
+
+  if (d == 0 && !binary_input) {
+    d = pid::dimension_hint(fin);
+  }
+  if (d == 0) {
+    d = 3;
+  }
+  if (binary_float_input) {
+    float *w;
+    pid::new_vector_binary(&N, &w, fin);
+    if (N != static_cast<size_t>(-1)) {
+      v.assign(w, w + N);
+    }
+    std::free(w);
+  }
+  else {
+    double *w;
+    if (!binary_input) {
+      pid::new_vector(&N, &w, fin);
+    }
+    else {
+      pid::new_vector_binary(&N, &w, fin);
+    }
+    if (N != static_cast<size_t>(-1)) {
+      v.assign(w, w + N);
+    }
+    std::free(w);
+  }
+  if (v.size() % d != 0) {
+    std::cerr << "kdtree: error: the number of elements is not a multiple of "
+	      << d << '\n';
+    std::exit(1);
+  }
+
+  FILE *fout = std::fopen(index_filename.c_str(), "w");
+  if (!fout) {
+    std::cerr << "kdtree: error: can't create: " << index_filename << '\n';
+    std::exit(1);
+  }
+  if (!pid::kdtree::write(v.size() / d, d, v.empty() ? 0 : &v[0], fout,
+			  leaf_size)) {
+    std::cerr << "kdtree: error: can't write: " << index_filename << '\n';
+    std::exit(1);
+  }
+  std::fclose(fout);
+  if (verbose) {
+    std::cerr << "kdtree: " << v.size() / d << " points of dimension " << d
+	      << " to " << index_filename << '\n';
+  }
+}
+
+void process(const char *filename) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    if (!output_filename) {
+      std::cerr << "kdtree: error: -o is needed for stdin\n";
+      std::exit(1);
+    }
+    process_file(stdin, output_filename);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "kdtree: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_file(fin, output_filename ? std::string(output_filename)
+	       : std::string(filename) + ".kdt");
+  std::fclose(fin);
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 'v':
+    verbose = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    if (size_of_vector < 1 || size_of_vector > 255) {
+      std::cerr << "kdtree: error: size of vector must be 1 to 255.\n";
+      std::exit(1);
+    }
+    break;
+  case 'l':
+    leaf_size = std::atoi(option + 1);
+    if (leaf_size < 1) {
+      leaf_size = 1;
+    }
+    break;
+  case 'o':
+    output_filename = option + 1;
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("kdtree");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "kdtree: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    help();
+    std::exit(0);
+  }
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      process(*argv);
+    }
+  }
+  return 0;
+}
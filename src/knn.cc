@@ -0,0 +1,290 @@
+/*
+ *  VectorStream 1.7
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2008 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static bool verbose = false;
+static bool put_indices = true;
+static bool put_distances = true;
+static size_t size_of_vector = 0;
+static size_t neighbours = 1;
+static size_t threads = 1;
+
+void help() {
+  std::cerr << "usage: knn [-k{K}] [-s{SIZE_OF_VECTOR}] [-I|-D] [-j[N]] [-b[s]]\n"
+    "\t[-B[s|d]] [-P] [--] {REFERENCE} {QUERIES}\n"
+    "\tknn finds the {K} nearest points of {REFERENCE} for each point of\n"
+    "\t{QUERIES}. The points are {SIZE_OF_VECTOR}-dimensional, or as given\n"
+    "\tby the dimension hint of {REFERENCE} if -s is not given. Writes the\n"
+    "\tindices of the neighbours, nearest first, and then their Euclidean\n"
+    "\tdistances, as two vectors of dimension {K}.\n"
+    "\t-k{K}: Number of neighbours. (Default: 1)\n"
+    "\t-s{SIZE_OF_VECTOR}: Dimension of the points. (Default: 3)\n"
+    "\t-I: Writes only the indices.\n"
+    "\t-D: Writes only the distances.\n"
+    "\t-j[N]: Computes on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
+}
+
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+template <typename real> void put_result(size_t n, const real *v) {
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", neighbours, stdout);
+    pid::put_vector(n, v, neighbours, stdout);
+  }
+  else {
+    put_vector_binary(n, v);
+  }
+}
+
+template <typename real>
+void process_points(size_t nr, const real *r, size_t nq, const real *q,
+		    size_t d) {
+  if (nr % d != 0 || nq % d != 0) {
+    std::cerr << "knn: error: the number of elements is not a multiple of "
+	      << d << '\n';
+    std::exit(1);
+  }
+  nr /= d;
+  nq /= d;
+  size_t k = neighbours;
+  if (k > nr) {
+    std::cerr << "knn: error: " << k << " neighbours of " << nr
+	      << " points\n";
+    std::exit(1);
+  }
+  std::vector<size_t> index(nq * k);
+  std::vector<real> distance(nq * k);
+
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "knn: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  // A few blocks per thread, so that idle threads can steal.
+  size_t queries = (nq + 4 * threads - 1) / (4 * threads);
+  if (queries < 64) {
+    queries = 64;
+  }
+  size_t blocks = (nq + queries - 1) / queries;
+  pid::parallel_for(threads, blocks, [&](size_t i) {
+      size_t n = std::min(queries, nq - i * queries);
+      pid::knn_points(&index[i * queries * k], &distance[i * queries * k], k,
+		      d, n, q + i * queries * d, nr, r);
+    });
+
+  if (put_indices) {
+    std::vector<real> v(index.begin(), index.end());
+    put_result(v.size(), v.empty() ? 0 : &v[0]);
+  }
+  if (put_distances) {
+    for (size_t i = 0; i < distance.size(); ++i) {
+      distance[i] = std::sqrt(distance[i]);
+    }
+    put_result(distance.size(), distance.empty() ? 0 : &distance[0]);
+  }
+  std::fflush(stdout);
+}
+
+template <typename real> void process_files(FILE *fin1, FILE *fin2) {
+  size_t N1, N2;
+  real *v1, *v2;
+  size_t d1 = 0, d2 = 0;
+  if (!binary_input) {
+    d1 = pid::dimension_hint(fin1);
+    d2 = pid::dimension_hint(fin2);
+    pid::new_vector(&N1, &v1, fin1);
+    pid::new_vector(&N2, &v2, fin2);
+  }
+  else {
+    pid::new_vector_binary(&N1, &v1, fin1);
+    pid::new_vector_binary(&N2, &v2, fin2);
+  }
+  size_t d = size_of_vector > 0 ? size_of_vector : d1 > 0 ? d1 : 3;
+  if (size_of_vector == 0 && d2 > 0 && d2 != d) {
+    std::cerr << "knn: error: the queries are " << d2
+	      << "-dimensional, the points " << d << "-dimensional\n";
+    std::exit(1);
+  }
+  process_points(N1, v1, N2, v2, d);
+  std::free(v1);
+  std::free(v2);
+}
+
+void process_files(FILE *fin1, FILE *fin2) {
+  if (binary_float_input) {
+    process_files<float>(fin1, fin2);
+  }
+  else {
+    process_files<double>(fin1, fin2);
+  }
+}
+
+FILE *open_or_exit(const char *filename) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    return stdin;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "knn: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  return fin;
+}
+
+void process(const char *filename1, const char *filename2) {
+  FILE *fin1 = open_or_exit(filename1);
+  FILE *fin2 = open_or_exit(filename2);
+  process_files(fin1, fin2);
+  if (fin1 != stdin) {
+    std::fclose(fin1);
+  }
+  if (fin2 != stdin) {
+    std::fclose(fin2);
+  }
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 'k':
+    neighbours = std::atoi(option + 1);
+    if (neighbours < 1) {
+      std::cerr << "knn: error: number of neighbours must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    if (size_of_vector < 1) {
+      std::cerr << "knn: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'I':
+    put_indices = true;
+    put_distances = false;
+    break;
+  case 'D':
+    put_indices = false;
+    put_distances = true;
+    break;
+  case 'v':
+    verbose = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("knn");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "knn: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  char *filenames[2];
+  int fnc = 0;
+
+  if (argc < 3) {
+    help();
+    std::exit(0);
+  }
+
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      if (fnc < 2) {
+	filenames[fnc] = *argv;
+	++fnc;
+      }
+      else {
+	std::cerr << "knn: warning: ignoring filename: " << *argv << '\n';
+      }
+    }
+  }
+  if (fnc < 2) {
+    help();
+    std::exit(1);
+  }
+  process(filenames[0], filenames[1]);
+  return 0;
+}
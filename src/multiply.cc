@@ -22,72 +22,271 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
-#include "vec.h"
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
 
 static bool binary_input = false;
+static bool binary_float_input = false;
 static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
 
 static bool multiply_all = false;
 static bool transpose = false;
+static bool matrix_product = false;
+static const char *translation_filename = 0;
+static bool homogeneous = false;
+static size_t threads = 1;
 
 static bool stop_parsing_options = false;
 static bool verbose = false;
 static size_t size_of_vector = 3;
+static bool size_given = false;
 
 void help() {
-  std::cerr << "usage: multiply [-s{SIZE_OF_VECTOR}] [-v] [-a] [-t] [-b]\n"
-    "\t[-B] [--] {FILENAME1} {FILENAME2}\n";
+  std::cerr << "usage: multiply [-s{SIZE_OF_VECTOR}] [-v] [-a] [-t] [-A{TRANSLATION}|-H]\n"
+    "\t[-M] [-j[N]] [-b[s]] [-B[s|d]] [-P] [--] {FILENAME1} {FILENAME2}\n"
+    "\t-A{TRANSLATION}: Affine transform. Adds the vectors of file\n"
+    "\t{TRANSLATION} (one vector for all, or one per vector) to the\n"
+    "\tproducts in the same pass.\n"
+    "\t-H: Homogeneous affine transform. The matrices are\n"
+    "\t(SIZE_OF_VECTOR + 1) x (SIZE_OF_VECTOR + 1) and hold the translation\n"
+    "\tin their last row (last column with -t).\n"
+    "\t-M: Matrix product. {FILENAME1} is an N x D matrix and {FILENAME2}\n"
+    "\ta D x K matrix, one row per dimension-long slice. D and K are\n"
+    "\ttaken from the dimension hints of the files (or D from -s and K\n"
+    "\tfrom the length of {FILENAME2}). Writes the N x K product.\n"
+    "\t-j[N]: Computes on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
 }
 
-void process_vectors(size_t n1, double *v1, size_t n2, double *v2) {
-  double *v = new double[n2];
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+template <typename real>
+void process_vectors(size_t n1, real *v1, size_t n2, real *v2) {
+  real *v = new real[n2];
 
   if (multiply_all) {
-    pid::vec_multiply_double_single_matrix_to_multi_vector(v, size_of_vector,
-							   n1, v1, n2, v2,
-							   static_cast<int>(transpose));
+    pid::multiply_single_matrix_to_multi_vector(v, size_of_vector,
+						n1, v1, n2, v2,
+						static_cast<int>(transpose));
   }
   else {
-    pid::vec_multiply_double_multi_matrix_to_multi_vector(v, size_of_vector,
-							  n1, v1, n2, v2,
-							  static_cast<int>(transpose));
+    pid::multiply_multi_matrix_to_multi_vector(v, size_of_vector,
+					       n1, v1, n2, v2, transpose);
   }
 		
   if (!binary_output) {
     pid::vec_put_header_to_file(stdout);
     pid::vec_put_hint_to_file("dimension", size_of_vector, stdout);
-    pid::vec_put_double_vector_to_file(n2, v, size_of_vector, stdout);
+    pid::put_vector(n2, v, size_of_vector, stdout);
   }
   else {
-    pid::vec_put_double_vector_to_file_binary(n2, v, stdout);
+    put_vector_binary(n2, v);
   }
   std::fflush(stdout);
   
   delete[] v;
 }
 
-void process_files(FILE *fin1, FILE *fin2) {
+// Writes m . v + b for the n2 / size_of_vector vectors v2.
+template <typename real>
+void process_affine(size_t n1, real *v1, size_t nb, real *b, size_t n2,
+		    real *v2) {
+  real *v = new real[n2];
+
+  if (multiply_all) {
+    pid::affine_single_matrix_to_multi_vector(v, size_of_vector, n1, v1,
+					      nb, b, n2, v2, transpose);
+  }
+  else {
+    pid::affine_multi_matrix_to_multi_vector(v, size_of_vector, n1, v1,
+					     nb, b, n2, v2, transpose);
+  }
+
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", size_of_vector, stdout);
+    pid::put_vector(n2, v, size_of_vector, stdout);
+  }
+  else {
+    put_vector_binary(n2, v);
+  }
+  std::fflush(stdout);
+
+  delete[] v;
+}
+
+// Splits the (d + 1) x (d + 1) homogeneous matrices of v1 into d x d
+// matrices and translations, and transforms v2 with them.
+template <typename real>
+void process_homogeneous(size_t n1, real *v1, size_t n2, real *v2) {
+  size_t d = size_of_vector;
+  size_t h = d + 1;
+  size_t count = n1 / (h * h);
+  if (multiply_all && count > 1) {
+    count = 1;
+  }
+  if (count == 0) {
+    std::cerr << "multiply: error: no " << h << " x " << h << " matrix\n";
+    std::exit(1);
+  }
+  std::vector<real> m(count * d * d), b(count * d);
+  for (size_t k = 0; k < count; ++k) {
+    const real *hk = v1 + k * h * h;
+    for (size_t i = 0; i < d; ++i) {
+      for (size_t j = 0; j < d; ++j) {
+	m[k * d * d + i * d + j] = hk[i * h + j];
+      }
+      // the translation, and the projective part that must be (0 ... 0 1)
+      b[k * d + i] = transpose ? hk[i * h + d] : hk[d * h + i];
+      real p = transpose ? hk[d * h + i] : hk[i * h + d];
+      if (p != 0) {
+	std::cerr << "multiply: error: matrix " << k << " is not affine\n";
+	std::exit(1);
+      }
+    }
+    if (hk[d * h + d] != 1) {
+      std::cerr << "multiply: error: matrix " << k << " is not affine\n";
+      std::exit(1);
+    }
+  }
+  process_affine(m.size(), &m[0], multiply_all ? d : b.size(), &b[0], n2, v2);
+}
+
+// Writes the product of the n1 / d x d matrix v1 and the d x n2 / d
+// matrix v2.  Rows of the product are split among the threads.
+template <typename real>
+void process_matrices(size_t n1, real *v1, size_t d, size_t n2, real *v2) {
+  if (d == 0 || n1 % d != 0 || n2 % d != 0 || n2 == 0) {
+    std::cerr << "multiply: error: can't multiply " << n1
+	      << " elements of dimension " << d << " by " << n2
+	      << " elements\n";
+    std::exit(1);
+  }
+  size_t m = n1 / d;
+  size_t n = n2 / d;
+  std::vector<real> c(m * n);
+
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "multiply: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  // A few blocks per thread, so that idle threads can steal.
+  size_t rows = (m + 4 * threads - 1) / (4 * threads);
+  if (rows < 64) {
+    rows = 64;
+  }
+  size_t blocks = (m + rows - 1) / rows;
+  pid::parallel_for(threads, blocks, [&](size_t i) {
+      size_t r = std::min(rows, m - i * rows);
+      pid::multiply_matrix_to_matrix(&c[i * rows * n], r, n, d,
+				     v1 + i * rows * d, v2);
+    });
+
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", n, stdout);
+    pid::put_vector(m * n, &c[0], n, stdout);
+  }
+  else {
+    put_vector_binary(m * n, &c[0]);
+  }
+  std::fflush(stdout);
+}
+
+template <typename real> void process_files(FILE *fin1, FILE *fin2) {
   size_t N1, N2;
-  double *v1, *v2;
+  real *v1, *v2;
+  size_t d1 = 0, d2 = 0;
+  pid::interleave_shared_vectors(threads);
+  if (matrix_product && !binary_input) {
+    d1 = pid::dimension_hint(fin1);
+    d2 = pid::dimension_hint(fin2);
+  }
   if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N1, &v1, fin1);
-    pid::vec_new_double_vector_from_file(&N2, &v2, fin2);
+    pid::new_vector(&N1, &v1, fin1);
+    pid::new_vector(&N2, &v2, fin2);
+  }
+  else {
+    pid::new_vector_binary(&N1, &v1, fin1);
+    pid::new_vector_binary(&N2, &v2, fin2);	
+  }
+  if (matrix_product) {
+    size_t d = (size_given || d1 == 0) ? size_of_vector : d1;
+    if (d2 > 0 && N2 != d * d2) {
+      std::cerr << "multiply: error: the second file is not a " << d << " x "
+		<< d2 << " matrix\n";
+      std::exit(1);
+    }
+    process_matrices(N1, v1, d, N2, v2);
+  }
+  else if (homogeneous) {
+    process_homogeneous(N1, v1, N2, v2);
+  }
+  else if (translation_filename) {
+    FILE *fin3 = pid::open_file(translation_filename);
+    if (!fin3) {
+      std::cerr << "multiply: error: can't open: " << translation_filename
+		<< '\n';
+      std::exit(1);
+    }
+    size_t N3;
+    real *v3;
+    if (!binary_input) {
+      pid::new_vector(&N3, &v3, fin3);
+    }
+    else {
+      pid::new_vector_binary(&N3, &v3, fin3);
+    }
+    std::fclose(fin3);
+    if (N3 != size_of_vector && N3 < N2) {
+      std::cerr << "multiply: error: " << N3 << " elements of translation for "
+		<< N2 << " elements\n";
+      std::exit(1);
+    }
+    process_affine(N1, v1, N3, v3, N2, v2);
+    std::free(v3);
   }
   else {
-    pid::vec_new_double_vector_from_file_binary(&N1, &v1, fin1);
-    pid::vec_new_double_vector_from_file_binary(&N2, &v2, fin2);	
+    process_vectors(N1, v1, N2, v2);
   }
-  process_vectors(N1, v1, N2, v2);
   pid::vec_scan_messages_from_file_and_put_to_file(fin1, stdout);
   pid::vec_scan_messages_from_file_and_put_to_file(fin2, stdout);
   std::free(v1);
   std::free(v2);
 }
 
+void process_files(FILE *fin1, FILE *fin2) {
+  if (binary_float_input) {
+    process_files<float>(fin1, fin2);
+  }
+  else {
+    process_files<double>(fin1, fin2);
+  }
+}
+
 void process(const char *filename1, const char *filename2) {
   if (filename1[0] == '-' && filename1[1] == '\0') {
     FILE *fin2;
-    fin2 = std::fopen(filename2, "r");
+    fin2 = pid::open_file(filename2);
     if (!fin2) {
       std::cerr << "multiply: error: can't open: " << filename2 << '\n';
       std::exit(1);
@@ -97,7 +296,7 @@ void process(const char *filename1, const char *filename2) {
   }
   else if (filename2[0] == '-' && filename2[1] == '\0') {
     FILE *fin1;
-    fin1 = std::fopen(filename1, "r");
+    fin1 = pid::open_file(filename1);
     if (!fin1) {
       std::cerr << "multiply: error: can't open: " << filename1 << '\n';
       std::exit(1);
@@ -107,8 +306,8 @@ void process(const char *filename1, const char *filename2) {
   }
   else {
     FILE *fin1, *fin2;
-    fin1 = std::fopen(filename1, "r");
-    fin2 = std::fopen(filename2, "r");
+    fin1 = pid::open_file(filename1);
+    fin2 = pid::open_file(filename2);
     if (!fin1) {
       std::cerr << "multiply: error: can't open: " << filename1 << '\n';
       std::exit(1);
@@ -130,6 +329,7 @@ static void parse_option(const char *option) {
     break;
   case 's':
     size_of_vector = std::atoi(option + 1);
+    size_given = true;
     if (size_of_vector < 2) {
       std::cerr << "multiply: error: size of vector must be greater than 1.\n";
       std::exit(1);
@@ -144,11 +344,43 @@ static void parse_option(const char *option) {
   case 't':
     transpose = true;
     break;
+  case 'M':
+    matrix_product = true;
+    break;
+  case 'A':
+    translation_filename = option + 1;
+    if (*translation_filename == '\0') {
+      std::cerr << "multiply: error: -A needs a file name.\n";
+      std::exit(1);
+    }
+    break;
+  case 'H':
+    homogeneous = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    pid::vec_set_threads(threads);
+    break;
   case 'b':
     binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
     break;
   case 'B':
     binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("multiply");
     break;
   case 'h':
     help();
@@ -168,6 +400,7 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
@@ -183,6 +416,10 @@ int main(int argc, char **argv) {
       }
     }
   }
+  if (homogeneous && translation_filename) {
+    std::cerr << "multiply: error: -A and -H can't be used together.\n";
+    std::exit(1);
+  }
   process(filenames[0], filenames[1]);
   return 0;
 }
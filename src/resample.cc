@@ -0,0 +1,291 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vec++.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static size_t size_of_vector = 1;
+static bool size_given = false;
+static size_t up = 1;
+static size_t down = 1;
+static size_t zeros = 8;
+static bool continued = false;
+static std::vector<const char *> files;
+
+// The state of the signal, carried from file to file with -c.
+static std::vector<double> history;
+static size_t phase = 0;
+static size_t records_in = 0;
+static size_t records_out = 0;
+static size_t components = 0;
+
+void help() {
+  std::cerr << "usage: resample -u{UP} -d{DOWN} [-s{SIZE_OF_VECTOR}] [-z{ZEROS}] [-c]\n"
+    "\t[-b[s]] [-B[s|d]] [-P] [--] [{FILENAME}...]\n"
+    "\tresample changes the sampling rate of each component of the vectors\n"
+    "\tby UP / DOWN, with a polyphase lowpass filter against aliasing.\n"
+    "\tOutput m is aligned with input m * DOWN / UP.\n"
+    "\t-u{UP}: Upsampling factor. (Default: 1)\n"
+    "\t-d{DOWN}: Downsampling factor. (Default: 1)\n"
+    "\t-s{SIZE_OF_VECTOR}: Number of components. (Default: the dimension\n"
+    "\thint of the file, or 1)\n"
+    "\t-z{ZEROS}: Zero crossings of the filter on each side; more is\n"
+    "\tsharper and slower. (Default: 8)\n"
+    "\t-c: Continues the signal from file to file, as if the files were\n"
+    "\tone long vector.\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+static size_t filter_length() {
+  return 2 * zeros * std::max(up, down) + 1;
+}
+
+// Resamples n elements of v and appends the output to a.
+template <typename real> void resample(std::vector<real> &a, size_t n,
+				       const real *v, size_t s,
+				       const std::vector<real> &h,
+				       std::vector<real> &state) {
+  size_t na;
+  size_t start = a.size();
+  a.resize(start + ((n / s * up + down - 1) / down + 1) * s);
+  pid::resample_multi_vector(&a[start], &na, s, n, v, up, down, h.size(),
+			     &h[0], state.empty() ? 0 : &state[0], &phase);
+  a.resize(start + na);
+}
+
+template <typename real> void process_file(FILE *fin, bool first, bool last) {
+  size_t s = size_of_vector;
+  size_t N;
+  real *v;
+
+  if (!binary_input) {
+    size_t hint = pid::dimension_hint(fin);
+    if (!size_given && hint > 0) {
+      s = hint;
+    }
+    pid::new_vector(&N, &v, fin);
+  }
+  else {
+    pid::new_vector_binary(&N, &v, fin);
+  }
+  if (N == static_cast<size_t>(-1)) {
+    N = 0;
+  }
+  if (N % s != 0) {
+    std::cerr << "resample: error: " << N << " elements are not records of "
+	      << s << '\n';
+    std::exit(1);
+  }
+
+  std::vector<real> h(filter_length());
+  pid::resample_filter(&h[0], h.size(), up, down);
+  size_t q = (h.size() + up - 1) / up;
+  if (first || !continued) {
+    // Starting half the filter late aligns the output with the input.
+    history.assign((q - 1) * s, 0);
+    phase = (h.size() - 1) / 2;
+    records_in = 0;
+    records_out = 0;
+    components = s;
+  }
+  else if (s != components) {
+    std::cerr << "resample: error: can't continue " << components
+	      << " components with " << s << '\n';
+    std::exit(1);
+  }
+
+  std::vector<real> state(history.begin(), history.end());
+  std::vector<real> a;
+  resample(a, N, v, s, h, state);
+  records_in += N / s;
+  if (last || !continued) {
+    // Zeros past the end push out the outputs held back by the delay.
+    size_t total = (records_in * up + down - 1) / down;
+    std::vector<real> tail((phase / up + q + 1) * s);
+    while (records_out + a.size() / s < total) {
+      resample(a, tail.size(), &tail[0], s, h, state);
+    }
+    a.resize((total - records_out) * s);
+  }
+  records_out += a.size() / s;
+  history.assign(state.begin(), state.end());
+
+  const real *out = a.empty() ? 0 : &a[0];
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", s, stdout);
+    pid::put_vector(a.size(), out, s, stdout);
+  }
+  else {
+    put_vector_binary(a.size(), out);
+  }
+  pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
+  std::fflush(stdout);
+  std::free(v);
+}
+
+void process_file(FILE *fin, bool first, bool last) {
+  if (binary_float_input) {
+    process_file<float>(fin, first, last);
+  }
+  else {
+    process_file<double>(fin, first, last);
+  }
+}
+
+void process(const char *filename, bool first, bool last) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    process_file(stdin, first, last);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "resample: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_file(fin, first, last);
+  std::fclose(fin);
+}
+
+static size_t parse_factor(const char *option) {
+  int f = std::atoi(option + 1);
+  if (f < 1) {
+    std::cerr << "resample: error: -" << *option
+	      << " must be greater than 0.\n";
+    std::exit(1);
+  }
+  return f;
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    size_given = true;
+    if (size_of_vector < 1) {
+      std::cerr << "resample: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'u':
+    up = parse_factor(option);
+    break;
+  case 'd':
+    down = parse_factor(option);
+    break;
+  case 'z':
+    zeros = parse_factor(option);
+    break;
+  case 'c':
+    continued = true;
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("resample");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "resample: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    help();
+    std::exit(0);
+  }
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      files.push_back(*argv);
+    }
+  }
+  if (files.empty()) {
+    files.push_back("-");
+  }
+
+  size_t g = up;
+  for (size_t r = down; r != 0; ) {
+    size_t t = g % r;
+    g = r;
+    r = t;
+  }
+  up /= g;
+  down /= g;
+  for (size_t i = 0; i < files.size(); ++i) {
+    process(files[i], i == 0, i + 1 == files.size());
+  }
+  return 0;
+}
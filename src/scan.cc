@@ -0,0 +1,272 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static size_t size_of_vector = 1;
+static bool size_given = false;
+static int operation = VEC_SCAN_SUM;
+static bool exclusive = false;
+static bool continued = false;
+static size_t threads = 1;
+
+// The running state carried from file to file with -c.
+static std::vector<double> carried;
+
+void help() {
+  std::cerr << "usage: scan [-s{SIZE_OF_VECTOR}] [-m|-M] [-e] [-c] [-j[N]] [-b[s]]\n"
+    "\t[-B[s|d]] [-P] [--] [{FILENAME}...]\n"
+    "\tscan writes the cumulative sums of each component of the vectors.\n"
+    "\t-s{SIZE_OF_VECTOR}: Number of components. (Default: the dimension\n"
+    "\thint of the file, or 1)\n"
+    "\t-m: Cumulative minimums instead.\n"
+    "\t-M: Cumulative maximums instead.\n"
+    "\t-e: Exclusive scan. Each output leaves out its own input, so the\n"
+    "\tfirst one is 0 (inf for -m, -inf for -M).\n"
+    "\t-c: Continues the scan from file to file, as if the files were\n"
+    "\tone long vector.\n"
+    "\t-j[N]: Scans on N threads (Default: one per CPU). Sums may differ\n"
+    "\tfrom the ones on one thread by rounding.\n"
+    "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+// Scans the n elements of v in place, starting from carry.  On more than
+// one thread, each block is scanned from the identity first; the carries
+// into the blocks are then the exclusive scan of the block totals, and
+// are combined into the blocks in a second pass.
+template <typename real> void scan_vector(size_t n, real *v, size_t s,
+					  real *carry) {
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "scan: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t records = n / s;
+  size_t rows = (records + 4 * threads - 1) / (4 * threads);
+  if (rows < 4096) {
+    rows = 4096;
+  }
+  size_t blocks = (records + rows - 1) / rows;
+  if (threads <= 1 || blocks <= 1) {
+    pid::scan_multi_vector(v, s, n, v, operation, exclusive, carry);
+    return;
+  }
+
+  std::vector<real> totals(blocks * s);
+  pid::parallel_for(threads, blocks, [&](size_t b) {
+      real *p = v + b * rows * s;
+      size_t m = std::min(rows, records - b * rows) * s;
+      pid::scan_identity(&totals[b * s], s, operation);
+      pid::scan_multi_vector(p, s, m, p, operation, exclusive,
+			     &totals[b * s]);
+    });
+  pid::scan_multi_vector(&totals[0], s, totals.size(), &totals[0], operation,
+			 true, carry);
+  pid::parallel_for(threads, blocks, [&](size_t b) {
+      real *p = v + b * rows * s;
+      size_t m = std::min(rows, records - b * rows) * s;
+      pid::scan_combine(p, s, m, &totals[b * s], operation);
+    });
+}
+
+template <typename real> void process_file(FILE *fin) {
+  size_t N;
+  real *v;
+  size_t s = size_of_vector;
+
+  if (!binary_input) {
+    size_t hint = pid::dimension_hint(fin);
+    if (!size_given && hint > 0) {
+      s = hint;
+    }
+    pid::new_vector(&N, &v, fin);
+  }
+  else {
+    pid::new_vector_binary(&N, &v, fin);
+  }
+  if (N == static_cast<size_t>(-1)) {
+    return;
+  }
+  if (N % s != 0) {
+    std::cerr << "scan: error: " << N << " elements are not records of "
+	      << s << '\n';
+    std::exit(1);
+  }
+
+  if (!continued || carried.size() != s) {
+    if (continued && !carried.empty()) {
+      std::cerr << "scan: error: can't continue " << carried.size()
+		<< " components with " << s << '\n';
+      std::exit(1);
+    }
+    std::vector<real> c(s);
+    pid::scan_identity(&c[0], s, operation);
+    carried.assign(c.begin(), c.end());
+  }
+  std::vector<real> carry(carried.begin(), carried.end());
+  scan_vector(N, v, s, &carry[0]);
+  if (continued) {
+    carried.assign(carry.begin(), carry.end());
+  }
+
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", s, stdout);
+    pid::put_vector(N, v, s, stdout);
+  }
+  else {
+    put_vector_binary(N, v);
+  }
+  pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
+  std::fflush(stdout);
+  std::free(v);
+}
+
+void process_file(FILE *fin) {
+  if (binary_float_input) {
+    process_file<float>(fin);
+  }
+  else {
+    process_file<double>(fin);
+  }
+}
+
+void process(const char *filename) {
+  if (filename[0] == '-' && filename[1] == '\0') {
+    process_file(stdin);
+    return;
+  }
+  FILE *fin = pid::open_file(filename);
+  if (!fin) {
+    std::cerr << "scan: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+  process_file(fin);
+  std::fclose(fin);
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    size_given = true;
+    if (size_of_vector < 1) {
+      std::cerr << "scan: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'm':
+    operation = VEC_SCAN_MIN;
+    break;
+  case 'M':
+    operation = VEC_SCAN_MAX;
+    break;
+  case 'e':
+    exclusive = true;
+    break;
+  case 'c':
+    continued = true;
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("scan");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "scan: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  int file_count = 0;
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else {
+      ++file_count;
+      process(*argv);
+    }
+  }
+  if (file_count == 0) {
+    process_file(stdin);
+  }
+  return 0;
+}
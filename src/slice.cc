@@ -21,20 +21,28 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
-#include "vec.h"
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
 
 static bool stop_parsing_options = false;
 
 static bool binary_input = false;
+static bool binary_float_input = false;
 static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
 
 static size_t offset = 0;
 static size_t length = 0;
 static size_t stride = 1;
+static bool sparse = false;
+static size_t threads = 0;
+static std::vector<const char *> files;
 
 void help() {
-  std::cerr << "usage: slice [-o{OFFSET}] [-l{LENGTH}] [-s{STRIDE}] [-b]\n"
-    "\t[-B]\n {FILENAME}\n"
+  std::cerr << "usage: slice [-o{OFFSET}] [-l{LENGTH}] [-s{STRIDE}] [-b[s]]\n"
+    "\t[-B[s|d]] [-z] [-j[N]] [-P] {FILENAME}\n"
     "\tslice slices vectorstream file {FILENAME} (or stdin if {FILENAME}\n"
     "\twas -) with offset OFFSET, length LENGTH, and stride STRIDE.\n"
     "\t-o{OFFSET}: Sets offset. {OFFSET} must be equal to or greater than 0.\n"
@@ -44,59 +52,250 @@ void help() {
     "\t-s{STRIDE}: Sets stride. {STRIDE} must be greater than 0.\n"
     "\t(Default: 1)\n"
     "\t-b: Binary input.\n"
-    "\t-B: DO NOT USE. Binary output. Machine dependent.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-z: Sparse. Reads the vector as its nonzero elements and writes\n"
+    "\tthe slice sparse. A chunk-indexed file is read dense, and the slice\n"
+    "\twritten sparse.\n"
+    "\t-j[N]: Processes the files on N threads (Default: one per CPU).\n"
+    "\tThe output keeps the order of the files. Options given after -j\n"
+    "\tapply to all files. A single file is sliced on N threads.\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
     "\t-: stdin.\n";
 }
 
-void process_vector(size_t N, double *v) {
-  if (length == 0) {
-    length = N / stride;
+template <typename real> void put_vector_binary(size_t n, const real *v,
+					     FILE *fout) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, fout);
   }
-  double *vs = new double[length];
-  pid::vec_slice_double_vector(vs, v, offset, length, stride);
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, fout);
+  }
+  else {
+    pid::put_vector_binary(n, v, fout);
+  }
+}
+
+template <typename real> void put_slice(const real *v, size_t o, size_t l,
+				       FILE *fout) {
+  real *vs = new real[l];
+  pid::slice_vector(vs, v, o, l, stride);
   if (!binary_output) {
-    pid::vec_put_header_to_file(stdout);
-    pid::vec_put_hint_to_file("dimension", stride, stdout);
-    pid::vec_put_double_vector_to_file(length, vs, 0, stdout);
-    std::fflush(stdout);
+    pid::vec_put_header_to_file(fout);
+    pid::vec_put_hint_to_file("dimension", stride, fout);
+    pid::put_vector(l, vs, 0, fout);
+    std::fflush(fout);
   }
   else {
-    pid::vec_put_double_vector_to_file_binary(length, vs, stdout);
-    std::fflush(stdout);
+    put_vector_binary(l, vs, fout);
+    std::fflush(fout);
   }
   delete[] vs;
 }
 
-void process_file(FILE *fin) {
+template <typename real> void process_vector(size_t N, real *v, FILE *fout) {
+  size_t l = length;
+  if (l == 0) {
+    l = N / stride;
+  }
+  put_slice(v, offset, l, fout);
+}
+
+template <typename real> void put_sparse_slice(size_t l, size_t nnz,
+					      const size_t *index,
+					      const real *v, FILE *fout) {
+  if (!binary_output) {
+    pid::vec_put_header_to_file(fout);
+    pid::vec_put_hint_to_file("dimension", stride, fout);
+    pid::put_sparse_vector(l, nnz, index, v, fout);
+  }
+  else if (binary_float_output) {
+    std::vector<float> w(v, v + nnz);
+    pid::put_sparse_vector_binary(l, nnz, index, nnz > 0 ? &w[0] : 0, fout);
+  }
+  else if (binary_double_output) {
+    std::vector<double> w(v, v + nnz);
+    pid::put_sparse_vector_binary(l, nnz, index, nnz > 0 ? &w[0] : 0, fout);
+  }
+  else {
+    pid::put_sparse_vector_binary(l, nnz, index, v, fout);
+  }
+  std::fflush(fout);
+}
+
+// Writes the slice of dense v sparse, for -z on chunk-indexed files.
+template <typename real> void put_slice_as_sparse(const real *v, size_t o,
+						  size_t l, FILE *fout) {
+  std::vector<real> vs(l);
+  if (l > 0) {
+    pid::slice_vector(&vs[0], v, o, l, stride);
+  }
+  std::vector<size_t> index;
+  std::vector<real> w;
+  for (size_t i = 0; i < l; ++i) {
+    if (vs[i] != 0) {
+      index.push_back(i);
+      w.push_back(vs[i]);
+    }
+  }
+  put_sparse_slice(l, w.size(), index.empty() ? 0 : &index[0],
+		   w.empty() ? 0 : &w[0], fout);
+}
+
+// Slices the nonzero elements only.
+template <typename real> void process_sparse_file(FILE *fin, FILE *fout) {
+  size_t N, nnz, *index;
+  real *v;
+
+  if (!binary_input) {
+    pid::new_sparse_vector(&N, &nnz, &index, &v, fin);
+  }
+  else {
+    pid::new_sparse_vector_binary(&N, &nnz, &index, &v, fin);
+  }
+  if (N == static_cast<size_t>(-1)) {
+    pid::put_nil(fout);
+  }
+  else {
+    size_t l = length;
+    if (l == 0) {
+      l = N / stride;
+    }
+    std::vector<size_t> index_out(nnz > 0 ? nnz : 1);
+    std::vector<real> v_out(index_out.size());
+    size_t nnz_out;
+    pid::slice_sparse_vector(&nnz_out, &index_out[0], &v_out[0], nnz, index,
+			     v, offset, l, stride);
+    put_sparse_slice(l, nnz_out, &index_out[0], &v_out[0], fout);
+  }
+  pid::delete_sparse_index(index);
+  std::free(v);
+}
+
+template <typename real> void process_file(FILE *fin, FILE *fout) {
   size_t N;
-  double *v;
-	
+  real *v;
+
+  if (sparse) {
+    process_sparse_file<real>(fin, fout);
+    return;
+  }
   if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N, &v, fin);
+    pid::new_vector(&N, &v, fin);
+  }
+  else {
+    pid::new_vector_binary(&N, &v, fin);
+  }
+  process_vector(N, v, fout);
+  std::free(v);
+}
+
+void process_file(FILE *fin, FILE *fout) {
+  if (binary_float_input) {
+    process_file<float>(fin, fout);
+  }
+  else {
+    process_file<double>(fin, fout);
+  }
+}
+
+// Reads only the elements the slice touches from a chunk-indexed file.
+template <typename real> void process_chunked_file(FILE *fin, FILE *fout) {
+  size_t N;
+  pid::vec_get_chunked_vector_length(fin, &N);
+  size_t l = length;
+  if (l == 0) {
+    l = N / stride;
+  }
+
+  size_t n;
+  real *v;
+  pid::new_vector_range_chunked(offset, l > 0 ? (l - 1) * stride + 1 : 0,
+				&n, &v, fin);
+  if (l > (n + stride - 1) / stride) {
+    l = (n + stride - 1) / stride;
+  }
+  if (sparse) {
+    put_slice_as_sparse(v, 0, l, fout);
   }
   else {
-    pid::vec_new_double_vector_from_file_binary(&N, &v, fin);
+    put_slice(v, 0, l, fout);
   }
-  process_vector(N, v);
   std::free(v);
 }
 
-void process(const char *filename) {
+// Returns 1 if {FILENAME} can't be opened.
+int process(const char *filename, FILE *fout) {
   FILE *fin;
-  fin = std::fopen(filename, "r");
+  fin = pid::open_file(filename);
   if (!fin) {
+    return 1;
+  }
+  if (pid::vec_is_chunked_file(fin)) {
+    if (binary_float_input) {
+      process_chunked_file<float>(fin, fout);
+    }
+    else {
+      process_chunked_file<double>(fin, fout);
+    }
+  }
+  else {
+    process_file(fin, fout);
+    pid::vec_scan_messages_from_file_and_put_to_file(fin, fout);
+  }
+  std::fclose(fin);
+  return 0;
+}
+
+void process_or_exit(const char *filename) {
+  if (process(filename, stdout) != 0) {
     std::cerr << "slice: error: can't open: " << filename << '\n';
     std::exit(1);
   }
-  process_file(fin);
-  pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
-  std::fclose(fin);
+}
+
+// With -j and one file, slices the vector itself on the threads.
+void slice_on_threads() {
+  pid::interleave_shared_vectors(threads);
+  pid::vec_set_threads(threads);
+}
+
+// Processes the files queued by -j, keeping the order of the output.
+void process_files() {
+  if (files.size() == 1) {
+    slice_on_threads();
+  }
+  else if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "slice: warning: -P processes files one at a time\n";
+    threads = 1;
+  }
+  size_t failed = pid::parallel_for_ordered(threads, files.size(),
+    [](size_t i, FILE *fout) {
+      if (files[i][0] == '-' && files[i][1] == '\0') {
+	process_file(stdin, fout);
+	return 0;
+      }
+      return process(files[i], fout);
+    }, stdout);
+  if (failed < files.size()) {
+    std::cerr << "slice: error: can't open: " << files[failed] << '\n';
+    std::exit(1);
+  }
 }
 
 void parse_option(const char *option) {
   switch (*option) {
   case '\0':
-    process_file(stdin);
+    if (threads > 0) {
+      files.push_back("-");
+    }
+    else {
+      process_file(stdin, stdout);
+    }
     break;
   case '-':
     stop_parsing_options = true;
@@ -112,9 +311,31 @@ void parse_option(const char *option) {
     break;
   case 'b':
     binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
     break;
   case 'B':
     binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'z':
+    sparse = true;
+    pid::vec_set_sparse_output(1);
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("slice");
     break;
   case 'h':
     help();
@@ -132,18 +353,29 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   int file_count = 0;
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-') {
       parse_option(*argv + 1);
     }
+    else if (threads > 0) {
+      ++file_count;
+      files.push_back(*argv);
+    }
     else {
       ++file_count;
-      process(*argv);
+      process_or_exit(*argv);
     }
   }
-  if (file_count == 0) {
-    process_file(stdin);
+  if (!files.empty()) {
+    process_files();
+  }
+  else if (file_count == 0) {
+    if (threads > 0) {
+      slice_on_threads();
+    }
+    process_file(stdin, stdout);
   }
   return 0;
 }
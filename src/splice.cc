@@ -5,9 +5,10 @@
 #include "vec.h"
 
 void help() {
-  std::cerr << "usage: splice {FILENAME1} {FILENAME2}\n"
+  std::cerr << "usage: splice [-P] {FILENAME1} {FILENAME2}\n"
     "\tsplice reads vectorstream files FILENAME1 and FILENAME2 and write\n"
-    "\tspliced array.\n";
+    "\tspliced array.\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n";
 }
 
 void process_files(FILE *fin1, FILE *fin2) {
@@ -22,10 +23,12 @@ void process_files(FILE *fin1, FILE *fin2) {
   }
 	
   double *v = new double[N * 2];
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
   for (int i = 0; i < N; ++i) {
     v[i * 2 + 0] = v1[i];
     v[i * 2 + 1] = v2[i];
   }
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, N * 2, N * 4 * sizeof(double));
 	
   pid::vec_put_header_to_file(stdout);
   pid::vec_put_double_vector_to_file(N * 2, v, 2, stdout);
@@ -38,8 +41,8 @@ void process_files(FILE *fin1, FILE *fin2) {
 
 void process(const char *filename1, const char *filename2) {
   FILE *fin1, *fin2;
-  fin1 = std::fopen(filename1, "r");
-  fin2 = std::fopen(filename2, "r");
+  fin1 = pid::vec_open_file(filename1, "r");
+  fin2 = pid::vec_open_file(filename2, "r");
   if (!fin1) {
     std::cerr << "splice: error: can't open:: " << filename1 << '\n';
     std::exit(1);
@@ -53,7 +56,28 @@ void process(const char *filename1, const char *filename2) {
   std::fclose(fin2);
 }
 
+void parse_option(const char *option) {
+  switch (*option) {
+  case 'P':
+    pid::vec_profile_start("splice");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "splice: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
 int main(int argc, char **argv) {
+  pid::vec_open_output();
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+    parse_option(argv[1] + 1);
+    ++argv;
+    --argc;
+  }
   if (argc < 3) {
     help();
     std::exit(0);
@@ -19,84 +19,207 @@
  */
 
 #include <iostream>
+#include <sstream>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
-#include <valarray>
-#include "vec.h"
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
 
 static bool stop_parsing_options = false;
 
 static bool binary_input = false;
+static bool binary_float_input = false;
 
 static size_t size_of_vector = 1;
+static size_t threads = 0;
+static std::vector<const char *> files;
 
 void help() {
-  std::cerr << "usage: statistics [-s{STRIDE}] [-b] {FILENAME}\n"
+  std::cerr << "usage: statistics [-s{STRIDE}] [-b[s]] [-j[N]] [-P] {FILENAME}\n"
     "\t-b: Binary input.\n"
+    "\t-bs: Binary input (single precision).\n"
+    "\t-j[N]: Processes the files on N threads (Default: one per CPU).\n"
+    "\tThe output keeps the order of the files. Options given after -j\n"
+    "\tapply to all files.\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
     "\t-: stdin.\n";
 }
 
-void process_vector(size_t N, double *v) {
-  std::valarray<double> va(v, N);
-	
-  for (size_t mu = 0; mu < size_of_vector; ++mu) {
-    std::valarray<double> v_sliced(va[std::slice(mu, N / size_of_vector,
-						 size_of_vector)]);
-    size_t num = v_sliced.size();
-    double max = v_sliced.max();
-    double min = v_sliced.min();
-    double dif = max - min;
-    double sum = v_sliced.sum();
-    double avr = sum / num;
-    v_sliced -= avr;
-    for (size_t i = 0; i < v_sliced.size(); ++i) {
-      v_sliced[i] = v_sliced[i] * v_sliced[i];
+void put_statistics(size_t num, double max, double min, double sum,
+		    double sq, std::ostream &os) {
+  double dif = max - min;
+  double avr = sum / num;
+  double var = num > 1 ? std::sqrt(sq / (num - 1)) : 0;
+  os << "num: " << num << "; max: " << max << "; min: " << min
+     << "; dif: " << dif << "; sum: " << sum << "; avr: " << avr 
+     << "; var: " << var << '\n';
+}
+
+// The input stays in its own element type; the sums are taken in double,
+// in the order of the records.  Records of D components (see
+// pid::dispatch_dimension) are taken all components in one pass; other
+// sizes one component at a time.
+template <typename real> struct statistics_kernel {
+  size_t N;
+  const real *v;
+  std::ostream &os;
+
+  template <size_t D> void run() {
+    if (D == 0) {
+      run_any();
+      return;
+    }
+    const size_t num = N / (D > 0 ? D : 1);
+    double max[D > 0 ? D : 1], min[D > 0 ? D : 1];
+    double sum[D > 0 ? D : 1], sq[D > 0 ? D : 1];
+#pragma GCC unroll 8
+    for (size_t mu = 0; mu < D; ++mu) {
+      max[mu] = min[mu] = num > 0 ? v[mu] : 0;
+      sum[mu] = sq[mu] = 0;
+    }
+    for (size_t i = 0; i < num; ++i) {
+      const real *p = v + i * D;
+#pragma GCC unroll 8
+      for (size_t mu = 0; mu < D; ++mu) {
+	double x = p[mu];
+	if (x > max[mu]) {
+	  max[mu] = x;
+	}
+	if (x < min[mu]) {
+	  min[mu] = x;
+	}
+	sum[mu] += x;
+      }
     }
-    double var;
     if (num > 1) {
-      var = std::sqrt(v_sliced.sum() / (num - 1));
+      double avr[D > 0 ? D : 1];
+#pragma GCC unroll 8
+      for (size_t mu = 0; mu < D; ++mu) {
+	avr[mu] = sum[mu] / num;
+      }
+      for (size_t i = 0; i < num; ++i) {
+	const real *p = v + i * D;
+#pragma GCC unroll 8
+	for (size_t mu = 0; mu < D; ++mu) {
+	  double d = p[mu] - avr[mu];
+	  sq[mu] += d * d;
+	}
+      }
     }
-    else {
-      var = 0;
+    for (size_t mu = 0; mu < D; ++mu) {
+      put_statistics(num, max[mu], min[mu], sum[mu], sq[mu], os);
     }
-    std::cout << "num: " << num << "; max: " << max << "; min: " << min
-	      << "; dif: " << dif << "; sum: " << sum << "; avr: " << avr 
-	      << "; var: " << var << '\n';
   }
+
+  void run_any() {
+    for (size_t mu = 0; mu < size_of_vector; ++mu) {
+      size_t num = N / size_of_vector;
+      const real *p = v + mu;
+      double max = 0;
+      double min = 0;
+      double sum = 0;
+      if (num > 0) {
+	max = min = p[0];
+      }
+      for (size_t i = 0; i < num; ++i) {
+	double x = p[i * size_of_vector];
+	if (x > max) {
+	  max = x;
+	}
+	if (x < min) {
+	  min = x;
+	}
+	sum += x;
+      }
+      double sq = 0;
+      if (num > 1) {
+	double avr = sum / num;
+	for (size_t i = 0; i < num; ++i) {
+	  double d = p[i * size_of_vector] - avr;
+	  sq += d * d;
+	}
+      }
+      put_statistics(num, max, min, sum, sq, os);
+    }
+  }
+};
+
+template <typename real> void process_vector(size_t N, const real *v,
+					  std::ostream &os) {
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+  statistics_kernel<real> k = { N, v, os };
+  pid::dispatch_dimension(size_of_vector, k);
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, N, 2 * N * sizeof(real));
 }
 
-void process_file(FILE *fin) {
+template <typename real> void process_file(FILE *fin, std::ostream &os) {
   size_t N;
-  double *v;
+  real *v;
 	
   if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N, &v, fin);
+    pid::new_vector(&N, &v, fin);
   }
   else {
-    pid::vec_new_double_vector_from_file_binary(&N, &v, fin);
+    pid::new_vector_binary(&N, &v, fin);
   }
-  process_vector(N, v);
+  process_vector(N, v, os);
   std::free(v);
 }
 
-void process(const char *filename) {
+void process_file(FILE *fin, std::ostream &os) {
+  if (binary_float_input) {
+    process_file<float>(fin, os);
+  }
+  else {
+    process_file<double>(fin, os);
+  }
+}
+
+void process(const char *filename, std::ostream &os) {
   FILE *fin;
-  fin = std::fopen(filename, "r");
+  fin = pid::open_file(filename);
   if (!fin) {
     std::cerr << "statistics: warning: can't open: " << filename << '\n';
   }
   else {
-    std::cout << filename << '\n';
-    process_file(fin);
+    os << filename << '\n';
+    process_file(fin, os);
+    std::fclose(fin);
+  }
+}
+
+// Processes the files queued by -j, keeping the order of the output.
+void process_files() {
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "statistics: warning: -P processes files one at a time\n";
+    threads = 1;
   }
-  std::fclose(fin);
+  std::cout.flush();
+  pid::parallel_for_ordered(threads, files.size(),
+    [](size_t i, FILE *fout) {
+      std::ostringstream os;
+      if (files[i][0] == '-' && files[i][1] == '\0') {
+	process_file(stdin, os);
+      }
+      else {
+	process(files[i], os);
+      }
+      std::fputs(os.str().c_str(), fout);
+      return 0;
+    }, stdout);
 }
 
 void parse_option(const char *option) {
   switch (*option) {
   case '\0':
-    process_file(stdin);
+    if (threads > 0) {
+      files.push_back("-");
+    }
+    else {
+      process_file(stdin, std::cout);
+    }
     break;
   case '-':
     stop_parsing_options = true;
@@ -106,6 +229,18 @@ void parse_option(const char *option) {
     break;
   case 'b':
     binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("statistics");
     break;
   case 'h':
     help();
@@ -123,18 +258,26 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   int file_count = 0;
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-') {
       parse_option(*argv + 1);
     }
+    else if (threads > 0) {
+      ++file_count;
+      files.push_back(*argv);
+    }
     else {
       ++file_count;
-      process(*argv);
+      process(*argv, std::cout);
     }
   }
-  if (file_count == 0) {
-    process_file(stdin);
+  if (!files.empty()) {
+    process_files();
+  }
+  else if (file_count == 0) {
+    process_file(stdin, std::cout);
   }
   return 0;
 }
@@ -21,7 +21,9 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
-#include "vec.h"
+#include <vector>
+#include "vec++.hh"
+#include "vecpool.hh"
 
 static bool stop_parsing_options = false;
 
@@ -32,11 +34,16 @@ static bool binary_input = false;
 static bool binary_float_input = false;
 static bool binary_output = false;
 static bool binary_float_output = false;
+static bool binary_double_output = false;
 static size_t stride = 1;
 static const char *name = 0;
+static size_t chunk_length = 0;
+static size_t threads = 0;
+static std::vector<const char *> files;
 
 void help() {
-  std::cerr << "usage: vcat [-v] [-u|-U] [-s{STRIDE}] [-b[s]] [-B[s]] [--] {FILENAME}\n"
+  std::cerr << "usage: vcat [-v] [-u|-U] [-s{STRIDE}] [-b[s]] [-B[s|d]]\n"
+    "\t[-C[{CHUNK}]] [-z] [-j[N]] [-P] [--] {FILENAME}\n"
     "\tvcat reads vector file {FILENAME} and writes it to stdout.\n"
     "\t-v: Verbose mode.\n"
     "\t-u: Unvectorize.\n"
@@ -44,126 +51,172 @@ void help() {
     "\t-s{STRIDE}: Specifies stride. {STRIDE} must be equal to or greater\n"
     "\tthan 0.\n"
     "\t-b: Binary input.\n"
-    "\t-bs: Binary input (single precision).\n"
-    "\t-B: DO NOT USE. Binary output. Machine dependent.\n"
+    "\t-bs: Binary input (single precision). Kept in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
     "\t-Bs: DO NOT USE. Binary output (single precision). Machine dependent.\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision). Machine dependent.\n"
+    "\t-C[{CHUNK}]: DO NOT USE. Chunk-indexed binary output, {CHUNK}\n"
+    "\telements per chunk (Default: 65536). Same precision as the input.\n"
+    "\tslice and gslice read only the chunks they need from such files.\n"
+    "\t-z: Sparse output. Writes only the nonzero elements with their\n"
+    "\tindices when that is smaller. (Also set by $VEC_SPARSE=1)\n"
+    "\t-j[N]: Processes the files on N threads (Default: one per CPU).\n"
+    "\tThe output keeps the order of the files. Options given after -j\n"
+    "\tapply to all files.\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
     "\n"
     "\t*You can merge more than two vector files by:\n"
     "\t\tvcat -u {FILE1} {FILE2} | vectorize - > {OUTPUT}\n";
 }
 
-void process_vector(size_t N, double *v) {
+template <typename real> void process_vector(size_t N, real *v, FILE *fout) {
   if (unvectorize || unvectorize_with_scheme_format) {
+    pid::vec_profile_begin(VEC_PROFILE_WRITE);
     if (stride < 2) {
       if (unvectorize_with_scheme_format) {
-	std::fprintf(stdout, "#( ; %d nodes\n", N);
+	std::fprintf(fout, "#( ; %lu nodes\n", static_cast<unsigned long>(N));
       }
       for (size_t i = 0; i < N; ++i) {
-	std::fprintf(stdout, "%f\n", static_cast<double>(v[i]));
+	std::fprintf(fout, "%f\n", static_cast<double>(v[i]));
       }
       if (unvectorize_with_scheme_format) {
-	std::fputs(")\n", stdout);
+	std::fputs(")\n", fout);
       }
     }
     else {
       if (unvectorize_with_scheme_format) {
-	std::fprintf(stdout, "#( ; %d nodes\n", N / stride);
+	std::fprintf(fout, "#( ; %lu nodes\n",
+		   static_cast<unsigned long>(N / stride));
       }
       for (size_t i = 0; i < N / stride; ++i) {
 	if (unvectorize_with_scheme_format) {
-	  std::fputs("#(", stdout);
+	  std::fputs("#(", fout);
 	}
 	for (size_t j = 0; j < stride; ++j) {
 	  int k = i * stride + j;
-	  std::fprintf(stdout, "%16f ", static_cast<double>(v[k]));
+	  std::fprintf(fout, "%16f ", static_cast<double>(v[k]));
 	}
 	if (unvectorize_with_scheme_format) {
-	  std::fputs(")\n", stdout);
+	  std::fputs(")\n", fout);
 	}
 	else {
-	  std::fputc('\n', stdout);
+	  std::fputc('\n', fout);
 	}
       }
       if (unvectorize_with_scheme_format) {
-	std::fputs(")\n", stdout);
+	std::fputs(")\n", fout);
       }
     }
+    pid::vec_profile_end(VEC_PROFILE_WRITE, N, 0);
   }
   else {
     if (!binary_output) {
-      pid::vec_put_header_to_file(stdout);
-      pid::vec_put_hint_to_file("dimension", stride, stdout);
-      pid::vec_put_double_vector_to_file(N, v, stride, stdout);
+      pid::vec_put_header_to_file(fout);
+      pid::vec_put_hint_to_file("dimension", stride, fout);
+      pid::put_vector(N, v, stride, fout);
     }
     else {
-      if (!binary_float_output) {
-	pid::vec_put_double_vector_to_file_binary(N, v, stdout);
+      if (chunk_length > 0) {
+	pid::put_vector_chunked(N, v, chunk_length, fout);
+      }
+      else if (binary_float_output) {
+	pid::put_vector_binary_as<float>(N, v, fout);
+      }
+      else if (binary_double_output) {
+	pid::put_vector_binary_as<double>(N, v, fout);
       }
       else {
-	float *fv = new float[N];
-	for (size_t i = 0; i < N; ++i) {
-	  fv[i] = v[i];
-	}
-	pid::vec_put_float_vector_to_file_binary(N, fv, stdout);
-	delete[] fv;
+	pid::put_vector_binary(N, v, fout);
       }
     }
   }
 }
 
-void process_file(FILE *fin) {
+void process_file(FILE *fin, FILE *fout) {
   size_t N;
-  double *v;
 
-  if (!binary_input) {
-    pid::vec_new_double_vector_from_file(&N, &v, fin);
+  if (binary_float_input) {
+    float *v;
+
+    pid::vec_new_float_vector_from_file(&N, &v, fin);
+    process_vector(N, v, fout);
+    pid::vec_delete_float_vector(v);
   }
   else {
-    if (!binary_float_input) {
-      pid::vec_new_double_vector_from_file_binary(&N, &v, fin);
+    double *v;
+
+    if (!binary_input) {
+      pid::vec_new_double_vector_from_file(&N, &v, fin);
     }
     else {
-      float *fv;
-      
-      pid::vec_new_float_vector_from_file(&N, &fv, fin);
-      v = static_cast<double *>(std::malloc(N * sizeof(double)));
-      for (size_t i = 0; i < N; ++i) {
-	v[i] = fv[i];
-      }
-      pid::vec_delete_float_vector(fv);
+      pid::vec_new_double_vector_from_file_binary(&N, &v, fin);
     }
+    process_vector(N, v, fout);
+    std::free(v);
   }
-  process_vector(N, v);
-  std::free(v);
 }
 
-void process(const char *filename) {
+// Returns 1 if {FILENAME} can't be opened.
+int process(const char *filename, FILE *fout) {
   if (verbose) {
     std::cerr << "processing " << filename << "... ";
   }
   FILE *fin;
-  fin = std::fopen(filename, "r");
+  fin = pid::open_file(filename);
   if (!fin) {
-    std::cerr << "vcat: error: can't open: " << filename << '\n';
-    std::exit(1);
+    return 1;
   }
-  process_file(fin);
+  process_file(fin, fout);
   if (!(unvectorize || unvectorize_with_scheme_format) && !binary_output) {
     std::rewind(fin);
-    pid::vec_scan_messages_from_file_and_put_to_file(fin, stdout);
-    std::fprintf(stdout, "%%? This file was created from %s\n", filename);
+    pid::vec_scan_messages_from_file_and_put_to_file(fin, fout);
+    std::fprintf(fout, "%%? This file was created from %s\n", filename);
   }
-  std::fflush(stdout);
+  std::fflush(fout);
   std::fclose(fin);
   if (verbose) {
     std::cerr << "done\n";
   }
+  return 0;
+}
+
+void process_or_exit(const char *filename) {
+  if (process(filename, stdout) != 0) {
+    std::cerr << "vcat: error: can't open: " << filename << '\n';
+    std::exit(1);
+  }
+}
+
+// Processes the files queued by -j, keeping the order of the output.
+void process_files() {
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "vcat: warning: -P processes files one at a time\n";
+    threads = 1;
+  }
+  size_t failed = pid::parallel_for_ordered(threads, files.size(),
+    [](size_t i, FILE *fout) {
+      if (files[i][0] == '-' && files[i][1] == '\0') {
+	process_file(stdin, fout);
+	return 0;
+      }
+      return process(files[i], fout);
+    }, stdout);
+  if (failed < files.size()) {
+    std::cerr << "vcat: error: can't open: " << files[failed] << '\n';
+    std::exit(1);
+  }
 }
 
 void parse_option(const char *option) {
   switch (*option) {
   case '\0':
-    process_file(stdin);
+    if (threads > 0) {
+      files.push_back("-");
+    }
+    else {
+      process_file(stdin, stdout);
+    }
     break;
   case '-':
     stop_parsing_options = true;
@@ -191,6 +244,28 @@ void parse_option(const char *option) {
     if (*++option == 's') {
       binary_float_output = true;
     }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'C':
+    binary_output = true;
+    chunk_length = std::atoi(option + 1);
+    if (chunk_length == 0) {
+      chunk_length = 65536;
+    }
+    break;
+  case 'z':
+    pid::vec_set_sparse_output(1);
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("vcat");
     break;
   case 'h':
     help();
@@ -208,18 +283,26 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   int file_count = 0;
+  pid::open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-') {
       parse_option(*argv + 1);
     }
+    else if (threads > 0) {
+      ++file_count;
+      files.push_back(*argv);
+    }
     else {
       ++file_count;
-      process(*argv);
+      process_or_exit(*argv);
     }
   }
-  if (file_count == 0) {
-    process_file(stdin);
+  if (!files.empty()) {
+    process_files();
+  }
+  else if (file_count == 0) {
+    process_file(stdin, stdout);
   }
   return 0;
 }
@@ -26,9 +26,14 @@
 #ifdef __cplusplus
 
 #include <cstdlib>
+#include <cstring>
+#include <ext/stdio_sync_filebuf.h>
+#include <iostream>
 #include <map>
+#include <new>
 #include <string>
 #include <stdexcept>
+#include <utility>
 #include <valarray>
 #include <vector>
 
@@ -44,6 +49,48 @@ namespace pid {
     return pid::vec_put_hint_to_file(hint, parameter, fout);
   }
 
+  // Returns the dimension hint in the header of the text vector file
+  // fin, or 0 if there is none.  Reads the header lines without
+  // seeking, so it works on pipes and rings too, and leaves fin at the
+  // first line after them; the readers skip the header anyway.  Gives 0
+  // for binary files, which are left as they were.
+  inline size_t dimension_hint(FILE *fin) {
+    size_t d = 0;
+    char line[VEC_MAXIMUM_LINE_LENGTH];
+    int c;
+    while ((c = std::getc(fin)) == '%') {
+      if (!std::fgets(line, VEC_MAXIMUM_LINE_LENGTH, fin)) {
+	return d;
+      }
+      if (std::strncmp(line, "*dimension=", 11) == 0) {
+	d = std::atoi(line + 11);
+      }
+      while (!std::strchr(line, '\n') &&
+	     std::fgets(line, VEC_MAXIMUM_LINE_LENGTH, fin)) {
+      }
+    }
+    if (c != EOF) {
+      std::ungetc(c, fin);
+    }
+    return d;
+  }
+
+  // "-", "ring:NAME" or a file name; see vec_open_file.
+  inline FILE *open_file(const char *filename, const char *mode = "r") {
+    return pid::vec_open_file(filename, mode);
+  }
+
+  // Called by the tools from main(): stdout, and std::cout with it,
+  // become $VEC_OUTPUT if it is set; see vec_open_output.
+  inline FILE *open_output() {
+    FILE *f = stdout;
+    if (pid::vec_open_output() != f) {
+      static __gnu_cxx::stdio_sync_filebuf<char> buffer(stdout);
+      std::cout.rdbuf(&buffer);
+    }
+    return stdout;
+  }
+
   inline int put_message(const char *message, FILE *fout) {
     return pid::vec_put_message_to_file(message, fout);
   }
@@ -80,11 +127,180 @@ namespace pid {
     pid::vec_delete_double_vector(v);
   }
 
+  inline int put_vector_binary(size_t n, const float *v, FILE *fout) {
+    return pid::vec_put_float_vector_to_file_binary(n, v, fout);
+  }
+
+  inline int put_vector_binary(size_t n, const double *v, FILE *fout) {
+    return pid::vec_put_double_vector_to_file_binary(n, v, fout);
+  }
+
+  inline int new_vector_binary(size_t *n, float **v, FILE *fin) {
+    return pid::vec_new_float_vector_from_file_binary(n, v, fin);
+  }
+
+  inline int new_vector_binary(size_t *n, double **v, FILE *fin) {
+    return pid::vec_new_double_vector_from_file_binary(n, v, fin);
+  }
+
+  // Writes v in binary with elements of type T, converting if the
+  // element type of v differs.  E.g. put_vector_binary_as<float>(n, v, f).
+
+  template <typename T> struct binary_writer {
+    static int put(size_t n, const T *v, FILE *fout) {
+      return put_vector_binary(n, v, fout);
+    }
+
+    template <typename real> static int put(size_t n, const real *v,
+					    FILE *fout) {
+      std::vector<T> w(v, v + n);
+      return put_vector_binary(n, n > 0 ? &w[0] : 0, fout);
+    }
+  };
+
+  template <typename T, typename real> inline int
+  put_vector_binary_as(size_t n, const real *v, FILE *fout) {
+    return binary_writer<T>::put(n, v, fout);
+  }
+
+  inline int put_vector_chunked(size_t n, const float *v,
+				size_t chunk_length, FILE *fout) {
+    return pid::vec_put_float_vector_to_file_chunked(n, v, chunk_length, fout);
+  }
+
+  inline int put_vector_chunked(size_t n, const double *v,
+				size_t chunk_length, FILE *fout) {
+    return pid::vec_put_double_vector_to_file_chunked(n, v, chunk_length,
+						      fout);
+  }
+
+  inline int new_vector_range_chunked(size_t first, size_t length, size_t *n,
+				      float **v, FILE *fin) {
+    return pid::vec_new_float_vector_range_from_file_chunked(first, length, n,
+							     v, fin);
+  }
+
+  inline int new_vector_range_chunked(size_t first, size_t length, size_t *n,
+				      double **v, FILE *fin) {
+    return pid::vec_new_double_vector_range_from_file_chunked(first, length,
+							      n, v, fin);
+  }
+
+  inline int put_stream_begin(FILE *fout) {
+    return pid::vec_put_stream_begin_to_file(fout);
+  }
+
+  inline int put_stream(size_t n, const float *v, size_t s, FILE *fout) {
+    return pid::vec_put_float_stream_to_file(n, v, s, fout);
+  }
+
+  inline int put_stream(size_t n, const double *v, size_t s, FILE *fout) {
+    return pid::vec_put_double_stream_to_file(n, v, s, fout);
+  }
+
+  inline int put_stream_end(size_t n, FILE *fout) {
+    return pid::vec_put_stream_end_to_file(n, fout);
+  }
+
+  inline int put_stream_begin_binary(FILE *fout) {
+    return pid::vec_put_stream_begin_to_file_binary(fout);
+  }
+
+  inline int put_stream_binary(size_t n, const float *v, FILE *fout) {
+    return pid::vec_put_float_stream_to_file_binary(n, v, fout);
+  }
+
+  inline int put_stream_binary(size_t n, const double *v, FILE *fout) {
+    return pid::vec_put_double_stream_to_file_binary(n, v, fout);
+  }
+
+  inline int put_stream_end_binary(size_t n, FILE *fout) {
+    return pid::vec_put_stream_end_to_file_binary(n, fout);
+  }
+
+  inline int put_sparse_vector(size_t n, size_t nnz, const size_t *index,
+			       const float *v, FILE *fout) {
+    return pid::vec_put_float_sparse_vector_to_file(n, nnz, index, v, fout);
+  }
+
+  inline int put_sparse_vector(size_t n, size_t nnz, const size_t *index,
+			       const double *v, FILE *fout) {
+    return pid::vec_put_double_sparse_vector_to_file(n, nnz, index, v, fout);
+  }
+
+  inline int new_sparse_vector(size_t *n, size_t *nnz, size_t **index,
+			       float **v, FILE *fin) {
+    return pid::vec_new_float_sparse_vector_from_file(n, nnz, index, v, fin);
+  }
+
+  inline int new_sparse_vector(size_t *n, size_t *nnz, size_t **index,
+			       double **v, FILE *fin) {
+    return pid::vec_new_double_sparse_vector_from_file(n, nnz, index, v, fin);
+  }
+
+  inline int put_sparse_vector_binary(size_t n, size_t nnz,
+				      const size_t *index, const float *v,
+				      FILE *fout) {
+    return pid::vec_put_float_sparse_vector_to_file_binary(n, nnz, index, v,
+							   fout);
+  }
+
+  inline int put_sparse_vector_binary(size_t n, size_t nnz,
+				      const size_t *index, const double *v,
+				      FILE *fout) {
+    return pid::vec_put_double_sparse_vector_to_file_binary(n, nnz, index, v,
+							    fout);
+  }
+
+  inline int new_sparse_vector_binary(size_t *n, size_t *nnz, size_t **index,
+				      float **v, FILE *fin) {
+    return pid::vec_new_float_sparse_vector_from_file_binary(n, nnz, index, v,
+							     fin);
+  }
+
+  inline int new_sparse_vector_binary(size_t *n, size_t *nnz, size_t **index,
+				      double **v, FILE *fin) {
+    return pid::vec_new_double_sparse_vector_from_file_binary(n, nnz, index,
+							      v, fin);
+  }
+
+  inline void delete_sparse_index(size_t *index) {
+    pid::vec_delete_sparse_index(index);
+  }
+
+  inline int slice_vector(float *a, const float *v, size_t offset,
+			  size_t length, size_t stride) {
+    return pid::vec_slice_float_vector(a, v, offset, length, stride);
+  }
+
   inline int slice_vector(double *a, const double *v, size_t offset,
 			  size_t length, size_t stride) {
     return pid::vec_slice_double_vector(a, v, offset, length, stride);
   }
+
+  inline int slice_sparse_vector(size_t *nnz, size_t *index, float *a,
+				 size_t nnz1, const size_t *index1,
+				 const float *v, size_t offset, size_t length,
+				 size_t stride) {
+    return pid::vec_slice_float_sparse_vector(nnz, index, a, nnz1, index1, v,
+					      offset, length, stride);
+  }
+
+  inline int slice_sparse_vector(size_t *nnz, size_t *index, double *a,
+				 size_t nnz1, const size_t *index1,
+				 const double *v, size_t offset, size_t length,
+				 size_t stride) {
+    return pid::vec_slice_double_sparse_vector(nnz, index, a, nnz1, index1, v,
+					       offset, length, stride);
+  }
 	
+  inline int add_multi_vector_to_multi_vector(float *a, size_t s, size_t n1,
+					      const float *v1, size_t n2,
+					      const float *v2) {
+    return pid::vec_add_float_multi_vector_to_multi_vector(a, s, n1, v1, n2,
+							   v2);
+  }
+
   inline int add_multi_vector_to_multi_vector(double *a, size_t s, size_t n1,
 					      const double *v1, size_t n2,
 					      const double *v2) {
@@ -92,6 +308,13 @@ namespace pid {
 							    v2);
   }
 
+  inline int add_single_vector_to_multi_vector(float *a, size_t s, size_t n1,
+					       const float *v1, size_t n2,
+					       const float *v2) {
+    return pid::vec_add_float_single_vector_to_multi_vector(a, s, n1, v1, n2,
+							    v2);
+  }
+
   inline int add_single_vector_to_multi_vector(double *a, size_t s, size_t n1,
 					       const double *v1, size_t n2,
 					       const double *v2) {
@@ -99,7 +322,54 @@ namespace pid {
 							     v2);
   }
 
-  inline int multiply_multi_matrix_to_malti_vector(double *a, size_t s,
+  inline int add_sparse_vector_to_vector(float *a, size_t n, const float *v1,
+					 size_t nnz, const size_t *index,
+					 const float *v2) {
+    return pid::vec_add_float_sparse_vector_to_vector(a, n, v1, nnz, index,
+						      v2);
+  }
+
+  inline int add_sparse_vector_to_vector(double *a, size_t n,
+					 const double *v1, size_t nnz,
+					 const size_t *index,
+					 const double *v2) {
+    return pid::vec_add_double_sparse_vector_to_vector(a, n, v1, nnz, index,
+						       v2);
+  }
+
+  inline int add_sparse_vector_to_sparse_vector(size_t *nnz, size_t *index,
+						float *a, size_t nnz1,
+						const size_t *index1,
+						const float *v1, size_t nnz2,
+						const size_t *index2,
+						const float *v2) {
+    return pid::vec_add_float_sparse_vector_to_sparse_vector(nnz, index, a,
+							     nnz1, index1, v1,
+							     nnz2, index2, v2);
+  }
+
+  inline int add_sparse_vector_to_sparse_vector(size_t *nnz, size_t *index,
+						double *a, size_t nnz1,
+						const size_t *index1,
+						const double *v1, size_t nnz2,
+						const size_t *index2,
+						const double *v2) {
+    return pid::vec_add_double_sparse_vector_to_sparse_vector(nnz, index, a,
+							      nnz1, index1,
+							      v1, nnz2,
+							      index2, v2);
+  }
+
+  inline int multiply_multi_matrix_to_multi_vector(float *a, size_t s,
+						   size_t nm, const float *m,
+						   size_t nv, const float *v,
+						   bool transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_multiply_float_multi_matrix_to_multi_vector(a, s, nm, m,
+								nv, v, t);
+  }
+
+  inline int multiply_multi_matrix_to_multi_vector(double *a, size_t s,
 						   size_t nm, const double *m,
 						   size_t nv, const double *v,
 						   bool transpose) {
@@ -108,6 +378,24 @@ namespace pid {
 								 nv, v, t);
   }
 
+  // Misspelled name kept for existing callers.
+  inline int multiply_multi_matrix_to_malti_vector(double *a, size_t s,
+						   size_t nm, const double *m,
+						   size_t nv, const double *v,
+						   bool transpose) {
+    return multiply_multi_matrix_to_multi_vector(a, s, nm, m, nv, v,
+						 transpose);
+  }
+
+  inline int multiply_single_matrix_to_multi_vector(float *a, size_t s,
+						    size_t nm, const float *m,
+						    size_t nv, const float *v,
+						    int transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_multiply_float_single_matrix_to_multi_vector(a, s, nm, m,
+								 nv, v, t);
+  }
+
   inline int multiply_single_matrix_to_multi_vector(double *a, size_t s,
 						    size_t nm, const double *m,
 						    size_t nv, const double *v,
@@ -117,6 +405,341 @@ namespace pid {
 								  nv, v, t);
   }
 
+  inline int affine_multi_matrix_to_multi_vector(float *a, size_t s,
+						 size_t nm, const float *m,
+						 size_t nb, const float *b,
+						 size_t nv, const float *v,
+						 bool transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_affine_float_multi_matrix_to_multi_vector(a, s, nm, m,
+							      nb, b, nv, v, t);
+  }
+
+  inline int affine_multi_matrix_to_multi_vector(double *a, size_t s,
+						 size_t nm, const double *m,
+						 size_t nb, const double *b,
+						 size_t nv, const double *v,
+						 bool transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_affine_double_multi_matrix_to_multi_vector(a, s, nm, m,
+							       nb, b, nv, v, t);
+  }
+
+  inline int affine_single_matrix_to_multi_vector(float *a, size_t s,
+						  size_t nm, const float *m,
+						  size_t nb, const float *b,
+						  size_t nv, const float *v,
+						  bool transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_affine_float_single_matrix_to_multi_vector(a, s, nm, m,
+							       nb, b, nv, v, t);
+  }
+
+  inline int affine_single_matrix_to_multi_vector(double *a, size_t s,
+						  size_t nm, const double *m,
+						  size_t nb, const double *b,
+						  size_t nv, const double *v,
+						  bool transpose) {
+    int t = transpose ? 1 : 0;
+    return pid::vec_affine_double_single_matrix_to_multi_vector(a, s, nm, m,
+								nb, b, nv, v, t);
+  }
+
+  inline int multiply_matrix_to_matrix(float *c, size_t m, size_t n, size_t k,
+				       const float *a, const float *b) {
+    return pid::vec_multiply_float_matrix_to_matrix(c, m, n, k, a, b);
+  }
+
+  inline int multiply_matrix_to_matrix(double *c, size_t m, size_t n,
+				       size_t k, const double *a,
+				       const double *b) {
+    return pid::vec_multiply_double_matrix_to_matrix(c, m, n, k, a, b);
+  }
+  inline int knn_points(size_t *index, float *distance, size_t k, size_t d,
+			size_t nq, const float *q, size_t nr, const float *r) {
+    return pid::vec_knn_float_points(index, distance, k, d, nq, q, nr, r);
+  }
+
+  inline int knn_points(size_t *index, double *distance, size_t k, size_t d,
+			size_t nq, const double *q, size_t nr,
+			const double *r) {
+    return pid::vec_knn_double_points(index, distance, k, d, nq, q, nr, r);
+  }
+
+  inline int scan_identity(float *carry, size_t s, int op) {
+    return pid::vec_scan_float_identity(carry, s, op);
+  }
+
+  inline int scan_multi_vector(float *a, size_t s, size_t n, const float *v,
+			       int op, bool exclusive, float *carry) {
+    int e = exclusive ? 1 : 0;
+    return pid::vec_scan_float_multi_vector(a, s, n, v, op, e, carry);
+  }
+
+  inline int scan_combine(float *a, size_t s, size_t n, const float *c,
+			  int op) {
+    return pid::vec_scan_float_combine(a, s, n, c, op);
+  }
+
+  inline int scan_identity(double *carry, size_t s, int op) {
+    return pid::vec_scan_double_identity(carry, s, op);
+  }
+
+  inline int scan_multi_vector(double *a, size_t s, size_t n, const double *v,
+			       int op, bool exclusive, double *carry) {
+    int e = exclusive ? 1 : 0;
+    return pid::vec_scan_double_multi_vector(a, s, n, v, op, e, carry);
+  }
+
+  inline int scan_combine(double *a, size_t s, size_t n, const double *c,
+			  int op) {
+    return pid::vec_scan_double_combine(a, s, n, c, op);
+  }
+
+  inline int filter_multi_vector(float *a, size_t s, size_t n, const float *v,
+				 size_t nk, const float *k, float *history,
+				 int method) {
+    return pid::vec_filter_float_multi_vector(a, s, n, v, nk, k, history,
+					      method);
+  }
+
+  inline int filter_multi_vector(double *a, size_t s, size_t n,
+				 const double *v, size_t nk, const double *k,
+				 double *history, int method) {
+    return pid::vec_filter_double_multi_vector(a, s, n, v, nk, k, history,
+					       method);
+  }
+
+  inline int resample_filter(float *h, size_t nh, size_t up, size_t down) {
+    return pid::vec_resample_float_filter(h, nh, up, down);
+  }
+
+  inline int resample_multi_vector(float *a, size_t *na, size_t s, size_t n,
+				   const float *v, size_t up, size_t down,
+				   size_t nh, const float *h, float *history,
+				   size_t *phase) {
+    return pid::vec_resample_float_multi_vector(a, na, s, n, v, up, down,
+						nh, h, history, phase);
+  }
+
+  inline int resample_filter(double *h, size_t nh, size_t up, size_t down) {
+    return pid::vec_resample_double_filter(h, nh, up, down);
+  }
+
+  inline int resample_multi_vector(double *a, size_t *na, size_t s, size_t n,
+				   const double *v, size_t up, size_t down,
+				   size_t nh, const double *h, double *history,
+				   size_t *phase) {
+    return pid::vec_resample_double_multi_vector(a, na, s, n, v, up, down,
+						 nh, h, history, phase);
+  }
+
+  inline int histogram_uniform(size_t *counts, size_t nb, float lo, float hi,
+			       size_t s, size_t n, const float *v) {
+    return pid::vec_histogram_float_uniform(counts, nb, lo, hi, s, n, v);
+  }
+
+  inline int histogram_edges(size_t *counts, size_t nb, const float *edges,
+			     size_t s, size_t n, const float *v) {
+    return pid::vec_histogram_float_edges(counts, nb, edges, s, n, v);
+  }
+
+  inline int histogram_uniform(size_t *counts, size_t nb, double lo, double hi,
+			       size_t s, size_t n, const double *v) {
+    return pid::vec_histogram_double_uniform(counts, nb, lo, hi, s, n, v);
+  }
+
+  inline int histogram_edges(size_t *counts, size_t nb, const double *edges,
+			     size_t s, size_t n, const double *v) {
+    return pid::vec_histogram_double_edges(counts, nb, edges, s, n, v);
+  }
+
+
+
+  // vector_buffer class
+  //
+  // Owns an array read by (or to be written with) the vector stream
+  // functions, together with its size and dimension.  The array is
+  // released with the deleter given at construction, which defaults to
+  // delete_vector() so that arrays coming from new_vector() can be
+  // adopted as they are.  The buffer can be moved but not copied.
+
+  template <typename real> class vector_buffer {
+  public:
+    typedef real value_type;
+    typedef real *iterator;
+    typedef const real *const_iterator;
+    typedef void (*deleter_type)(real *);
+
+  private:
+    real *_data;
+    size_t _size;
+    size_t _dimension;
+    deleter_type _deleter;
+
+    static void default_deleter(real *v) {
+      delete_vector(v);
+    }
+
+  public:
+    vector_buffer()
+      : _data(0), _size(0), _dimension(1), _deleter(default_deleter) {
+    }
+
+    // Adopts v.  v must be releasable with deleter.
+    vector_buffer(real *v, size_t n, size_t dimension = 1,
+		  deleter_type deleter = default_deleter)
+      : _data(v), _size(n), _dimension(dimension > 0 ? dimension : 1),
+	_deleter(deleter) {
+    }
+
+    // Allocates n zero-cleared elements.
+    explicit vector_buffer(size_t n, size_t dimension = 1)
+      : _data(0), _size(0), _dimension(dimension > 0 ? dimension : 1),
+	_deleter(default_deleter) {
+      if (n > 0) {
+	_data = static_cast<real *>(std::calloc(n, sizeof(real)));
+	if (!_data) {
+	  throw std::bad_alloc();
+	}
+	_size = n;
+      }
+    }
+
+    vector_buffer(const vector_buffer &) = delete;
+    vector_buffer &operator = (const vector_buffer &) = delete;
+
+    vector_buffer(vector_buffer &&b)
+      : _data(b._data), _size(b._size), _dimension(b._dimension),
+	_deleter(b._deleter) {
+      b._data = 0;
+      b._size = 0;
+    }
+
+    vector_buffer &operator = (vector_buffer &&b) {
+      if (this != &b) {
+	reset();
+	_data = b._data;
+	_size = b._size;
+	_dimension = b._dimension;
+	_deleter = b._deleter;
+	b._data = 0;
+	b._size = 0;
+      }
+      return *this;
+    }
+
+    ~vector_buffer() {
+      reset();
+    }
+
+    // Releases the array and leaves the buffer empty.
+    void reset() {
+      if (_data && _deleter) {
+	_deleter(_data);
+      }
+      _data = 0;
+      _size = 0;
+    }
+
+    // Adopts v in place of the current array.
+    void reset(real *v, size_t n, deleter_type deleter = default_deleter) {
+      reset();
+      _data = v;
+      _size = n;
+      _deleter = deleter;
+    }
+
+    // Gives up ownership; the caller must release the returned array.
+    real *release() {
+      real *v = _data;
+      _data = 0;
+      _size = 0;
+      return v;
+    }
+
+    void swap(vector_buffer &b) {
+      std::swap(_data, b._data);
+      std::swap(_size, b._size);
+      std::swap(_dimension, b._dimension);
+      std::swap(_deleter, b._deleter);
+    }
+
+    real *data() {
+      return _data;
+    }
+
+    const real *data() const {
+      return _data;
+    }
+
+    size_t size() const {
+      return _size;
+    }
+
+    bool empty() const {
+      return _size == 0;
+    }
+
+    size_t dimension() const {
+      return _dimension;
+    }
+
+    void set_dimension(size_t dimension) {
+      _dimension = dimension > 0 ? dimension : 1;
+    }
+
+    // Number of records, i.e. size() / dimension().
+    size_t records() const {
+      return _size / _dimension;
+    }
+
+    deleter_type deleter() const {
+      return _deleter;
+    }
+
+    real &operator [] (size_t i) {
+      return _data[i];
+    }
+
+    const real &operator [] (size_t i) const {
+      return _data[i];
+    }
+
+    iterator begin() {
+      return _data;
+    }
+
+    iterator end() {
+      return _data + _size;
+    }
+
+    const_iterator begin() const {
+      return _data;
+    }
+
+    const_iterator end() const {
+      return _data + _size;
+    }
+  };
+
+  template <typename real> inline int
+  new_vector(vector_buffer<real> *b, FILE *fin) {
+    size_t n;
+    real *v;
+    int result = new_vector(&n, &v, fin);
+    if (result == 0) {
+      b->reset(v, (n == static_cast<size_t>(-1)) ? 0 : n);
+    }
+    return result;
+  }
+
+  template <typename real> inline int
+  put_vector(const vector_buffer<real> &b, FILE *fout) {
+    size_t s = b.dimension() > 1 ? b.dimension() : 0;
+    return put_vector(b.size(), b.data(), s, fout);
+  }
+
   // Utility functions and functors
 
   class string_to_string {
@@ -163,34 +786,61 @@ namespace pid {
     }
   }
 
+  // Record dimensions
+
+  // Records of up to fixed_dimensions components get code of their own:
+  // dispatch_dimension(d, k) calls k.template run<D>() with D == d, a
+  // constant, so that the loops over a record unroll (mark them with
+  // #pragma GCC unroll), or with D == 0 for other d, where k takes the
+  // dimension at run time.  The dimension comes from -s or the
+  // "dimension" hint.
+  const size_t fixed_dimensions = 8;
+
+  template <typename Kernel> inline void
+  dispatch_dimension(size_t d, Kernel &k) {
+    switch (d) {
+    case 1: k.template run<1>(); break;
+    case 2: k.template run<2>(); break;
+    case 3: k.template run<3>(); break;
+    case 4: k.template run<4>(); break;
+    case 5: k.template run<5>(); break;
+    case 6: k.template run<6>(); break;
+    case 7: k.template run<7>(); break;
+    case 8: k.template run<8>(); break;
+    default: k.template run<0>(); break;
+    }
+  }
+
   // vector_loader class
 
   template <typename real> class vector_loader {
   private:
+    vector_buffer<real> _buffer;
     std::valarray<real> *_values;
-    std::map<std::string, std::string> *_options;
-    std::map<std::string, std::string> *_hints;
-    std::vector<std::string> *_messages;
-    
-    void register_parameter(std::map<std::string, std::string> *map,
+    std::map<std::string, std::string> _options;
+    std::map<std::string, std::string> _hints;
+    std::vector<std::string> _messages;
+
+    void register_parameter(std::map<std::string, std::string> &map,
 			    char *line) {
-      char *s1 = line;
-      char *s2 = line;
-      while (*s2 != '\0' && *s2 != '=') {
-	++s2;
+      const char *s1 = line;
+      const char *s2 = line;
+      char *p = line;
+      while (*p != '\0' && *p != '=') {
+	++p;
       }
-      if (*s2 == '\0') {
+      if (*p == '\0') {
 	s2 = "1";
       }
       else {
-	*s2 = '\0';
-	++s2;
+	*p = '\0';
+	s2 = p + 1;
 	if (*s2 == '\0') {
 	  s2 = "0";
 	}
       }
-      map->insert(std::pair<std::string, std::string>(std::string(s1),
-						      std::string(s2)));
+      map.insert(std::pair<std::string, std::string>(std::string(s1),
+						     std::string(s2)));
     }
 
     void process_special_line(char *line) {
@@ -202,7 +852,7 @@ namespace pid {
 	register_parameter(_hints, line + 1);
 	break;
       case '?':
-	_messages->push_back(std::string(line + 1));
+	_messages.push_back(std::string(line + 1));
 	break;
       default:
 	break;
@@ -211,17 +861,13 @@ namespace pid {
 
     void cut_lf(char *line) {
       size_t l = std::strlen(line);
-      if (line[l - 1] == '\n') {
+      if (l > 0 && line[l - 1] == '\n') {
 	line[l - 1] = '\0';
       }
     }
 
   public:
-    vector_loader(const std::string &filename) throw (std::exception) {
-      _values = 0;
-      _options = new std::map<std::string, std::string>();
-      _hints = new std::map<std::string, std::string>();
-      _messages = new std::vector<std::string>();
+    vector_loader(const std::string &filename) : _values(0) {
       FILE *fin = std::fopen(filename.c_str(), "r");
       if (!fin) {
 	throw std::invalid_argument(filename);
@@ -229,9 +875,13 @@ namespace pid {
       // First scan
       char buff[VEC_MAXIMUM_LINE_LENGTH];
       while (!std::feof(fin)) {
+	buff[0] = '\0';
 	buff[VEC_MAXIMUM_LINE_LENGTH - 1] = '\0';
-	fgets(buff, VEC_MAXIMUM_LINE_LENGTH, fin);
+	if (!std::fgets(buff, VEC_MAXIMUM_LINE_LENGTH, fin)) {
+	  break;
+	}
 	if (buff[VEC_MAXIMUM_LINE_LENGTH - 1] != '\0') {
+	  std::fclose(fin);
 	  throw std::length_error(filename);
 	}
 	if (buff[0] == '%') {
@@ -239,42 +889,55 @@ namespace pid {
 	  process_special_line(buff + 1);
 	}
       }
-      // Second scan
+      // Second scan; the parsed array is adopted without copying.
       std::rewind(fin);
-      size_t n;
-      real *v;
-      int result = new_vector(&n, &v, fin);
+      int result = new_vector(&_buffer, fin);
       std::fclose(fin);
-      if (result == 0) {
-	_values = new std::valarray<real>(v, n);
-	delete_vector(v);
+      if (result != 0) {
+	throw std::runtime_error(filename);
       }
-      else {
-	// should thorw some exception
+      std::map<std::string, std::string>::const_iterator d
+	= _hints.find("dimension");
+      if (d != _hints.end()) {
+	_buffer.set_dimension(std::atoi(d->second.c_str()));
       }
     }
 
     ~vector_loader() {
       delete _values;
-      delete _options;
-      delete _hints;
-      delete _messages;
       _values = 0;
-      _options = 0;
-      _hints = 0;
-      _messages = 0;
     }
-    
+
+    vector_buffer<real> &buffer() {
+      return _buffer;
+    }
+
+    // Moves the loaded array out of the loader.
+    vector_buffer<real> release_buffer() {
+      delete _values;
+      _values = 0;
+      return std::move(_buffer);
+    }
+
+    // Copies the loaded array into a valarray on first use.  Prefer
+    // buffer(), which does not copy.
     std::valarray<real> *values() {
+      if (!_values) {
+	_values = new std::valarray<real>(_buffer.data(), _buffer.size());
+      }
       return _values;
     }
-    
+
+    std::map<std::string, std::string> *options() {
+      return &_options;
+    }
+
     std::map<std::string, std::string> *hints() {
-      return _hints;
+      return &_hints;
     }
-    
+
     std::vector<std::string> *messages() {
-      return _messages;
+      return &_messages;
     }
   };
 
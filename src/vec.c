@@ -18,10 +18,25 @@
  *
  */
 
+#define _GNU_SOURCE	/* fopencookie */
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <memory.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include "vec.h"
 
 #ifdef HAVE_CONFIG_H
@@ -31,6 +46,14 @@
 #define FORMAT_STR_1 "%.16g"
 #define FORMAT_STR_2 "%18.16g"
 
+#define VEC_CHUNKED_MAGIC "VCTRCHK1"
+#define VEC_CHUNKED_INDEX_MAGIC "VCTRINDX"
+#define VEC_CHUNKED_HEADER_SIZE (8 + 3 * sizeof(size_t))
+#define VEC_CHUNKED_TRAILER_SIZE (2 * sizeof(size_t) + 8)
+#define VEC_SPARSE_MAGIC "VCTRSPRS"
+#define VEC_STREAM_TOKEN "*"
+#define VEC_STREAM_LENGTH ((size_t)-1)
+
 int default_error_handler(int error_type, const char *error_message) {
 	if (error_type != 0) {
 		fprintf(stderr, "Vector Stream: Error (%d): %s\n", error_type, error_message);
@@ -45,73 +68,714 @@ int default_error_handler(int error_type, const char *error_message) {
 
 static vec_error_handler_t vec_error_handler = default_error_handler;
 
-static int skip_whitespace(FILE *fin) {
+/* State of the text parser.  Each reader has its own, so that vectors
+   can be read by several threads at a time. */
+struct vec_scanner {
+	FILE *fin;
+	size_t bytes;	/* consumed so far; used by the profiler */
+	char *buff;
+	int buff_length;
+	const char *map;	/* the file mapped into memory, or NULL */
+	size_t map_length;
+	size_t pos;	/* position in map */
+};
+
+/* Regular files are mapped and read from memory, from the position of
+   the stream on; pipes and terminals are read through stdio. */
+static void scanner_init(struct vec_scanner *sc, FILE *fin) {
+	struct stat st;
+	off_t start;
+
+	sc->fin = fin;
+	sc->bytes = 0;
+	sc->buff = 0;
+	sc->buff_length = 128;
+	sc->map = 0;
+	flockfile(fin);
+	if (fstat(fileno(fin), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (start = ftello(fin)) >= 0 && start < st.st_size) {
+		void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fin), 0);
+
+		if (m != MAP_FAILED) {
+			madvise(m, st.st_size, MADV_SEQUENTIAL);
+			sc->map = (const char *)m;
+			sc->map_length = st.st_size;
+			sc->pos = start;
+		}
+	}
+}
+
+/* Leaves the stream just after the last character read. */
+static void scanner_free(struct vec_scanner *sc) {
+	if (sc->map) {
+		fseeko(sc->fin, sc->pos, SEEK_SET);
+		munmap((void *)sc->map, sc->map_length);
+		sc->map = 0;
+	}
+	funlockfile(sc->fin);
+	free(sc->buff);
+	sc->buff = 0;
+}
+
+/* The reader holds the lock of the stream (see scanner_init), so that
+   the per-character calls need not take it again. */
+static int scan_char(struct vec_scanner *sc) {
+	int c;
+
+	if (sc->map) {
+		c = sc->pos < sc->map_length ? (unsigned char)sc->map[sc->pos++] : EOF;
+	}
+	else {
+		c = getc_unlocked(sc->fin);
+	}
+	if (c != EOF) {
+		++sc->bytes;
+	}
+	return c;
+}
+
+static void unscan_char(int c, struct vec_scanner *sc) {
+	if (c != EOF) {
+		--sc->bytes;
+		if (sc->map) {
+			--sc->pos;
+		}
+		else {
+			ungetc(c, sc->fin);
+		}
+	}
+}
+
+static int skip_whitespace(struct vec_scanner *sc) {
 	int c;
 
 	do {
-		if (feof(fin))
-			return 1;
-		c = fgetc(fin);
+		c = scan_char(sc);
 	}
 	while (isspace(c));
-	ungetc(c, fin);
+	if (c == EOF)
+		return 1;
+	unscan_char(c, sc);
 	return 0;
 }
 
-static int skip_comment(FILE *fin) {
+static int skip_comment(struct vec_scanner *sc) {
 	int c;
 
-	skip_whitespace(fin);
-	c = fgetc(fin);
+	skip_whitespace(sc);
+	c = scan_char(sc);
 	if (c == '%') {
 		/* skip to EOL */
 		do {
-			c = fgetc(fin);
+			c = scan_char(sc);
 		}
-		while (c != '\n');
+		while (c != '\n' && c != EOF);
 		/* check the next line (recursive call) */
-		return skip_comment(fin);
+		return skip_comment(sc);
 	}
 	else {
-		ungetc(c, fin);
-		return skip_whitespace(fin);
+		unscan_char(c, sc);
+		return skip_whitespace(sc);
 	}
 }
 
-static char *get_token(FILE *fin) {
-	/* Warning: this function returns MUTABLE array. */
-	static int buff_length = 128;
-	static char *buff = 0;
+static char *get_token(struct vec_scanner *sc) {
+	/* Warning: this function returns MUTABLE array, valid until the
+	   next call with the same scanner. */
 	int i = 0;
 	int c;
 
-	if (!buff) {
-	buff = (char *)calloc(buff_length, sizeof(char));
+	if (!sc->buff) {
+		sc->buff = (char *)calloc(sc->buff_length, sizeof(char));
 	}
-	skip_whitespace(fin);
-	while (!feof(fin) && !isspace(c = fgetc(fin))) {
-		if (i > buff_length - 2) {
+	skip_whitespace(sc);
+	while ((c = scan_char(sc)) != EOF && !isspace(c)) {
+		if (i > sc->buff_length - 2) {
 			char *tmp_buff;
 
-			tmp_buff = (char *)calloc(buff_length * 2, sizeof(char));
-			memcpy(tmp_buff, buff, buff_length * sizeof(char));
-			free(buff);
-			buff_length *= 2;
-			buff = tmp_buff;
+			tmp_buff = (char *)calloc(sc->buff_length * 2, sizeof(char));
+			memcpy(tmp_buff, sc->buff, sc->buff_length * sizeof(char));
+			free(sc->buff);
+			sc->buff_length *= 2;
+			sc->buff = tmp_buff;
 		}
-		buff[i] = c;
+		sc->buff[i] = c;
 		++i;
 	}
-	buff[i] = 0;
-	return &buff[0];
+	sc->buff[i] = 0;
+	return &sc->buff[0];
+}
+
+/* Exact powers of ten for scan_decimal. */
+static const double vec_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Converts the decimal number [p, end) if its digits fit in a double
+   and the power of ten is exact; the quotient or product of the two is
+   then rounded once, as strtod rounds (Clinger's fast path).  Returns 0
+   on success, or 1 if strtod has to do it. */
+static int scan_decimal(const char *p, const char *end, double *x) {
+	int negative = 0, digits = 0, e = 0, e_negative = 0, e_value = 0;
+	unsigned long long m = 0;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p++ == '-';
+	}
+	if (p == end) {
+		return 1;
+	}
+	for (; p < end && isdigit((unsigned char)*p); ++p) {
+		if (m > 0 || *p != '0') {
+			m = m * 10 + (*p - '0');
+			++digits;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && isdigit((unsigned char)*p); ++p) {
+			if (m > 0 || *p != '0') {
+				m = m * 10 + (*p - '0');
+				++digits;
+			}
+			--e;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		++p;
+		if (p < end && (*p == '-' || *p == '+')) {
+			e_negative = *p++ == '-';
+		}
+		if (p == end) {
+			return 1;
+		}
+		for (; p < end && isdigit((unsigned char)*p) && e_value < 1000; ++p) {
+			e_value = e_value * 10 + (*p - '0');
+		}
+		e += e_negative ? -e_value : e_value;
+	}
+	if (p != end || digits > 19 || m > ((unsigned long long)1 << 53) || e < -22 || e > 22) {
+		return 1;
+	}
+	*x = e < 0 ? (double)m / vec_powers_of_ten[-e] : (double)m * vec_powers_of_ten[e];
+	if (negative) {
+		*x = -*x;
+	}
+	return 0;
+}
+
+/* atof(get_token(sc)), but from the mapped file in place if a space
+   ends the token there. */
+static double scan_number(struct vec_scanner *sc) {
+	if (sc->map) {
+		const char *t, *p, *end = sc->map + sc->map_length;
+
+		skip_whitespace(sc);
+		t = p = sc->map + sc->pos;
+		while (p < end && !isspace((unsigned char)*p)) {
+			++p;
+		}
+		if (p < end) {
+			double x;
+
+			/* the space is consumed, as get_token does */
+			sc->bytes += p - t + 1;
+			sc->pos = p - sc->map + 1;
+			return scan_decimal(t, p, &x) == 0 ? x : strtod(t, NULL);
+		}
+	}
+	return atof(get_token(sc));
 }
 
+/* Sparse vectors; defined below. */
+static int get_sparse_text(struct vec_scanner *sc, size_t *n, size_t *nnz, size_t **index, void **v, size_t element_size);
+static int get_sparse_binary(FILE *fin, size_t *n, size_t *nnz, size_t **index, void **v, size_t element_size);
+static void *scatter_sparse(size_t n, size_t nnz, const size_t *index, const void *v, size_t element_size);
+static int try_put_sparse(size_t n, const void *v, size_t element_size, int binary, FILE *fout);
+
+/* Vectors of unknown length; defined below. */
+static int get_stream_text(struct vec_scanner *sc, size_t *n, void **v, size_t element_size);
+static int get_stream_binary(FILE *fin, size_t *n, void **v, size_t element_size);
+
 vec_error_handler_t vec_set_error_handler(vec_error_handler_t new_error_handler) {
 	vec_error_handler_t current_error_handler = vec_error_handler;
 	vec_error_handler = new_error_handler;
 	return current_error_handler;
 }
 
+/* Profiling */
+
+struct vec_profile_counter {
+	double start;
+	double seconds;
+	double elements;
+	double bytes;
+	int depth;
+};
+
+static const char *vec_profile_phase_names[VEC_PROFILE_PHASES] = {
+	"read", "compute", "write"
+};
+
+static int vec_profile_state = -1;	/* -1: VEC_PROFILE not checked yet */
+static const char *vec_profile_name = 0;
+static double vec_profile_origin = 0;
+static struct vec_profile_counter vec_profile_counters[VEC_PROFILE_PHASES];
+
+static double vec_profile_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void vec_profile_report_at_exit(void) {
+	vec_profile_report_to_file(stderr);
+}
+
+void vec_profile_start(const char *name) {
+	if (vec_profile_state != 1) {
+		vec_profile_origin = vec_profile_now();
+		memset(vec_profile_counters, 0, sizeof(vec_profile_counters));
+		atexit(vec_profile_report_at_exit);
+	}
+	vec_profile_state = 1;
+	if (name) {
+		vec_profile_name = name;
+	}
+}
+
+int vec_profile_is_enabled(void) {
+	if (vec_profile_state < 0) {
+		const char *e = getenv("VEC_PROFILE");
+
+		vec_profile_state = 0;
+		if (e && *e != '\0' && strcmp(e, "0") != 0) {
+			vec_profile_start(0);
+		}
+	}
+	return vec_profile_state;
+}
+
+void vec_profile_begin(int phase) {
+	if (vec_profile_is_enabled() && phase >= 0 && phase < VEC_PROFILE_PHASES) {
+		struct vec_profile_counter *c = &vec_profile_counters[phase];
+
+		/* nested calls (e.g. text reader falling to binary) count once */
+		if (c->depth++ == 0) {
+			c->start = vec_profile_now();
+		}
+	}
+}
+
+void vec_profile_end(int phase, size_t elements, size_t bytes) {
+	if (vec_profile_state == 1 && phase >= 0 && phase < VEC_PROFILE_PHASES) {
+		struct vec_profile_counter *c = &vec_profile_counters[phase];
+
+		if (c->depth > 0 && --c->depth == 0) {
+			c->seconds += vec_profile_now() - c->start;
+			c->elements += (double)elements;
+			c->bytes += (double)bytes;
+		}
+	}
+}
+
+int vec_profile_report_to_file(FILE *fout) {
+	if (fout) {
+		struct rusage ru;
+		char label[64];
+		int i;
+
+		if (vec_profile_state != 1) {
+			return 0;
+		}
+		if (vec_profile_name) {
+			sprintf(label, "%.40s, pid %ld", vec_profile_name, (long)getpid());
+		}
+		else {
+			sprintf(label, "pid %ld", (long)getpid());
+		}
+		getrusage(RUSAGE_SELF, &ru);
+		fprintf(fout, "Vector Stream: Profile (%s): total %.6f s, peak RSS %ld kB\n",
+			label, vec_profile_now() - vec_profile_origin, (long)ru.ru_maxrss);
+		for (i = 0; i < VEC_PROFILE_PHASES; ++i) {
+			struct vec_profile_counter *c = &vec_profile_counters[i];
+			double t = c->seconds > 0 ? c->seconds : 1e-9;
+
+			fprintf(fout, "Vector Stream: Profile (%s): %-7s %.6f s, %.0f elements (%.3g elements/s), %.0f bytes (%.3g MB/s)\n",
+				label, vec_profile_phase_names[i], c->seconds,
+				c->elements, c->elements / t, c->bytes, c->bytes / t * 1e-6);
+		}
+		return 0;
+	}
+	else {
+		vec_error_handler(1, "vec_profile_report_to_file: fout == NULL");
+		return 1;
+	}
+}
+
+/* Memory placement */
+
+/*
+ * A tool that reads its vectors on one thread first-touches all of
+ * their pages there, so on a host with several NUMA nodes they sit on
+ * one node and its memory controller serves the threads of all.  With
+ * the interleave policy, the pages of large vectors are spread over the
+ * nodes as they are allocated instead.  The mask and the node of each
+ * CPU are read once from /sys; without it, there is one node.
+ */
+#define VEC_NUMA_MAXIMUM_NODES 64	/* bits in vec_numa_mask */
+#define VEC_NUMA_MAXIMUM_CPUS 1024
+#define VEC_NUMA_MINIMUM_BYTES (1 << 21)	/* smaller vectors stay local */
+
+static int vec_numa_policy = -1;	/* -1: VEC_NUMA not checked yet */
+static int vec_numa_nodes = 0;	/* 0: /sys not read yet */
+static unsigned long vec_numa_mask = 0;	/* nodes with memory */
+static short vec_numa_cpu_nodes[VEC_NUMA_MAXIMUM_CPUS];
+
+/* Reads a list like "0-3,8,10-11" from path into set[0 .. size). */
+static int read_numa_list(const char *path, unsigned char *set, int size) {
+	FILE *f = fopen(path, "r");
+	char line[4096];
+	char *p, *end;
+	long first, last, i;
+
+	memset(set, 0, size);
+	if (!f) {
+		return 1;
+	}
+	p = fgets(line, sizeof(line), f);
+	fclose(f);
+	while (p && *p != '\0' && *p != '\n') {
+		first = last = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+		}
+		for (i = first; i <= last && i < size; ++i) {
+			if (i >= 0) {
+				set[i] = 1;
+			}
+		}
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return 0;
+}
+
+static void read_numa_topology(void) {
+	unsigned char nodes[VEC_NUMA_MAXIMUM_NODES];
+	unsigned char cpus[VEC_NUMA_MAXIMUM_CPUS];
+	char path[64];
+	unsigned long mask = 0;
+	int count = 0, i, c;
+
+	if (vec_numa_nodes > 0) {
+		return;
+	}
+	memset(vec_numa_cpu_nodes, 0, sizeof(vec_numa_cpu_nodes));
+	if (read_numa_list("/sys/devices/system/node/has_memory", nodes, VEC_NUMA_MAXIMUM_NODES) == 0 ||
+		read_numa_list("/sys/devices/system/node/online", nodes, VEC_NUMA_MAXIMUM_NODES) == 0) {
+		for (i = 0; i < VEC_NUMA_MAXIMUM_NODES; ++i) {
+			if (!nodes[i]) {
+				continue;
+			}
+			mask |= 1UL << i;
+			++count;
+			sprintf(path, "/sys/devices/system/node/node%d/cpulist", i);
+			if (read_numa_list(path, cpus, VEC_NUMA_MAXIMUM_CPUS) == 0) {
+				for (c = 0; c < VEC_NUMA_MAXIMUM_CPUS; ++c) {
+					if (cpus[c]) {
+						vec_numa_cpu_nodes[c] = (short)i;
+					}
+				}
+			}
+		}
+	}
+	if (count == 0) {
+		mask = 1;
+		count = 1;
+	}
+	vec_numa_mask = mask;
+	vec_numa_nodes = count;
+}
+
+void vec_set_numa_policy(int policy) {
+	vec_numa_policy = policy;
+}
+
+int vec_get_numa_policy(void) {
+	if (vec_numa_policy < 0) {
+		const char *e = getenv("VEC_NUMA");
+
+		if (e && (strcmp(e, "off") == 0 || strcmp(e, "0") == 0)) {
+			vec_numa_policy = VEC_NUMA_OFF;
+		}
+		else if (e && strcmp(e, "interleave") == 0) {
+			vec_numa_policy = VEC_NUMA_INTERLEAVE;
+		}
+		else {
+			vec_numa_policy = VEC_NUMA_LOCAL;
+		}
+	}
+	return vec_numa_policy;
+}
+
+int vec_numa_node_count(void) {
+	read_numa_topology();
+	return vec_numa_nodes;
+}
+
+int vec_numa_node_of_cpu(int cpu) {
+	read_numa_topology();
+	return (cpu >= 0 && cpu < VEC_NUMA_MAXIMUM_CPUS) ? vec_numa_cpu_nodes[cpu] : 0;
+}
+
+int vec_numa_worker_cpu(size_t w, size_t threads) {
+	cpu_set_t allowed;
+	int ids[VEC_NUMA_MAXIMUM_NODES];
+	size_t counts[VEC_NUMA_MAXIMUM_NODES];
+	size_t groups = 0, g, k;
+	int cpu;
+
+	if (threads <= 1 || w >= threads || vec_get_numa_policy() == VEC_NUMA_OFF ||
+		vec_numa_node_count() < 2 || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return -1;
+	}
+	/* the nodes of the allowed CPUs, in the order of the CPUs */
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &allowed)) {
+			int id = vec_numa_node_of_cpu(cpu);
+
+			for (g = 0; g < groups && ids[g] != id; ++g) {
+			}
+			if (g == groups) {
+				ids[groups] = id;
+				counts[groups++] = 0;
+			}
+			++counts[g];
+		}
+	}
+	if (groups < 2) {
+		return -1;
+	}
+	/* worker w is the k-th of node g, whose first is ceil(g * threads / groups) */
+	g = w * groups / threads;
+	k = (w - (g * threads + groups - 1) / groups) % counts[g];
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, &allowed) && vec_numa_node_of_cpu(cpu) == ids[g] && k-- == 0) {
+			return cpu;
+		}
+	}
+	return -1;
+}
+
+int vec_interleave_memory(void *p, size_t bytes) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t first = ((size_t)p + page - 1) / page * page;
+	size_t last = ((size_t)p + bytes) / page * page;
+
+	read_numa_topology();
+	if (vec_numa_nodes < 2 || last <= first) {
+		return 0;
+	}
+	/* Pages already touched are moved; the rest are placed on first
+	   touch.  Only whole pages are bound, as the allocator may share
+	   the partial ones at either end. */
+	if (syscall(SYS_mbind, (void *)first, last - first, MPOL_INTERLEAVE,
+			&vec_numa_mask, VEC_NUMA_MAXIMUM_NODES + 1, MPOL_MF_MOVE) != 0) {
+		return 1;
+	}
+	return 0;
+}
+
+/* Applies the policy to the elements of a vector just read. */
+static void place_elements(void *v, size_t bytes) {
+	if (v && bytes >= VEC_NUMA_MINIMUM_BYTES &&
+		vec_get_numa_policy() == VEC_NUMA_INTERLEAVE) {
+		vec_interleave_memory(v, bytes);
+	}
+}
+
+/* Allocates the elements of a vector to be read, placed by the policy
+   before they are touched. */
+static void *new_elements(size_t n, size_t element_size) {
+	void *v = calloc(n, element_size);
+
+	place_elements(v, n * element_size);
+	return v;
+}
+
+/* Parse cache */
+
+/*
+ * With a cache directory, the text readers keep each dense vector they
+ * parse from a regular file in a binary entry of the directory, named by
+ * the device, inode, size and modification time of the file and the
+ * position of the vector in it.  Reading the same vector of the
+ * unchanged file again maps the entry and copies the elements out
+ * (callers own and free the vectors) instead of parsing the text.  An
+ * entry is written to a temporary file and renamed into place, so that
+ * readers running at the same time see all of it or nothing; an entry
+ * whose header does not match its key and length is ignored.  Entries
+ * of files since changed are left for the user to clean up.
+ */
+#define VEC_CACHE_MAGIC "VCTRCCH1"
+#define VEC_CACHE_PATH_LENGTH 4096
+
+struct vec_cache_header {
+	char magic[8];
+	unsigned long long device;
+	unsigned long long inode;
+	unsigned long long size;
+	long long mtime;
+	long long mtime_nsec;
+	unsigned long long offset;	/* of the vector in the file */
+	unsigned long long element_size;
+	unsigned long long n;
+	unsigned long long end;	/* offset just after the vector */
+};
+
+static pthread_once_t vec_parse_cache_once = PTHREAD_ONCE_INIT;
+static char *vec_parse_cache = NULL;
+
+/* Run once, as the readers on several threads may look at the cache
+   for the first time together. */
+static void get_parse_cache_from_environment(void) {
+	const char *e = getenv("VEC_CACHE");
+
+	if (e && *e != '\0' && (vec_parse_cache = strdup(e)) != NULL) {
+		mkdir(vec_parse_cache, 0700);
+	}
+}
+
+/* Not thread-safe: call it before reading on other threads. */
+void vec_set_parse_cache(const char *directory) {
+	pthread_once(&vec_parse_cache_once, get_parse_cache_from_environment);
+	free(vec_parse_cache);
+	vec_parse_cache = (directory && *directory != '\0') ? strdup(directory) : NULL;
+	if (vec_parse_cache) {
+		mkdir(vec_parse_cache, 0700);
+	}
+}
+
+const char *vec_get_parse_cache(void) {
+	pthread_once(&vec_parse_cache_once, get_parse_cache_from_environment);
+	return vec_parse_cache;
+}
+
+/* The key of an entry is public (anyone can stat the file), so only
+   entries that nobody else could have written are trusted: the
+   directory and the entries must be ours and not writable by others. */
+static int is_private(const struct stat *st) {
+	return st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/* Fills the key of the vector at the position of fin and the path of
+   its entry; returns 0 if the vector can be cached. */
+static int cache_key(FILE *fin, size_t element_size, struct vec_cache_header *h, char *path) {
+	const char *dir = vec_get_parse_cache();
+	struct stat st;
+	off_t offset;
+	int length;
+
+	if (!dir || stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || !is_private(&st)) {
+		return 1;
+	}
+	if (fstat(fileno(fin), &st) != 0 || !S_ISREG(st.st_mode) || (offset = ftello(fin)) < 0) {
+		return 1;
+	}
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, VEC_CACHE_MAGIC, 8);
+	h->device = st.st_dev;
+	h->inode = st.st_ino;
+	h->size = st.st_size;
+	h->mtime = st.st_mtim.tv_sec;
+	h->mtime_nsec = st.st_mtim.tv_nsec;
+	h->offset = offset;
+	h->element_size = element_size;
+	length = snprintf(path, VEC_CACHE_PATH_LENGTH, "%s/%llx-%llx-%llx-%llx.%llx-%llx-%llu.vcache",
+		dir, h->device, h->inode, h->size, (unsigned long long)h->mtime,
+		(unsigned long long)h->mtime_nsec, h->offset, h->element_size);
+	return (length < 0 || length >= VEC_CACHE_PATH_LENGTH) ? 1 : 0;
+}
+
+/* Reads the vector from its entry and leaves fin after the vector, as
+   the parser would have; returns 0 on a hit. */
+static int get_cached(const struct vec_cache_header *key, const char *path, FILE *fin, size_t *n, void **v) {
+	const struct vec_cache_header *h;
+	struct stat st;
+	void *m;
+	int fd = open(path, O_RDONLY | O_NOFOLLOW);
+
+	if (fd < 0) {
+		return 1;
+	}
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || !is_private(&st) ||
+		(size_t)st.st_size < sizeof(*h) ||
+		(m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	h = (const struct vec_cache_header *)m;
+	if (memcmp(h, key, offsetof(struct vec_cache_header, n)) != 0 || h->n == 0 ||
+		(size_t)st.st_size != sizeof(*h) + h->n * h->element_size ||
+		(*v = new_elements(h->n, h->element_size)) == NULL) {
+		munmap(m, st.st_size);
+		return 1;
+	}
+	if (fseeko(fin, h->end, SEEK_SET) != 0) {
+		free(*v);
+		*v = NULL;
+		munmap(m, st.st_size);
+		return 1;
+	}
+	*n = h->n;
+	memcpy(*v, h + 1, *n * h->element_size);
+	munmap(m, st.st_size);
+	return 0;
+}
+
+static int write_all(int fd, const void *p, size_t length) {
+	while (length > 0) {
+		ssize_t r = write(fd, p, length);
+
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return 1;
+		}
+		p = (const char *)p + r;
+		length -= r;
+	}
+	return 0;
+}
+
+/* Writes the entry of the vector just parsed; fin is after it. */
+static void put_cached(struct vec_cache_header *h, const char *path, FILE *fin, size_t n, const void *v) {
+	char temporary[VEC_CACHE_PATH_LENGTH + 8];
+	off_t end = ftello(fin);
+	int fd;
+
+	if (end < 0 || n == 0 || !v) {
+		return;
+	}
+	h->n = n;
+	h->end = end;
+	sprintf(temporary, "%s.XXXXXX", path);
+	fd = mkstemp(temporary);
+	if (fd < 0) {
+		return;
+	}
+	if (write_all(fd, h, sizeof(*h)) != 0 || write_all(fd, v, n * h->element_size) != 0 ||
+		close(fd) != 0 || rename(temporary, path) != 0) {
+		unlink(temporary);
+	}
+}
+
 int vec_put_header_to_file(FILE *fout) {
 	if (fout) {
 		fputs("%!VCTR\n"
@@ -189,23 +853,32 @@ int vec_put_nil_to_file(FILE *fout) {
 
 int vec_put_float_vector_to_file(size_t n, const float *v, size_t s, FILE *fout) {
 	if (fout) {
-		fprintf(fout, "%d %% Number of elements\n", n);
+		size_t bytes = 0;
+
+		if (v && n > 0 && n != (size_t)-1 && try_put_sparse(n, v, sizeof(float), 0, fout)) {
+			return 0;
+		}
+		vec_profile_begin(VEC_PROFILE_WRITE);
+		if (n != (size_t)-1) {
+			bytes += fprintf(fout, "%lu %% Number of elements\n", (unsigned long)n);
+		}
 		if (n > 0 && v != NULL) {
 			if (s > 1) {
 				size_t i, j;
 				for (i = 0; i < n; i += s) {
 					for (j = 0; j < s; ++j) {
 						if (i + j < n) {
-							fprintf(fout, FORMAT_STR_2 " ", (double)v[i + j]);
+							bytes += fprintf(fout, FORMAT_STR_2 " ", (double)v[i + j]);
 						}
 					}
 					fputc('\n', fout);
+					++bytes;
 				}
 			}
 			else {
 				size_t i;
 				for (i = 0; i < n; ++i) {
-					fprintf(fout, FORMAT_STR_1 "\n", (double)v[i]);
+					bytes += fprintf(fout, FORMAT_STR_1 "\n", (double)v[i]);
 				}
 			}
 		}
@@ -215,6 +888,7 @@ int vec_put_float_vector_to_file(size_t n, const float *v, size_t s, FILE *fout)
 		else {
 			vec_put_nil_to_file(fout);
 		}
+		vec_profile_end(VEC_PROFILE_WRITE, v ? n : 0, bytes);
 		return 0;
 	}
 	else {
@@ -228,25 +902,56 @@ vec_new_float_vector_from_file(size_t *n, float **v, FILE *fin) {
 	if (fin) {
 		size_t i;
 		char *t;
+		struct vec_scanner sc;
 		int c;
+		struct vec_cache_header key;
+		char path[VEC_CACHE_PATH_LENGTH];
+		int cached = cache_key(fin, sizeof(float), &key, path) == 0;
+		int r = 0;
 
-		c = fgetc(fin);
+		vec_profile_begin(VEC_PROFILE_READ);
+		if (cached && get_cached(&key, path, fin, n, (void **)v) == 0) {
+			vec_profile_end(VEC_PROFILE_READ, *n, sizeof(key) + *n * sizeof(float));
+			return 0;
+		}
+		scanner_init(&sc, fin);
+		c = scan_char(&sc);
 		if (c == 'V') {
 			vec_error_handler(0, "falls to binary mode");
+			scanner_free(&sc);
 			ungetc(c, fin);
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
 			return vec_new_float_vector_from_file_binary(n, v, fin);
 		}
 		else {
-			ungetc(c, fin);
-			skip_comment(fin);
-			t = get_token(fin);
-			if (strcmp(t, "nil") != 0) {
-				*n = atoi(t);
+			unscan_char(c, &sc);
+			skip_comment(&sc);
+			t = get_token(&sc);
+			if (strcmp(t, "sparse") == 0) {
+				size_t nnz, *index;
+				void *w;
+
+				*v = NULL;
+				r = get_sparse_text(&sc, n, &nnz, &index, &w, sizeof(float));
+				if (r == 0) {
+					*v = (float *)scatter_sparse(*n, nnz, index, w, sizeof(float));
+					free(index);
+					free(w);
+				}
+				else {
+					*n = 0;
+				}
+			}
+			else if (strcmp(t, VEC_STREAM_TOKEN) == 0) {
+				r = get_stream_text(&sc, n, (void **)v, sizeof(float));
+			}
+			else if (strcmp(t, "nil") != 0) {
+				*n = strtoul(t, NULL, 10);
 				if (*n > 0) {
-					*v = (float *)calloc(*n, sizeof(float));
+					*v = (float *)new_elements(*n, sizeof(float));
 					for (i = 0; i < *n; ++i) {
-						skip_comment(fin);
-						(*v)[i] = (float)atof(get_token(fin));
+						skip_comment(&sc);
+						(*v)[i] = (float)scan_number(&sc);
 					}
 				}
 				else {
@@ -257,7 +962,12 @@ vec_new_float_vector_from_file(size_t *n, float **v, FILE *fin) {
 				*n = -1;
 				*v = NULL;
 			}
-			return 0;
+			scanner_free(&sc);
+			if (cached && r == 0 && *n != (size_t)-1) {
+				put_cached(&key, path, fin, *n, *v);
+			}
+			vec_profile_end(VEC_PROFILE_READ, *n != (size_t)-1 ? *n : 0, sc.bytes);
+			return r;
 		}
 	}
 	else {
@@ -274,9 +984,14 @@ void vec_delete_float_vector(float *v) {
 
 int vec_put_float_vector_to_file_binary(size_t n, const float *v, FILE *fout) {
 	if (fout && v && n > 0) {
+		if (try_put_sparse(n, v, sizeof(float), 1, fout)) {
+			return 0;
+		}
+		vec_profile_begin(VEC_PROFILE_WRITE);
 		fwrite("VCTR****", sizeof(char), 8, fout);
 		fwrite(&n, sizeof(size_t), 1, fout);
 		fwrite(v, sizeof(float), n, fout);
+		vec_profile_end(VEC_PROFILE_WRITE, n, 8 + sizeof(size_t) + n * sizeof(float));
 		return 0;
 	}
 	else {
@@ -289,18 +1004,49 @@ int vec_new_float_vector_from_file_binary(size_t *n, float **v, FILE *fin) {
 	if (fin) {
 		char buff[16];
 		
+		vec_profile_begin(VEC_PROFILE_READ);
 		fread(&buff[0], sizeof(char), 8, fin);
-		if (strncmp(&buff[0], "VCTR****", 4) == 0) {
+		if (memcmp(&buff[0], VEC_CHUNKED_MAGIC, 8) == 0) {
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
+			if (fseeko(fin, -8, SEEK_CUR) != 0) {
+				*n = 0;
+				*v = NULL;
+				vec_error_handler(1, "vec_new_float_vector_from_file_binary: chunked vector needs a seekable file");
+				return 1;
+			}
+			return vec_new_float_vector_range_from_file_chunked(0, (size_t)-1, n, v, fin);
+		}
+		else if (memcmp(&buff[0], VEC_SPARSE_MAGIC, 8) == 0) {
+			size_t nnz, *index;
+			void *w;
+
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
+			*v = NULL;
+			if (get_sparse_binary(fin, n, &nnz, &index, &w, sizeof(float)) != 0) {
+				return 1;
+			}
+			*v = (float *)scatter_sparse(*n, nnz, index, w, sizeof(float));
+			free(index);
+			free(w);
+			return 0;
+		}
+		else if (strncmp(&buff[0], "VCTR****", 4) == 0) {
 			fread(&buff[0], sizeof(size_t), 1, fin);
 			*n = *(size_t *)&buff[0];
-			*v = (float *)calloc(*n, sizeof(float));
+			if (*n == VEC_STREAM_LENGTH) {
+				vec_profile_end(VEC_PROFILE_READ, 0, 0);
+				return get_stream_binary(fin, n, (void **)v, sizeof(float));
+			}
+			*v = (float *)new_elements(*n, sizeof(float));
 			fread(*v, sizeof(float), *n, fin);
+			vec_profile_end(VEC_PROFILE_READ, *n, 8 + sizeof(size_t) + *n * sizeof(float));
  			return 0;
 		}
 		else {
 			*n = 0;
 			*v = NULL;
 			vec_error_handler(1, "vec_new_float_vector_from_file_binary: bad magic");
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
 			return 1;
 		}
 	}
@@ -312,24 +1058,33 @@ int vec_new_float_vector_from_file_binary(size_t *n, float **v, FILE *fin) {
 
 int vec_put_double_vector_to_file(size_t n, const double *v, size_t s, FILE *fout) {
 	if (fout) {
-		fprintf(fout, "%d %% Number of elements\n", n);
+		size_t bytes = 0;
+
+		if (v && n > 0 && n != (size_t)-1 && try_put_sparse(n, v, sizeof(double), 0, fout)) {
+			return 0;
+		}
+		vec_profile_begin(VEC_PROFILE_WRITE);
+		if (n != (size_t)-1) {
+			bytes += fprintf(fout, "%lu %% Number of elements\n", (unsigned long)n);
+		}
 		if (n > 0 && v != NULL) {
 			if (s > 1) {
 				size_t i, j;
 				for (i = 0; i < n; i += s) {
 					for (j = 0; j < s; ++j) {
 						if (i + j < n) {
-							fprintf(fout, FORMAT_STR_2 " ", v[i + j]);
+							bytes += fprintf(fout, FORMAT_STR_2 " ", v[i + j]);
 						}
 					}
 					fputc('\n', fout);
+					++bytes;
 				}
 			}
 			else {
 				size_t i;
 				
 				for (i = 0; i < n; ++i) {
-					fprintf(fout, FORMAT_STR_1 "\n", v[i]);
+					bytes += fprintf(fout, FORMAT_STR_1 "\n", v[i]);
 				}
 			}
  		}
@@ -339,6 +1094,7 @@ int vec_put_double_vector_to_file(size_t n, const double *v, size_t s, FILE *fou
 		else {
 			vec_put_nil_to_file(fout);
 		}
+		vec_profile_end(VEC_PROFILE_WRITE, v ? n : 0, bytes);
 		return 0;
 	}
 	else {
@@ -351,26 +1107,57 @@ int vec_new_double_vector_from_file(size_t *n, double **v, FILE *fin) {
 	if (fin) {
 		size_t i;
 		char *t;
+		struct vec_scanner sc;
 		int c;
+		struct vec_cache_header key;
+		char path[VEC_CACHE_PATH_LENGTH];
+		int cached = cache_key(fin, sizeof(double), &key, path) == 0;
+		int r = 0;
 
-		c = fgetc(fin);
+		vec_profile_begin(VEC_PROFILE_READ);
+		if (cached && get_cached(&key, path, fin, n, (void **)v) == 0) {
+			vec_profile_end(VEC_PROFILE_READ, *n, sizeof(key) + *n * sizeof(double));
+			return 0;
+		}
+		scanner_init(&sc, fin);
+		c = scan_char(&sc);
 		if (c == 'V') {
 			vec_error_handler(0, "falls to binary mode");
+			scanner_free(&sc);
 			ungetc(c, fin);
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
 			return vec_new_double_vector_from_file_binary(n, v, fin);
 		}
 		else {
-			ungetc(c, fin);
-			skip_comment(fin);
-			t = get_token(fin);
-			if (strcmp(t, "nil") != 0) {
-				*n = atoi(t);
-				if (*n > 0) {
-					*v = (double *)calloc(*n, sizeof(double));
-					for (i = 0; i < *n; ++i) {
-						skip_comment(fin);
-						(*v)[i] = atof(get_token(fin));
-					}
+			unscan_char(c, &sc);
+			skip_comment(&sc);
+			t = get_token(&sc);
+			if (strcmp(t, "sparse") == 0) {
+				size_t nnz, *index;
+				void *w;
+
+				*v = NULL;
+				r = get_sparse_text(&sc, n, &nnz, &index, &w, sizeof(double));
+				if (r == 0) {
+					*v = (double *)scatter_sparse(*n, nnz, index, w, sizeof(double));
+					free(index);
+					free(w);
+				}
+				else {
+					*n = 0;
+				}
+			}
+			else if (strcmp(t, VEC_STREAM_TOKEN) == 0) {
+				r = get_stream_text(&sc, n, (void **)v, sizeof(double));
+			}
+			else if (strcmp(t, "nil") != 0) {
+				*n = strtoul(t, NULL, 10);
+				if (*n > 0) {
+					*v = (double *)new_elements(*n, sizeof(double));
+					for (i = 0; i < *n; ++i) {
+						skip_comment(&sc);
+						(*v)[i] = scan_number(&sc);
+					}
 				}
 				else {
 					*v = NULL;
@@ -380,7 +1167,12 @@ int vec_new_double_vector_from_file(size_t *n, double **v, FILE *fin) {
 				*n = -1;
 				*v = NULL;
 			}
-			return 0;
+			scanner_free(&sc);
+			if (cached && r == 0 && *n != (size_t)-1) {
+				put_cached(&key, path, fin, *n, *v);
+			}
+			vec_profile_end(VEC_PROFILE_READ, *n != (size_t)-1 ? *n : 0, sc.bytes);
+			return r;
 		}
 	}
 	else {
@@ -397,9 +1189,14 @@ void vec_delete_double_vector(double *v) {
 
 int vec_put_double_vector_to_file_binary(size_t n, const double *v, FILE *fout) {
 	if (fout && v && n > 0) {
+		if (try_put_sparse(n, v, sizeof(double), 1, fout)) {
+			return 0;
+		}
+		vec_profile_begin(VEC_PROFILE_WRITE);
 		fwrite("VCTR****", sizeof(char), 8, fout);
 		fwrite(&n, sizeof(size_t), 1, fout);
 		fwrite(v, sizeof(double), n, fout);
+		vec_profile_end(VEC_PROFILE_WRITE, n, 8 + sizeof(size_t) + n * sizeof(double));
 		return 0;
 	}
 	else {
@@ -412,18 +1209,49 @@ int vec_new_double_vector_from_file_binary(size_t *n, double **v, FILE *fin) {
 	if (fin) {
 		char buff[16];
 
+		vec_profile_begin(VEC_PROFILE_READ);
 		fread(&buff[0], sizeof(char), 8, fin);
-		if (strncmp(&buff[0], "VCTR****", 4) == 0) {
+		if (memcmp(&buff[0], VEC_CHUNKED_MAGIC, 8) == 0) {
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
+			if (fseeko(fin, -8, SEEK_CUR) != 0) {
+				*n = 0;
+				*v = NULL;
+				vec_error_handler(1, "vec_new_double_vector_from_file_binary: chunked vector needs a seekable file");
+				return 1;
+			}
+			return vec_new_double_vector_range_from_file_chunked(0, (size_t)-1, n, v, fin);
+		}
+		else if (memcmp(&buff[0], VEC_SPARSE_MAGIC, 8) == 0) {
+			size_t nnz, *index;
+			void *w;
+
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
+			*v = NULL;
+			if (get_sparse_binary(fin, n, &nnz, &index, &w, sizeof(double)) != 0) {
+				return 1;
+			}
+			*v = (double *)scatter_sparse(*n, nnz, index, w, sizeof(double));
+			free(index);
+			free(w);
+			return 0;
+		}
+		else if (strncmp(&buff[0], "VCTR****", 4) == 0) {
 			fread(&buff[0], sizeof(size_t), 1, fin);
 			*n = *(size_t *)&buff[0];
-			*v = (double *)calloc(*n, sizeof(double));
+			if (*n == VEC_STREAM_LENGTH) {
+				vec_profile_end(VEC_PROFILE_READ, 0, 0);
+				return get_stream_binary(fin, n, (void **)v, sizeof(double));
+			}
+			*v = (double *)new_elements(*n, sizeof(double));
 			fread(*v, sizeof(double), *n, fin);
+			vec_profile_end(VEC_PROFILE_READ, *n, 8 + sizeof(size_t) + *n * sizeof(double));
 			return 0;
 		}
 		else {
 			*n = 0;
 			*v = NULL;
 			vec_error_handler(1, "vec_new_double_vector_from_file_binary: bad magic");
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
 			return 1;
 		}
 	}
@@ -433,119 +1261,1365 @@ int vec_new_double_vector_from_file_binary(size_t *n, double **v, FILE *fin) {
 	}
 }
 
-int vec_slice_double_vector(double *a, const double *v, size_t offset, size_t length, size_t stride) {
-	if (a && v && length > 0 && stride > 0) {
+/* Chunk-indexed binary vectors */
+
+/*
+ * Layout (all integers are size_t, as in the plain binary format):
+ *   "VCTRCHK1", number of elements, element size, chunk length,
+ *   the elements,
+ *   index: offset (from the magic), first element, length, min, max
+ *          of each chunk,
+ *   number of chunks, offset of the index, "VCTRINDX".
+ */
+
+static double element_at(const void *v, size_t element_size, size_t i) {
+	if (element_size == sizeof(float)) {
+		return ((const float *)v)[i];
+	}
+	else {
+		return ((const double *)v)[i];
+	}
+}
+
+static void convert_elements(void *a, size_t a_size, const void *v, size_t v_size, size_t n) {
+	size_t i;
+
+	if (a_size == v_size) {
+		memcpy(a, v, n * a_size);
+	}
+	else if (a_size == sizeof(float)) {
+		for (i = 0; i < n; ++i) {
+			((float *)a)[i] = (float)((const double *)v)[i];
+		}
+	}
+	else {
+		for (i = 0; i < n; ++i) {
+			((double *)a)[i] = ((const float *)v)[i];
+		}
+	}
+}
+
+static int put_chunked(size_t n, const void *v, size_t element_size, size_t chunk_length, FILE *fout) {
+	size_t chunks = (n + chunk_length - 1) / chunk_length;
+	size_t data = VEC_CHUNKED_HEADER_SIZE;
+	size_t index = data + n * element_size;
+	size_t k;
+
+	vec_profile_begin(VEC_PROFILE_WRITE);
+	fwrite(VEC_CHUNKED_MAGIC, sizeof(char), 8, fout);
+	fwrite(&n, sizeof(size_t), 1, fout);
+	fwrite(&element_size, sizeof(size_t), 1, fout);
+	fwrite(&chunk_length, sizeof(size_t), 1, fout);
+	fwrite(v, element_size, n, fout);
+	for (k = 0; k < chunks; ++k) {
+		struct vec_chunk c;
 		size_t i;
 
-		for (i = 0; i < length; ++i) {
-			size_t j = offset + i * stride;
-			a[i] = v[j];
+		c.first = k * chunk_length;
+		c.length = (n - c.first < chunk_length) ? n - c.first : chunk_length;
+		c.offset = data + c.first * element_size;
+		c.min = c.max = element_at(v, element_size, c.first);
+		for (i = c.first + 1; i < c.first + c.length; ++i) {
+			double x = element_at(v, element_size, i);
+			if (x < c.min) {
+				c.min = x;
+			}
+			if (x > c.max) {
+				c.max = x;
+			}
 		}
+		fwrite(&c.offset, sizeof(size_t), 1, fout);
+		fwrite(&c.first, sizeof(size_t), 1, fout);
+		fwrite(&c.length, sizeof(size_t), 1, fout);
+		fwrite(&c.min, sizeof(double), 1, fout);
+		fwrite(&c.max, sizeof(double), 1, fout);
+	}
+	fwrite(&chunks, sizeof(size_t), 1, fout);
+	fwrite(&index, sizeof(size_t), 1, fout);
+	fwrite(VEC_CHUNKED_INDEX_MAGIC, sizeof(char), 8, fout);
+	vec_profile_end(VEC_PROFILE_WRITE, n, index + chunks * (3 * sizeof(size_t) + 2 * sizeof(double)) + VEC_CHUNKED_TRAILER_SIZE);
+	return 0;
+}
+
+/* Reads the header at the current position; fin is left there. */
+static int get_chunked_header(FILE *fin, off_t *start, size_t *n, size_t *element_size) {
+	char magic[8];
+	size_t header[3];
+
+	*start = ftello(fin);
+	if (*start < 0) {
+		return 1;
+	}
+	if (fread(magic, sizeof(char), 8, fin) != 8 || memcmp(magic, VEC_CHUNKED_MAGIC, 8) != 0 ||
+		fread(header, sizeof(size_t), 3, fin) != 3 || fseeko(fin, *start, SEEK_SET) != 0) {
+		fseeko(fin, *start, SEEK_SET);
+		return 1;
+	}
+	*n = header[0];
+	*element_size = header[1];
+	return 0;
+}
+
+int vec_is_chunked_file(FILE *fin) {
+	off_t start;
+	size_t n, element_size;
+
+	return fin && get_chunked_header(fin, &start, &n, &element_size) == 0;
+}
+
+int vec_get_chunked_vector_length(FILE *fin, size_t *n) {
+	off_t start;
+	size_t element_size;
+
+	if (fin && get_chunked_header(fin, &start, n, &element_size) == 0) {
 		return 0;
 	}
 	else {
-		if (!a) {
-			vec_error_handler(1, "vec_slice_double_vector: destination null");
+		vec_error_handler(1, "vec_get_chunked_vector_length: not a seekable chunked vector");
+		return 1;
+	}
+}
+
+int vec_new_chunk_index_from_file(FILE *fin, size_t *n, size_t *element_size, size_t *chunks, struct vec_chunk **index) {
+	off_t start;
+	size_t trailer[2];
+	char magic[8];
+	size_t k;
+
+	*chunks = 0;
+	*index = NULL;
+	if (!fin || get_chunked_header(fin, &start, n, element_size) != 0 ||
+		(*element_size != sizeof(float) && *element_size != sizeof(double)) ||
+		fseeko(fin, -(off_t)VEC_CHUNKED_TRAILER_SIZE, SEEK_END) != 0 ||
+		fread(trailer, sizeof(size_t), 2, fin) != 2 ||
+		fread(magic, sizeof(char), 8, fin) != 8 || memcmp(magic, VEC_CHUNKED_INDEX_MAGIC, 8) != 0 ||
+		fseeko(fin, start + (off_t)trailer[1], SEEK_SET) != 0) {
+		vec_error_handler(1, "vec_new_chunk_index_from_file: not a seekable chunked vector");
+		return 1;
+	}
+	*chunks = trailer[0];
+	*index = (struct vec_chunk *)calloc(*chunks > 0 ? *chunks : 1, sizeof(struct vec_chunk));
+	for (k = 0; k < *chunks; ++k) {
+		struct vec_chunk *c = &(*index)[k];
+
+		if (fread(&c->offset, sizeof(size_t), 1, fin) != 1 ||
+			fread(&c->first, sizeof(size_t), 1, fin) != 1 ||
+			fread(&c->length, sizeof(size_t), 1, fin) != 1 ||
+			fread(&c->min, sizeof(double), 1, fin) != 1 ||
+			fread(&c->max, sizeof(double), 1, fin) != 1) {
+			free(*index);
+			*index = NULL;
+			*chunks = 0;
+			vec_error_handler(1, "vec_new_chunk_index_from_file: broken index");
+			return 1;
+		}
+		c->offset += start;
+	}
+	fseeko(fin, start, SEEK_SET);
+	return 0;
+}
+
+void vec_delete_chunk_index(struct vec_chunk *index) {
+	if (index) {
+		free(index);
+	}
+}
+
+/* Reads elements [first, first + length) of the chunked vector at the
+   current position, touching only the chunks that hold them.  fin is
+   left at the end of the vector. */
+static int get_chunked_range(size_t first, size_t length, size_t *n, void **v, size_t v_size, FILE *fin) {
+	size_t total, element_size, chunks, k;
+	struct vec_chunk *index;
+	char *buff = NULL;
+	size_t bytes = 0;
+
+	*n = 0;
+	*v = NULL;
+	vec_profile_begin(VEC_PROFILE_READ);
+	if (vec_new_chunk_index_from_file(fin, &total, &element_size, &chunks, &index) != 0) {
+		vec_profile_end(VEC_PROFILE_READ, 0, 0);
+		return 1;
+	}
+	if (first > total) {
+		first = total;
+	}
+	if (length > total - first) {
+		length = total - first;
+	}
+	*n = length;
+	*v = new_elements(length > 0 ? length : 1, v_size);
+	if (element_size != v_size) {
+		buff = (char *)malloc(index[0].length * element_size);
+	}
+	/* chunks are in order; skip to the first one needed */
+	for (k = 0; k < chunks && length > 0; ++k) {
+		struct vec_chunk *c = &index[k];
+		size_t from, to;
+
+		if (c->first + c->length <= first) {
+			continue;
 		}
-		if (!v) {
-			vec_error_handler(1, "vec_slice_double_vector: source null");
+		if (c->first >= first + length) {
+			break;
 		}
-		if (length == 0) {
-			vec_error_handler(1, "vec_slice_double_vector: length is 0");
+		from = (first > c->first) ? first : c->first;
+		to = (first + length < c->first + c->length) ? first + length : c->first + c->length;
+		if (fseeko(fin, (off_t)(c->offset + (from - c->first) * element_size), SEEK_SET) != 0 ||
+			fread(buff ? (void *)buff : (void *)((char *)*v + (from - first) * v_size), element_size, to - from, fin) != to - from) {
+			free(buff);
+			vec_delete_chunk_index(index);
+			vec_profile_end(VEC_PROFILE_READ, 0, 0);
+			vec_error_handler(1, "get_chunked_range: short read");
+			return 1;
 		}
-		if (stride == 0) {
-			vec_error_handler(1, "vec_slice_double_vector: stride is 0");
+		if (buff) {
+			convert_elements((char *)*v + (from - first) * v_size, v_size, buff, element_size, to - from);
 		}
+		bytes += (to - from) * element_size;
+	}
+	free(buff);
+	vec_delete_chunk_index(index);
+	fseeko(fin, 0, SEEK_END);
+	vec_profile_end(VEC_PROFILE_READ, length, bytes);
+	return 0;
+}
+
+int vec_put_float_vector_to_file_chunked(size_t n, const float *v, size_t chunk_length, FILE *fout) {
+	if (fout && v && n > 0 && chunk_length > 0) {
+		return put_chunked(n, v, sizeof(float), chunk_length, fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_float_vector_to_file_chunked: bad parameters");
 		return 1;
 	}
 }
 
-int vec_add_double_multi_vector_to_multi_vector(double *a, size_t s, size_t n1, const double *v1, size_t n2, const double *v2) {
-	if (a && s > 0 && n1 > 0 && v1 && n2 > 0 && v2) {
-		size_t n = (n1 < n2) ? n1 : n2;
-		size_t i;
+int vec_new_float_vector_range_from_file_chunked(size_t first, size_t length, size_t *n, float **v, FILE *fin) {
+	if (fin) {
+		return get_chunked_range(first, length, n, (void **)v, sizeof(float), fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_float_vector_range_from_file_chunked: fin == NULL");
+		return 1;
+	}
+}
 
-		for (i = 0; i < n; ++i) {
-		a[i] = v1[i] + v2[i];
+int vec_put_double_vector_to_file_chunked(size_t n, const double *v, size_t chunk_length, FILE *fout) {
+	if (fout && v && n > 0 && chunk_length > 0) {
+		return put_chunked(n, v, sizeof(double), chunk_length, fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_double_vector_to_file_chunked: bad parameters");
+		return 1;
+	}
+}
+
+int vec_new_double_vector_range_from_file_chunked(size_t first, size_t length, size_t *n, double **v, FILE *fin) {
+	if (fin) {
+		return get_chunked_range(first, length, n, (void **)v, sizeof(double), fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_double_vector_range_from_file_chunked: fin == NULL");
+		return 1;
 	}
+}
+
+/* Sparse vectors */
+
+/*
+ * Text:   "sparse {N} {NNZ}", then {NNZ} lines of "{INDEX} {VALUE}".
+ * Binary: "VCTRSPRS", N, NNZ, element size (size_t each), the indices
+ *         (size_t), the values.
+ * Indices are ascending and below N.
+ */
+
+static int vec_sparse_output = -1;	/* -1: VEC_SPARSE not checked yet */
+
+void vec_set_sparse_output(int enabled) {
+	vec_sparse_output = enabled ? 1 : 0;
+}
+
+int vec_sparse_output_is_enabled(void) {
+	if (vec_sparse_output < 0) {
+		const char *e = getenv("VEC_SPARSE");
+
+		vec_sparse_output = (e && *e != '\0' && strcmp(e, "0") != 0) ? 1 : 0;
+	}
+	return vec_sparse_output;
+}
+
+static void store_element(void *v, size_t element_size, size_t i, double x) {
+	if (element_size == sizeof(float)) {
+		((float *)v)[i] = (float)x;
+	}
+	else {
+		((double *)v)[i] = x;
+	}
+}
+
+static int check_sparse_index(size_t n, size_t nnz, const size_t *index) {
+	size_t i;
+
+	for (i = 0; i < nnz; ++i) {
+		if (index[i] >= n || (i > 0 && index[i] <= index[i - 1])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static size_t count_nonzeros(size_t n, const void *v, size_t element_size) {
+	size_t i, nnz = 0;
+
+	for (i = 0; i < n; ++i) {
+		if (element_at(v, element_size, i) != 0) {
+			++nnz;
+		}
+	}
+	return nnz;
+}
+
+static void pack_dense(size_t n, const void *dense, size_t element_size, size_t *nnz, size_t **index, void **v) {
+	size_t i, k = 0;
+
+	*nnz = (n > 0 && n != (size_t)-1 && dense) ? count_nonzeros(n, dense, element_size) : 0;
+	*index = (size_t *)calloc(*nnz > 0 ? *nnz : 1, sizeof(size_t));
+	*v = new_elements(*nnz > 0 ? *nnz : 1, element_size);
+	for (i = 0; k < *nnz; ++i) {
+		double x = element_at(dense, element_size, i);
+		if (x != 0) {
+			(*index)[k] = i;
+			store_element(*v, element_size, k, x);
+			++k;
+		}
+	}
+}
+
+static void *scatter_sparse(size_t n, size_t nnz, const size_t *index, const void *v, size_t element_size) {
+	void *dense;
+	size_t i;
+
+	if (n == 0 || n == (size_t)-1) {
+		return NULL;
+	}
+	dense = new_elements(n, element_size);
+	for (i = 0; i < nnz; ++i) {
+		store_element(dense, element_size, index[i], element_at(v, element_size, i));
+	}
+	return dense;
+}
+
+static int put_sparse_text(size_t n, size_t nnz, const size_t *index, const void *v, size_t element_size, FILE *fout) {
+	size_t i, bytes = 0;
+
+	vec_profile_begin(VEC_PROFILE_WRITE);
+	bytes += fprintf(fout, "sparse %lu %lu %% Number of elements and of nonzero elements\n",
+		(unsigned long)n, (unsigned long)nnz);
+	for (i = 0; i < nnz; ++i) {
+		bytes += fprintf(fout, "%lu " FORMAT_STR_1 "\n", (unsigned long)index[i], element_at(v, element_size, i));
+	}
+	vec_profile_end(VEC_PROFILE_WRITE, nnz, bytes);
+	return 0;
+}
+
+static int put_sparse_binary(size_t n, size_t nnz, const size_t *index, const void *v, size_t element_size, FILE *fout) {
+	vec_profile_begin(VEC_PROFILE_WRITE);
+	fwrite(VEC_SPARSE_MAGIC, sizeof(char), 8, fout);
+	fwrite(&n, sizeof(size_t), 1, fout);
+	fwrite(&nnz, sizeof(size_t), 1, fout);
+	fwrite(&element_size, sizeof(size_t), 1, fout);
+	fwrite(index, sizeof(size_t), nnz, fout);
+	fwrite(v, element_size, nnz, fout);
+	vec_profile_end(VEC_PROFILE_WRITE, nnz, 8 + 3 * sizeof(size_t) + nnz * (sizeof(size_t) + element_size));
 	return 0;
- 	}
+}
+
+/* Writes v sparse if sparse output is enabled and the sparse encoding
+   is smaller; returns 1 if it did. */
+static int try_put_sparse(size_t n, const void *v, size_t element_size, int binary, FILE *fout) {
+	size_t nnz, *index;
+	void *w;
+
+	if (!vec_sparse_output_is_enabled()) {
+		return 0;
+	}
+	nnz = count_nonzeros(n, v, element_size);
+	/* a text pair is about twice a dense element */
+	if (binary ? nnz * (sizeof(size_t) + element_size) + 2 * sizeof(size_t) >= n * element_size : 2 * nnz >= n) {
+		return 0;
+	}
+	pack_dense(n, v, element_size, &nnz, &index, &w);
+	if (binary) {
+		put_sparse_binary(n, nnz, index, w, element_size, fout);
+	}
 	else {
-		vec_error_handler(1, "vec_add_double_multi_vector_to_multi_vector: bad parameters");
+		put_sparse_text(n, nnz, index, w, element_size, fout);
+	}
+	free(index);
+	free(w);
+	return 1;
+}
+
+/* Reads the rest of a text sparse vector after the "sparse" token. */
+static int get_sparse_text(struct vec_scanner *sc, size_t *n, size_t *nnz, size_t **index, void **v, size_t element_size) {
+	size_t i;
+
+	skip_comment(sc);
+	*n = strtoul(get_token(sc), NULL, 10);
+	skip_comment(sc);
+	*nnz = strtoul(get_token(sc), NULL, 10);
+	*index = (size_t *)calloc(*nnz > 0 ? *nnz : 1, sizeof(size_t));
+	*v = new_elements(*nnz > 0 ? *nnz : 1, element_size);
+	for (i = 0; i < *nnz; ++i) {
+		skip_comment(sc);
+		(*index)[i] = strtoul(get_token(sc), NULL, 10);
+		skip_comment(sc);
+		store_element(*v, element_size, i, scan_number(sc));
+	}
+	if (check_sparse_index(*n, *nnz, *index) != 0) {
+		free(*index);
+		free(*v);
+		*index = NULL;
+		*v = NULL;
+		*nnz = 0;
+		vec_error_handler(1, "get_sparse_text: indices must be ascending and below the length");
 		return 1;
 	}
+	return 0;
+}
+
+/* Reads the rest of a binary sparse vector after the magic. */
+static int get_sparse_binary(FILE *fin, size_t *n, size_t *nnz, size_t **index, void **v, size_t element_size) {
+	size_t header[3];
+	void *buff;
+
+	*index = NULL;
+	*v = NULL;
+	*nnz = 0;
+	vec_profile_begin(VEC_PROFILE_READ);
+	if (fread(header, sizeof(size_t), 3, fin) != 3 ||
+		(header[2] != sizeof(float) && header[2] != sizeof(double))) {
+		vec_profile_end(VEC_PROFILE_READ, 0, 0);
+		vec_error_handler(1, "get_sparse_binary: broken header");
+		return 1;
+	}
+	*n = header[0];
+	*nnz = header[1];
+	*index = (size_t *)calloc(*nnz > 0 ? *nnz : 1, sizeof(size_t));
+	*v = new_elements(*nnz > 0 ? *nnz : 1, element_size);
+	buff = (header[2] == element_size) ? *v : malloc(*nnz > 0 ? *nnz * header[2] : 1);
+	if (fread(*index, sizeof(size_t), *nnz, fin) != *nnz || fread(buff, header[2], *nnz, fin) != *nnz ||
+		check_sparse_index(*n, *nnz, *index) != 0) {
+		if (buff != *v) {
+			free(buff);
+		}
+		free(*index);
+		free(*v);
+		*index = NULL;
+		*v = NULL;
+		*nnz = 0;
+		vec_profile_end(VEC_PROFILE_READ, 0, 0);
+		vec_error_handler(1, "get_sparse_binary: broken vector");
+		return 1;
+	}
+	if (buff != *v) {
+		convert_elements(*v, element_size, buff, header[2], *nnz);
+		free(buff);
+	}
+	vec_profile_end(VEC_PROFILE_READ, *nnz, 8 + 3 * sizeof(size_t) + *nnz * (sizeof(size_t) + header[2]));
+	return 0;
 }
 
-int vec_add_double_single_vector_to_multi_vector(double *a, size_t s, size_t n1, const double *v1, size_t n2, const double *v2) {
-	if (a && s > 0 && n1 >= s && v1 && n2 / s >= n1 / s && v2) {
-		size_t i, j;
+/* Reads a sparse vector, or a dense one and packs it.  Binary input
+   may be sparse, classic or chunked (the latter needs a seekable file). */
+static int get_sparse(size_t *n, size_t *nnz, size_t **index, void **v, size_t element_size, int binary, FILE *fin) {
+	void *dense = NULL;
+	size_t i;
+
+	*nnz = 0;
+	*index = NULL;
+	*v = NULL;
+	if (!binary) {
+		struct vec_scanner sc;
+		char *t;
+		int c;
 
-		for (j = 0; j < n2 / s + 1; ++j) {
-			for (i = 0; i < s; ++i) {
-				size_t k = j * s + i;
-				if (k < n2) {
-					a[k] = v1[i] + v2[k];
+		scanner_init(&sc, fin);
+		c = scan_char(&sc);
+		if (c == 'V') {
+			vec_error_handler(0, "falls to binary mode");
+			scanner_free(&sc);
+			ungetc(c, fin);
+			return get_sparse(n, nnz, index, v, element_size, 1, fin);
+		}
+		unscan_char(c, &sc);
+		skip_comment(&sc);
+		t = get_token(&sc);
+		if (strcmp(t, "sparse") == 0) {
+			int r;
+
+			vec_profile_begin(VEC_PROFILE_READ);
+			r = get_sparse_text(&sc, n, nnz, index, v, element_size);
+			scanner_free(&sc);
+			vec_profile_end(VEC_PROFILE_READ, *nnz, sc.bytes);
+			return r;
+		}
+		if (strcmp(t, "nil") == 0) {
+			scanner_free(&sc);
+			*n = -1;
+			return 0;
+		}
+		if (strcmp(t, VEC_STREAM_TOKEN) == 0) {
+			int r;
+
+			vec_profile_begin(VEC_PROFILE_READ);
+			r = get_stream_text(&sc, n, &dense, element_size);
+			scanner_free(&sc);
+			vec_profile_end(VEC_PROFILE_READ, *n, sc.bytes);
+			if (r != 0) {
+				return 1;
+			}
+		}
+		else {
+			vec_profile_begin(VEC_PROFILE_READ);
+			*n = strtoul(t, NULL, 10);
+			if (*n > 0) {
+				dense = new_elements(*n, element_size);
+				for (i = 0; i < *n; ++i) {
+					skip_comment(&sc);
+					store_element(dense, element_size, i, scan_number(&sc));
 				}
 			}
+			scanner_free(&sc);
+			vec_profile_end(VEC_PROFILE_READ, *n, sc.bytes);
 		}
-		return 0;
 	}
 	else {
-		vec_error_handler(1, "vec_add_double_single_vector_to_multi_vector: bad parameters");
+		char magic[8];
+
+		if (fread(magic, sizeof(char), 8, fin) != 8) {
+			*n = 0;
+			vec_error_handler(1, "get_sparse: bad magic");
+			return 1;
+		}
+		if (memcmp(magic, VEC_SPARSE_MAGIC, 8) == 0) {
+			return get_sparse_binary(fin, n, nnz, index, v, element_size);
+		}
+		else if (memcmp(magic, VEC_CHUNKED_MAGIC, 8) == 0) {
+			if (fseeko(fin, -8, SEEK_CUR) != 0) {
+				*n = 0;
+				vec_error_handler(1, "get_sparse: chunked vector needs a seekable file");
+				return 1;
+			}
+			if (get_chunked_range(0, (size_t)-1, n, &dense, element_size, fin) != 0) {
+				return 1;
+			}
+		}
+		else if (strncmp(magic, "VCTR****", 4) == 0) {
+			vec_profile_begin(VEC_PROFILE_READ);
+			if (fread(n, sizeof(size_t), 1, fin) != 1) {
+				*n = 0;
+				vec_profile_end(VEC_PROFILE_READ, 0, 0);
+				vec_error_handler(1, "get_sparse: broken vector");
+				return 1;
+			}
+			if (*n == VEC_STREAM_LENGTH) {
+				vec_profile_end(VEC_PROFILE_READ, 0, 0);
+				if (get_stream_binary(fin, n, &dense, element_size) != 0) {
+					return 1;
+				}
+			}
+			else {
+				dense = new_elements(*n > 0 ? *n : 1, element_size);
+				i = fread(dense, element_size, *n, fin);
+				vec_profile_end(VEC_PROFILE_READ, i, 8 + sizeof(size_t) + i * element_size);
+			}
+		}
+		else {
+			*n = 0;
+			vec_error_handler(1, "get_sparse: bad magic");
+			return 1;
+		}
+	}
+	pack_dense(*n, dense, element_size, nnz, index, v);
+	free(dense);
+	return 0;
+}
+
+int vec_put_float_sparse_vector_to_file(size_t n, size_t nnz, const size_t *index, const float *v, FILE *fout) {
+	if (fout && (nnz == 0 || (index && v))) {
+		return put_sparse_text(n, nnz, index, v, sizeof(float), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_float_sparse_vector_to_file: bad parameters");
+		return 1;
+	}
+}
+
+int vec_new_float_sparse_vector_from_file(size_t *n, size_t *nnz, size_t **index, float **v, FILE *fin) {
+	if (fin) {
+		return get_sparse(n, nnz, index, (void **)v, sizeof(float), 0, fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_float_sparse_vector_from_file: fin == NULL");
 		return 1;
 	}
 }
 
-int vec_multiply_double_multi_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nv, const double *v, int transpose) {
-	if (a && s > 0 && nm / (s * s) >= nv / s && m && nv / s > 0 && v) {
-		size_t i, j, k;
+int vec_put_float_sparse_vector_to_file_binary(size_t n, size_t nnz, const size_t *index, const float *v, FILE *fout) {
+	if (fout && (nnz == 0 || (index && v))) {
+		return put_sparse_binary(n, nnz, index, v, sizeof(float), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_float_sparse_vector_to_file_binary: bad parameters");
+		return 1;
+	}
+}
+
+int vec_new_float_sparse_vector_from_file_binary(size_t *n, size_t *nnz, size_t **index, float **v, FILE *fin) {
+	if (fin) {
+		return get_sparse(n, nnz, index, (void **)v, sizeof(float), 1, fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_float_sparse_vector_from_file_binary: fin == NULL");
+		return 1;
+	}
+}
 
-		for (k = 0; k < nv; ++k) {
-			a[k] = 0;
+int vec_put_double_sparse_vector_to_file(size_t n, size_t nnz, const size_t *index, const double *v, FILE *fout) {
+	if (fout && (nnz == 0 || (index && v))) {
+		return put_sparse_text(n, nnz, index, v, sizeof(double), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_double_sparse_vector_to_file: bad parameters");
+		return 1;
+	}
+}
+
+int vec_new_double_sparse_vector_from_file(size_t *n, size_t *nnz, size_t **index, double **v, FILE *fin) {
+	if (fin) {
+		return get_sparse(n, nnz, index, (void **)v, sizeof(double), 0, fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_double_sparse_vector_from_file: fin == NULL");
+		return 1;
+	}
+}
+
+int vec_put_double_sparse_vector_to_file_binary(size_t n, size_t nnz, const size_t *index, const double *v, FILE *fout) {
+	if (fout && (nnz == 0 || (index && v))) {
+		return put_sparse_binary(n, nnz, index, v, sizeof(double), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_double_sparse_vector_to_file_binary: bad parameters");
+		return 1;
+	}
+}
+
+int vec_new_double_sparse_vector_from_file_binary(size_t *n, size_t *nnz, size_t **index, double **v, FILE *fin) {
+	if (fin) {
+		return get_sparse(n, nnz, index, (void **)v, sizeof(double), 1, fin);
+	}
+	else {
+		vec_error_handler(1, "vec_new_double_sparse_vector_from_file_binary: fin == NULL");
+		return 1;
+	}
+}
+
+void vec_delete_sparse_index(size_t *index) {
+	if (index) {
+		free(index);
+	}
+}
+
+/* Vectors of unknown length */
+
+/*
+ * Text:   "*", the elements, then "* {N}".
+ * Binary: "VCTR****", (size_t)-1, then blocks of a length (size_t) and
+ *         as many elements, then a block of length 0 and N (size_t).
+ * A writer puts the elements as it makes them and the count after them,
+ * so it need not hold the vector; N is checked by the readers.
+ */
+
+/* Reads the rest of a text vector of unknown length after the "*"
+   token, the trailer included. */
+static int get_stream_text(struct vec_scanner *sc, size_t *n, void **v, size_t element_size) {
+	size_t capacity = 1024, count = 0;
+	int c;
+
+	*n = 0;
+	*v = malloc(capacity * element_size);
+	for (;;) {
+		skip_comment(sc);
+		c = scan_char(sc);
+		if (c == '*' || c == EOF) {
+			break;
 		}
-		for (k = 0; k < nv / s; ++k) {
-			for (j = 0; j < s; ++j) {
-				for (i = 0; i < s; ++i) {
-					if (transpose == 0) {
-						a[k * s + j] += m[k * s * s + i * s + j] * v[k * s + i];
-					}
-					else {
-						a[k * s + j] += m[k * s * s + j * s + i] * v[k * s + i];
-					}
-				}
+		unscan_char(c, sc);
+		if (*n == capacity) {
+			capacity *= 2;
+			*v = realloc(*v, capacity * element_size);
+		}
+		store_element(*v, element_size, *n, scan_number(sc));
+		++*n;
+	}
+	if (c == '*') {
+		skip_comment(sc);
+		count = strtoul(get_token(sc), NULL, 10);
+	}
+	if (c != '*' || count != *n) {
+		free(*v);
+		*v = NULL;
+		*n = 0;
+		vec_error_handler(1, "get_stream_text: broken vector of unknown length");
+		return 1;
+	}
+	if (*n == 0) {
+		free(*v);
+		*v = NULL;
+	}
+	place_elements(*v, *n * element_size);
+	return 0;
+}
+
+/* Reads the rest of a binary vector of unknown length after its
+   length, (size_t)-1. */
+static int get_stream_binary(FILE *fin, size_t *n, void **v, size_t element_size) {
+	size_t capacity = 0, length, count, blocks = 0;
+	int broken = 0;
+
+	vec_profile_begin(VEC_PROFILE_READ);
+	*n = 0;
+	*v = NULL;
+	while (!broken) {
+		if (fread(&length, sizeof(size_t), 1, fin) != 1) {
+			broken = 1;
+		}
+		else if (length == 0) {
+			broken = fread(&count, sizeof(size_t), 1, fin) != 1 || count != *n;
+			break;
+		}
+		else {
+			if (*n + length > capacity) {
+				capacity = *n + length > 2 * capacity ? *n + length : 2 * capacity;
+				*v = realloc(*v, capacity * element_size);
+			}
+			broken = fread((char *)*v + *n * element_size, element_size, length, fin) != length;
+			*n += length;
+			++blocks;
+		}
+	}
+	if (broken) {
+		free(*v);
+		*v = NULL;
+		*n = 0;
+		vec_profile_end(VEC_PROFILE_READ, 0, 0);
+		vec_error_handler(1, "get_stream_binary: broken vector of unknown length");
+		return 1;
+	}
+	/* grown as it came, so its pages are moved now */
+	place_elements(*v, *n * element_size);
+	vec_profile_end(VEC_PROFILE_READ, *n, 8 + (blocks + 3) * sizeof(size_t) + *n * element_size);
+	return 0;
+}
+
+static int put_stream_text(size_t n, const void *v, size_t element_size, size_t s, FILE *fout) {
+	size_t i, j, bytes = 0;
+
+	vec_profile_begin(VEC_PROFILE_WRITE);
+	if (s > 1) {
+		for (i = 0; i < n; i += s) {
+			for (j = 0; j < s && i + j < n; ++j) {
+				bytes += fprintf(fout, FORMAT_STR_2 " ", element_at(v, element_size, i + j));
 			}
+			fputc('\n', fout);
+			++bytes;
 		}
+	}
+	else {
+		for (i = 0; i < n; ++i) {
+			bytes += fprintf(fout, FORMAT_STR_1 "\n", element_at(v, element_size, i));
+		}
+	}
+	vec_profile_end(VEC_PROFILE_WRITE, n, bytes);
+	return 0;
+}
+
+static int put_stream_binary(size_t n, const void *v, size_t element_size, FILE *fout) {
+	/* a block of length 0 would end the vector */
+	if (n > 0) {
+		vec_profile_begin(VEC_PROFILE_WRITE);
+		fwrite(&n, sizeof(size_t), 1, fout);
+		fwrite(v, element_size, n, fout);
+		vec_profile_end(VEC_PROFILE_WRITE, n, sizeof(size_t) + n * element_size);
+	}
+	return 0;
+}
+
+int vec_put_stream_begin_to_file(FILE *fout) {
+	if (fout) {
+		fputs(VEC_STREAM_TOKEN " % Number of elements follows the elements\n", fout);
+		return 0;
+	}
+	else {
+		vec_error_handler(1, "vec_put_stream_begin_to_file: fout == NULL");
+		return 1;
+	}
+}
+
+int vec_put_float_stream_to_file(size_t n, const float *v, size_t s, FILE *fout) {
+	if (fout && (n == 0 || v)) {
+		return put_stream_text(n, v, sizeof(float), s, fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_float_stream_to_file: bad parameters");
+		return 1;
+	}
+}
+
+int vec_put_double_stream_to_file(size_t n, const double *v, size_t s, FILE *fout) {
+	if (fout && (n == 0 || v)) {
+		return put_stream_text(n, v, sizeof(double), s, fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_double_stream_to_file: bad parameters");
+		return 1;
+	}
+}
+
+int vec_put_stream_end_to_file(size_t n, FILE *fout) {
+	if (fout) {
+		fprintf(fout, VEC_STREAM_TOKEN " %lu %% Number of elements\n", (unsigned long)n);
+		return 0;
+	}
+	else {
+		vec_error_handler(1, "vec_put_stream_end_to_file: fout == NULL");
+		return 1;
+	}
+}
+
+int vec_put_stream_begin_to_file_binary(FILE *fout) {
+	if (fout) {
+		size_t n = VEC_STREAM_LENGTH;
+
+		fwrite("VCTR****", sizeof(char), 8, fout);
+		fwrite(&n, sizeof(size_t), 1, fout);
+		return 0;
+	}
+	else {
+		vec_error_handler(1, "vec_put_stream_begin_to_file_binary: fout == NULL");
+		return 1;
+	}
+}
+
+int vec_put_float_stream_to_file_binary(size_t n, const float *v, FILE *fout) {
+	if (fout && (n == 0 || v)) {
+		return put_stream_binary(n, v, sizeof(float), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_float_stream_to_file_binary: bad parameters");
+		return 1;
+	}
+}
+
+int vec_put_double_stream_to_file_binary(size_t n, const double *v, FILE *fout) {
+	if (fout && (n == 0 || v)) {
+		return put_stream_binary(n, v, sizeof(double), fout);
+	}
+	else {
+		vec_error_handler(1, "vec_put_double_stream_to_file_binary: bad parameters");
+		return 1;
+	}
+}
+
+int vec_put_stream_end_to_file_binary(size_t n, FILE *fout) {
+	if (fout) {
+		size_t zero = 0;
+
+		fwrite(&zero, sizeof(size_t), 1, fout);
+		fwrite(&n, sizeof(size_t), 1, fout);
 		return 0;
 	}
 	else {
-		vec_error_handler(1, "vec_multiply_double_multi_matrix_to_multi_vector: bad parameters");
+		vec_error_handler(1, "vec_put_stream_end_to_file_binary: fout == NULL");
 		return 1;
 	}
 }
 
-int vec_multiply_double_single_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nv, const double *v, int transpose) {
-	if (a && s > 0 && nm >= s * s && m && nv / s >= nm / (s * s) && v) {
-		size_t i, j, k;
+/* Shared-memory rings */
+
+/*
+ * A ring is a POSIX shared memory object "/vecring-NAME" of a header
+ * and VEC_RING_LENGTH bytes of data, written by one process and read by
+ * another.  head and tail count the bytes written and read; each side
+ * publishes its count with a release store, so no lock is taken.  A side
+ * that finds the ring full or empty flags itself waiting and sleeps on
+ * the other side's futex word, which is bumped with every count, so the
+ * calls into the kernel are made only when one side waits.  The name is
+ * removed as soon as both sides have the ring open, so nothing is left
+ * behind when either one dies.
+ */
+
+struct vec_ring_header {
+	unsigned long long head;	/* bytes written */
+	unsigned long long tail;	/* bytes read */
+	int written;	/* futex word, bumped when head moves */
+	int read;	/* futex word, bumped when tail moves */
+	int reader_waiting;
+	int writer_waiting;
+	int writer_closed;
+	int reader_closed;
+	int writer_pid;
+	int reader_pid;
+	int attached;	/* sides that have opened the ring */
+};
+
+struct vec_ring {
+	struct vec_ring_header *h;
+	char *data;
+	char name[256];
+	int writer;
+};
+
+static void ring_wait(int *word, int value) {
+	/* Wakes up now and then to see whether the other side died. */
+	struct timespec t;
+
+	t.tv_sec = 1;
+	t.tv_nsec = 0;
+	syscall(SYS_futex, word, FUTEX_WAIT, value, &t, NULL, 0);
+}
+
+static void ring_wake(int *word) {
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Whether the other side has closed the ring, or died without. */
+static int ring_side_is_gone(int *closed, int *pid) {
+	int p = __atomic_load_n(pid, __ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(closed, __ATOMIC_ACQUIRE) ||
+		(p > 0 && kill(p, 0) != 0 && errno == ESRCH);
+}
+
+static ssize_t ring_read(void *cookie, char *buf, size_t size) {
+	struct vec_ring *r = (struct vec_ring *)cookie;
+	struct vec_ring_header *h = r->h;
+	unsigned long long head, tail = h->tail;
+	size_t n, i, at;
 
-		for (k = 0; k < nv; ++k) {
-			a[k] = 0;
+	for (;;) {
+		head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+		if (head != tail) {
+			break;
 		}
-		for (k = 0; k < nv / s; ++k) {	
-			for (j = 0; j < s; ++j) {
-				for (i = 0; i < s; ++i) {
-					if (transpose == 0) {
-						a[k * s + j] += m[i * s + j] * v[k * s + i];
-					}
-					else {
-						a[k * s + j] += m[j * s + i] * v[k * s + i];
-					}
+		/* Flag first, then check again: the writer either sees the
+		   flag or has moved head before we look. */
+		__atomic_store_n(&h->reader_waiting, 1, __ATOMIC_SEQ_CST);
+		{
+			int seen = __atomic_load_n(&h->written, __ATOMIC_SEQ_CST);
+
+			if (__atomic_load_n(&h->head, __ATOMIC_SEQ_CST) == tail) {
+				if (ring_side_is_gone(&h->writer_closed, &h->writer_pid) && __atomic_load_n(&h->head, __ATOMIC_SEQ_CST) == tail) {
+					__atomic_store_n(&h->reader_waiting, 0, __ATOMIC_RELAXED);
+					return 0;
 				}
+				ring_wait(&h->written, seen);
 			}
 		}
-		return 0;
+		__atomic_store_n(&h->reader_waiting, 0, __ATOMIC_RELAXED);
+	}
+	n = head - tail < size ? (size_t)(head - tail) : size;
+	at = tail % VEC_RING_LENGTH;
+	i = n < VEC_RING_LENGTH - at ? n : VEC_RING_LENGTH - at;
+	memcpy(buf, r->data + at, i);
+	memcpy(buf + i, r->data, n - i);
+	__atomic_store_n(&h->tail, tail + n, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&h->read, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&h->writer_waiting, __ATOMIC_SEQ_CST) &&
+		__atomic_load_n(&h->head, __ATOMIC_SEQ_CST) - (tail + n) <= VEC_RING_LENGTH / 2) {
+		ring_wake(&h->read);
+	}
+	return n;
+}
+
+static ssize_t ring_write(void *cookie, const char *buf, size_t size) {
+	struct vec_ring *r = (struct vec_ring *)cookie;
+	struct vec_ring_header *h = r->h;
+	unsigned long long head = h->head, tail;
+	size_t done = 0;
+
+	while (done < size) {
+		size_t n, i, at;
+
+		tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&h->reader_closed, __ATOMIC_ACQUIRE) ||
+			(head - tail == VEC_RING_LENGTH && ring_side_is_gone(&h->reader_closed, &h->reader_pid))) {
+			errno = EPIPE;
+			return done > 0 ? (ssize_t)done : -1;
+		}
+		if (head - tail == VEC_RING_LENGTH) {
+			__atomic_store_n(&h->writer_waiting, 1, __ATOMIC_SEQ_CST);
+			{
+				int seen = __atomic_load_n(&h->read, __ATOMIC_SEQ_CST);
+
+				/* Sleeps until half the ring is free, so that the
+				   two sides take turns in large pieces. */
+				if (head - __atomic_load_n(&h->tail, __ATOMIC_SEQ_CST) > VEC_RING_LENGTH / 2) {
+					ring_wait(&h->read, seen);
+				}
+			}
+			__atomic_store_n(&h->writer_waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		n = VEC_RING_LENGTH - (size_t)(head - tail);
+		if (n > size - done) {
+			n = size - done;
+		}
+		at = head % VEC_RING_LENGTH;
+		i = n < VEC_RING_LENGTH - at ? n : VEC_RING_LENGTH - at;
+		memcpy(r->data + at, buf + done, i);
+		memcpy(r->data, buf + done + i, n - i);
+		head += n;
+		done += n;
+		__atomic_store_n(&h->head, head, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&h->written, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&h->reader_waiting, __ATOMIC_SEQ_CST)) {
+			ring_wake(&h->written);
+		}
+	}
+	return done;
+}
+
+static int ring_close(void *cookie) {
+	struct vec_ring *r = (struct vec_ring *)cookie;
+	struct vec_ring_header *h = r->h;
+
+	if (r->writer) {
+		__atomic_store_n(&h->writer_closed, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&h->written, 1, __ATOMIC_SEQ_CST);
+		ring_wake(&h->written);
 	}
 	else {
-		vec_error_handler(1, "vec_multiply_double_single_matrix_to_multi_vector: bad parameters");
-		return 1;
+		__atomic_store_n(&h->reader_closed, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&h->read, 1, __ATOMIC_SEQ_CST);
+		ring_wake(&h->read);
+	}
+	munmap(h, sizeof(struct vec_ring_header) + VEC_RING_LENGTH);
+	free(r);
+	return 0;
+}
+
+/* vec_open_ring, giving the ring itself to vec_open_output. */
+static FILE *open_ring(const char *name, const char *mode, struct vec_ring **ring) {
+	static const size_t size = sizeof(struct vec_ring_header) + VEC_RING_LENGTH;
+	struct vec_ring *r;
+	struct stat st;
+	cookie_io_functions_t io;
+	int writer, fd;
+	void *m;
+	FILE *f;
+
+	if (!name || !mode || strlen(name) > 200 || strchr(name, '/')) {
+		vec_error_handler(1, "vec_open_ring: bad parameters");
+		return NULL;
+	}
+	writer = mode[0] == 'w';
+	r = (struct vec_ring *)calloc(1, sizeof(struct vec_ring));
+	sprintf(r->name, "/vecring-%s", name);
+	r->writer = writer;
+	for (;;) {
+		fd = shm_open(r->name, O_RDWR | O_CREAT, 0600);
+		if (fd < 0 || fstat(fd, &st) != 0 || ((size_t)st.st_size != size && ftruncate(fd, size) != 0)) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			free(r);
+			vec_error_handler(1, "vec_open_ring: can't create the ring");
+			return NULL;
+		}
+		m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED) {
+			free(r);
+			vec_error_handler(1, "vec_open_ring: can't map the ring");
+			return NULL;
+		}
+		r->h = (struct vec_ring_header *)m;
+		/* A ring that already had a side like ours is left over from
+		   an earlier run; replace it. */
+		if (__atomic_load_n(writer ? &r->h->writer_pid : &r->h->reader_pid, __ATOMIC_ACQUIRE) != 0) {
+			munmap(m, size);
+			shm_unlink(r->name);
+			continue;
+		}
+		break;
+	}
+	r->data = (char *)m + sizeof(struct vec_ring_header);
+	__atomic_store_n(writer ? &r->h->writer_pid : &r->h->reader_pid, (int)getpid(), __ATOMIC_RELEASE);
+	if (__atomic_add_fetch(&r->h->attached, 1, __ATOMIC_SEQ_CST) == 2) {
+		shm_unlink(r->name);
+	}
+	io.read = writer ? NULL : ring_read;
+	io.write = writer ? ring_write : NULL;
+	io.seek = NULL;
+	io.close = ring_close;
+	f = fopencookie(r, writer ? "w" : "r", io);
+	if (!f) {
+		ring_close(r);
+		vec_error_handler(1, "vec_open_ring: can't open the stream");
+		return NULL;
+	}
+	if (ring) {
+		*ring = r;
+	}
+	return f;
+}
+
+FILE *vec_open_ring(const char *name, const char *mode) {
+	return open_ring(name, mode, NULL);
+}
+
+FILE *vec_open_file(const char *filename, const char *mode) {
+	if (!filename || !mode) {
+		vec_error_handler(1, "vec_open_file: bad parameters");
+		return NULL;
+	}
+	if (strcmp(filename, "-") == 0) {
+		return mode[0] == 'w' ? stdout : stdin;
+	}
+	if (strncmp(filename, VEC_RING_PREFIX, strlen(VEC_RING_PREFIX)) == 0) {
+		return vec_open_ring(filename + strlen(VEC_RING_PREFIX), mode);
+	}
+	return fopen(filename, mode);
+}
+
+/* $VEC_OUTPUT names the output of the tools instead of stdout, for
+   rings, e.g. VEC_OUTPUT=ring:a slice ... & multiply ... ring:a.  Only
+   the tools ask for it, from main(). */
+static int vec_output_opened = 0;
+static struct vec_ring *vec_output_ring = NULL;
+
+/* A ring that no reader has opened is removed if the tool failed, so
+   that nothing is left in /dev/shm for a reader that will never come. */
+static void vec_close_output(int status, void *arg) {
+	(void)arg;
+	if (status != 0 && vec_output_ring &&
+		__atomic_load_n(&vec_output_ring->h->attached, __ATOMIC_SEQ_CST) < 2) {
+		shm_unlink(vec_output_ring->name);
+	}
+	fclose(stdout);
+}
+
+FILE *vec_open_output(void) {
+	const char *e = getenv("VEC_OUTPUT");
+	FILE *f;
+
+	if (vec_output_opened || !e || *e == '\0') {
+		return stdout;
+	}
+	vec_output_opened = 1;
+	if (strncmp(e, VEC_RING_PREFIX, strlen(VEC_RING_PREFIX)) == 0) {
+		f = open_ring(e + strlen(VEC_RING_PREFIX), "w", &vec_output_ring);
+	}
+	else {
+		f = vec_open_file(e, "w");
+	}
+	if (f && f != stdout) {
+		fflush(stdout);
+		stdout = f;
+		on_exit(vec_close_output, NULL);
+	}
+	else if (!f) {
+		vec_error_handler(1, "vec_open_output: can't open $VEC_OUTPUT");
+	}
+	return stdout;
+}
+
+/* Threads */
+
+/*
+ * The element-wise operations run on a pool of threads, started on
+ * first use and kept for the life of the process.  vec_run_parts splits
+ * the records of an operation into a few parts per thread, and the
+ * caller and the workers take the parts in turn.  The pool runs one
+ * operation at a time; an operation called while it is busy (from a
+ * thread of the caller's own, say) runs on its caller alone.  A part is
+ * computed exactly as the same records would be on one thread.
+ */
+#define VEC_MAXIMUM_THREADS 256
+
+typedef void (*vec_part_t)(void *context, size_t first, size_t count);
+
+static size_t vec_threads = 0;	/* 0: VEC_THREADS not checked yet */
+static pthread_mutex_t vec_pool_owner = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t vec_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vec_pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t vec_pool_done = PTHREAD_COND_INITIALIZER;
+static size_t vec_pool_size = 0;	/* workers started */
+static int vec_pool_cpus[VEC_MAXIMUM_THREADS];	/* -1: not pinned */
+static unsigned long vec_pool_generation = 0;
+
+/* The operation being run, guarded by vec_pool_lock. */
+static struct {
+	vec_part_t part;
+	void *context;
+	size_t records;
+	size_t piece;	/* records per part */
+	size_t parts;
+	size_t next;	/* next part to take */
+	size_t finished;
+	size_t workers;	/* workers that take part */
+} vec_pool_job;
+
+void vec_set_threads(size_t threads) {
+	if (threads == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = n > 0 ? (size_t)n : 1;
+	}
+	vec_threads = threads < VEC_MAXIMUM_THREADS ? threads : VEC_MAXIMUM_THREADS;
+}
+
+size_t vec_get_threads(void) {
+	if (vec_threads == 0) {
+		const char *e = getenv("VEC_THREADS");
+
+		vec_set_threads(e && *e != '\0' ? strtoul(e, NULL, 10) : 1);
+	}
+	return vec_threads;
+}
+
+/* Takes parts until there are none left; called with the lock held. */
+static void vec_pool_take_parts(void) {
+	while (vec_pool_job.next < vec_pool_job.parts) {
+		size_t first = vec_pool_job.next++ * vec_pool_job.piece;
+		size_t count = vec_pool_job.records - first;
+
+		if (count > vec_pool_job.piece) {
+			count = vec_pool_job.piece;
+		}
+		pthread_mutex_unlock(&vec_pool_lock);
+		vec_pool_job.part(vec_pool_job.context, first, count);
+		pthread_mutex_lock(&vec_pool_lock);
+		if (++vec_pool_job.finished == vec_pool_job.parts) {
+			pthread_cond_signal(&vec_pool_done);
+		}
+	}
+}
+
+static void *vec_pool_worker(void *arg) {
+	size_t w = (size_t)arg;
+	unsigned long seen;
+
+	if (vec_pool_cpus[w] >= 0) {
+		cpu_set_t s;
+
+		CPU_ZERO(&s);
+		CPU_SET(vec_pool_cpus[w], &s);
+		sched_setaffinity(0, sizeof(s), &s);
+	}
+	pthread_mutex_lock(&vec_pool_lock);
+	seen = vec_pool_generation;
+	for (;;) {
+		while (vec_pool_generation == seen) {
+			pthread_cond_wait(&vec_pool_start, &vec_pool_lock);
+		}
+		seen = vec_pool_generation;
+		if (w < vec_pool_job.workers) {
+			vec_pool_take_parts();
+		}
 	}
+	return NULL;
 }
+
+/* Calls part(context, first, count) over [0, records), on the threads
+   of vec_get_threads() if the operation has at least
+   VEC_PARALLEL_MINIMUM elements, and returns when all parts are done. */
+static void vec_run_parts(size_t records, size_t elements, vec_part_t part, void *context) {
+	size_t threads = vec_get_threads();
+
+	if (threads <= 1 || elements < VEC_PARALLEL_MINIMUM || records < 2 ||
+		pthread_mutex_trylock(&vec_pool_owner) != 0) {
+		part(context, 0, records);
+		return;
+	}
+	/* worker w is thread w + 1 of the operation; the caller is thread 0 */
+	while (vec_pool_size < threads - 1) {
+		pthread_t t;
+		pthread_attr_t attr;
+		size_t w = vec_pool_size;
+		int created;
+
+		vec_pool_cpus[w] = vec_numa_worker_cpu(w + 1, threads);
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		created = pthread_create(&t, &attr, vec_pool_worker, (void *)w) == 0;
+		pthread_attr_destroy(&attr);
+		if (!created) {
+			break;
+		}
+		++vec_pool_size;
+	}
+	pthread_mutex_lock(&vec_pool_lock);
+	vec_pool_job.part = part;
+	vec_pool_job.context = context;
+	vec_pool_job.records = records;
+	vec_pool_job.workers = threads - 1 < vec_pool_size ? threads - 1 : vec_pool_size;
+	vec_pool_job.piece = (records + 4 * threads - 1) / (4 * threads);
+	vec_pool_job.parts = (records + vec_pool_job.piece - 1) / vec_pool_job.piece;
+	vec_pool_job.next = 0;
+	vec_pool_job.finished = 0;
+	++vec_pool_generation;
+	pthread_cond_broadcast(&vec_pool_start);
+	vec_pool_take_parts();
+	while (vec_pool_job.finished < vec_pool_job.parts) {
+		pthread_cond_wait(&vec_pool_done, &vec_pool_lock);
+	}
+	pthread_mutex_unlock(&vec_pool_lock);
+	pthread_mutex_unlock(&vec_pool_owner);
+}
+
+/* Vector operations */
+
+/*
+ * Records of up to VEC_FIXED_DIMENSIONS elements get kernels of their
+ * own.  A kernel written as an inline function of the record size s is
+ * called through VEC_DISPATCH_DIMENSION(s, CALL), where CALL(S) makes
+ * the call with S for s: a constant for each s up to the limit, so that
+ * the compiler unrolls the loops over a record (marked VEC_UNROLL), and
+ * s itself beyond.
+ */
+#define VEC_FIXED_DIMENSIONS 8
+#define VEC_INLINE static inline __attribute__((always_inline))
+#define VEC_UNROLL _Pragma("GCC unroll 8")
+#define VEC_DISPATCH_DIMENSION(s, CALL) \
+	switch (s) { \
+	case 1: CALL(1); break; \
+	case 2: CALL(2); break; \
+	case 3: CALL(3); break; \
+	case 4: CALL(4); break; \
+	case 5: CALL(5); break; \
+	case 6: CALL(6); break; \
+	case 7: CALL(7); break; \
+	case 8: CALL(8); break; \
+	default: CALL(s); break; \
+	}
+
+#define VEC_REAL float
+#define VEC_REAL_NAME "float"
+#define VEC_FUNC(op, rest) vec_##op##_float_##rest
+#include "vec_kernels.h"
+#undef VEC_REAL
+#undef VEC_REAL_NAME
+#undef VEC_FUNC
+
+#define VEC_REAL double
+#define VEC_REAL_NAME "double"
+#define VEC_FUNC(op, rest) vec_##op##_double_##rest
+#include "vec_kernels.h"
+#undef VEC_REAL
+#undef VEC_REAL_NAME
+#undef VEC_FUNC
@@ -35,6 +35,65 @@ extern "C" {
 	typedef int (*vec_error_handler_t)(int error_type, const char *error_message);
 	extern vec_error_handler_t vec_set_error_handler(vec_error_handler_t new_error_handler);
 
+	/* Profiling */
+	/* Phases are timed only while profiling is enabled, either by
+	   vec_profile_start() or by setting VEC_PROFILE=1 in the environment.
+	   The report is written to stderr at exit. */
+#define VEC_PROFILE_READ 0
+#define VEC_PROFILE_COMPUTE 1
+#define VEC_PROFILE_WRITE 2
+#define VEC_PROFILE_PHASES 3
+	extern void vec_profile_start(const char *name);
+	extern int vec_profile_is_enabled(void);
+	extern void vec_profile_begin(int phase);
+	extern void vec_profile_end(int phase, size_t elements, size_t bytes);
+	extern int vec_profile_report_to_file(FILE *fout);
+
+	/* Memory placement */
+	/* On a host with several NUMA nodes, the pages of a vector are put
+	   on the node of the thread that first touches them (VEC_NUMA_LOCAL,
+	   the default), or spread over the nodes as the readers allocate
+	   large vectors (VEC_NUMA_INTERLEAVE).  VEC_NUMA_OFF also keeps the
+	   threads from being pinned to nodes: worker w of `threads` runs on
+	   CPU vec_numa_worker_cpu(w, threads), or anywhere if it is -1.  The
+	   policy is set by vec_set_numa_policy(), or by $VEC_NUMA (off,
+	   local, interleave). */
+#define VEC_NUMA_OFF 0
+#define VEC_NUMA_LOCAL 1
+#define VEC_NUMA_INTERLEAVE 2
+	extern void vec_set_numa_policy(int policy);
+	extern int vec_get_numa_policy(void);
+	extern int vec_numa_node_count(void);
+	extern int vec_numa_node_of_cpu(int cpu);
+	extern int vec_numa_worker_cpu(size_t w, size_t threads);
+	extern int vec_interleave_memory(void *p, size_t bytes);
+
+	/* Threads */
+	/* The element-wise operations (slicing, adding, multiplying and
+	   affine transforms of dense vectors) split the records of vectors
+	   of at least VEC_PARALLEL_MINIMUM elements over the threads set by
+	   vec_set_threads(), or by $VEC_THREADS; 0 is one per CPU, and the
+	   default is 1.  Each record is computed as on one thread, so the
+	   results do not depend on the number of threads. */
+#define VEC_PARALLEL_MINIMUM 65536
+	extern void vec_set_threads(size_t threads);
+	extern size_t vec_get_threads(void);
+
+	/* Parse cache */
+	/* With a cache directory, set by vec_set_parse_cache() or by
+	   $VEC_CACHE, the text readers keep the vectors they parse from
+	   regular files in binary in the directory, and read them from
+	   there while the file (its inode, size and modification time) is
+	   unchanged.  NULL turns the cache off, as it is by default.  Safe
+	   for processes reading and writing the cache at the same time.
+	   The directory is made with mode 0700; a directory or an entry
+	   that is not the user's own, or that group or others can write,
+	   is not used.
+	   vec_set_parse_cache() is not thread-safe: call it before any
+	   thread reads vectors. */
+	extern void vec_set_parse_cache(const char *directory);
+	extern const char *vec_get_parse_cache(void);
+
 	/* Writing header to output stream */
 	extern int vec_put_header_to_file(FILE *fout);
 
@@ -70,17 +129,144 @@ extern "C" {
 	extern int vec_put_double_vector_to_file_binary(size_t n, const double *v, FILE *fout);
 	extern int vec_new_double_vector_from_file_binary(size_t *n, double **v, FILE *fin);
 	
+	/* Writing and reading chunk-indexed binary vector */
+	/* DO NOT USE UNTIL YOU UNDERSTAND WHAT THESE ARE.  Machine dependent,
+	   like the binary format above.  Reading needs a seekable file, and
+	   the vector must be the last thing in the file. */
+	struct vec_chunk {
+		size_t offset;	/* file position of the first element */
+		size_t first;	/* index of the first element */
+		size_t length;
+		double min;
+		double max;
+	};
+	extern int vec_is_chunked_file(FILE *fin);
+	extern int vec_get_chunked_vector_length(FILE *fin, size_t *n);
+	extern int vec_new_chunk_index_from_file(FILE *fin, size_t *n, size_t *element_size, size_t *chunks, struct vec_chunk **index);
+	extern void vec_delete_chunk_index(struct vec_chunk *index);
+	extern int vec_put_float_vector_to_file_chunked(size_t n, const float *v, size_t chunk_length, FILE *fout);
+	extern int vec_new_float_vector_range_from_file_chunked(size_t first, size_t length, size_t *n, float **v, FILE *fin);
+	extern int vec_put_double_vector_to_file_chunked(size_t n, const double *v, size_t chunk_length, FILE *fout);
+	extern int vec_new_double_vector_range_from_file_chunked(size_t first, size_t length, size_t *n, double **v, FILE *fin);
+
+	/* Writing and reading sparse vector */
+	/* A sparse vector is its length n and nnz (index, value) pairs, with
+	   the indices ascending.  The readers take sparse or dense input;
+	   the dense writers above write sparse when it is enabled and
+	   smaller (vec_set_sparse_output, or $VEC_SPARSE). */
+	extern void vec_set_sparse_output(int enabled);
+	extern int vec_sparse_output_is_enabled(void);
+	extern int vec_put_float_sparse_vector_to_file(size_t n, size_t nnz, const size_t *index, const float *v, FILE *fout);
+	extern int vec_new_float_sparse_vector_from_file(size_t *n, size_t *nnz, size_t **index, float **v, FILE *fin);
+	extern int vec_put_double_sparse_vector_to_file(size_t n, size_t nnz, const size_t *index, const double *v, FILE *fout);
+	extern int vec_new_double_sparse_vector_from_file(size_t *n, size_t *nnz, size_t **index, double **v, FILE *fin);
+	extern void vec_delete_sparse_index(size_t *index);
+
+	/* DO NOT USE UNTIL YOU UNDERSTAND WHAT THESE ARE. */
+	extern int vec_put_float_sparse_vector_to_file_binary(size_t n, size_t nnz, const size_t *index, const float *v, FILE *fout);
+	extern int vec_new_float_sparse_vector_from_file_binary(size_t *n, size_t *nnz, size_t **index, float **v, FILE *fin);
+	extern int vec_put_double_sparse_vector_to_file_binary(size_t n, size_t nnz, const size_t *index, const double *v, FILE *fout);
+	extern int vec_new_double_sparse_vector_from_file_binary(size_t *n, size_t *nnz, size_t **index, double **v, FILE *fin);
+
+	/* Writing vector of unknown length */
+	/* A writer that does not know the number of elements in advance
+	   puts the beginning, the elements in any number of pieces, and the
+	   end with the number of elements; the readers above read it like
+	   any other vector.  With s > 1, pieces should hold whole rows. */
+	extern int vec_put_stream_begin_to_file(FILE *fout);
+	extern int vec_put_float_stream_to_file(size_t n, const float *v, size_t s, FILE *fout);
+	extern int vec_put_double_stream_to_file(size_t n, const double *v, size_t s, FILE *fout);
+	extern int vec_put_stream_end_to_file(size_t n, FILE *fout);
+
+	/* DO NOT USE UNTIL YOU UNDERSTAND WHAT THESE ARE. */
+	extern int vec_put_stream_begin_to_file_binary(FILE *fout);
+	extern int vec_put_float_stream_to_file_binary(size_t n, const float *v, FILE *fout);
+	extern int vec_put_double_stream_to_file_binary(size_t n, const double *v, FILE *fout);
+	extern int vec_put_stream_end_to_file_binary(size_t n, FILE *fout);
+
+	/* Opening files and rings */
+	/* vec_open_file opens "-" as stdin or stdout, "ring:NAME" as a
+	   ring, and other names as files.  A ring carries a stream from one
+	   process to another through shared memory instead of a pipe; it
+	   is created by whichever side opens it first, and removed when the
+	   reader closes it.  Rings are not seekable, like pipes.
+	   vec_open_output, called by the tools from main(), makes the file
+	   or ring named by $VEC_OUTPUT stdout and closes it at exit; if the
+	   program exits with an error before a reader has opened the ring,
+	   the ring is removed.  Without $VEC_OUTPUT, it returns stdout. */
+#define VEC_RING_PREFIX "ring:"
+#define VEC_RING_LENGTH (1 << 20)
+	extern FILE *vec_open_ring(const char *name, const char *mode);
+	extern FILE *vec_open_file(const char *filename, const char *mode);
+	extern FILE *vec_open_output(void);
+
 	/* Slicing */
+	extern int vec_slice_float_vector(float *a, const float *v, size_t offset, size_t length, size_t stride);
 	extern int vec_slice_double_vector(double *a, const double *v, size_t offset, size_t length, size_t stride);
+	extern int vec_slice_float_sparse_vector(size_t *nnz, size_t *index, float *a, size_t nnz1, const size_t *index1, const float *v, size_t offset, size_t length, size_t stride);
+	extern int vec_slice_double_sparse_vector(size_t *nnz, size_t *index, double *a, size_t nnz1, const size_t *index1, const double *v, size_t offset, size_t length, size_t stride);
 	
 	/* Adding */
+	extern int vec_add_float_multi_vector_to_multi_vector(float *a, size_t s, size_t n1, const float *v1, size_t n2, const float *v2);
+	extern int vec_add_float_single_vector_to_multi_vector(float *a, size_t s, size_t n1, const float *v1, size_t n2, const float *v2);
 	extern int vec_add_double_multi_vector_to_multi_vector(double *a, size_t s, size_t n1, const double *v1, size_t n2, const double *v2);
 	extern int vec_add_double_single_vector_to_multi_vector(double *a, size_t s, size_t n1, const double *v1, size_t n2, const double *v2);
+	extern int vec_add_float_sparse_vector_to_vector(float *a, size_t n, const float *v1, size_t nnz, const size_t *index, const float *v2);
+	extern int vec_add_float_sparse_vector_to_sparse_vector(size_t *nnz, size_t *index, float *a, size_t nnz1, const size_t *index1, const float *v1, size_t nnz2, const size_t *index2, const float *v2);
+	extern int vec_add_double_sparse_vector_to_vector(double *a, size_t n, const double *v1, size_t nnz, const size_t *index, const double *v2);
+	extern int vec_add_double_sparse_vector_to_sparse_vector(size_t *nnz, size_t *index, double *a, size_t nnz1, const size_t *index1, const double *v1, size_t nnz2, const size_t *index2, const double *v2);
 
 	/* Multiplying */
+	extern int vec_multiply_float_multi_matrix_to_multi_vector(float *a, size_t s, size_t nm, const float *m, size_t nv, const float *v, int transpose);
+	extern int vec_multiply_float_single_matrix_to_multi_vector(float *a, size_t s, size_t nm, const float *m, size_t nv, const float *v, int transpose);
+
 	extern int vec_multiply_double_multi_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nv, const double *v, int transpose);
 
 	extern int vec_multiply_double_single_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nv, const double *v, int transpose);
+
+	/* Affine transform: a = m . v + b, with one translation b or one per vector */
+	extern int vec_affine_float_multi_matrix_to_multi_vector(float *a, size_t s, size_t nm, const float *m, size_t nb, const float *b, size_t nv, const float *v, int transpose);
+	extern int vec_affine_float_single_matrix_to_multi_vector(float *a, size_t s, size_t nm, const float *m, size_t nb, const float *b, size_t nv, const float *v, int transpose);
+	extern int vec_affine_double_multi_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nb, const double *b, size_t nv, const double *v, int transpose);
+	extern int vec_affine_double_single_matrix_to_multi_vector(double *a, size_t s, size_t nm, const double *m, size_t nb, const double *b, size_t nv, const double *v, int transpose);
+
+	/* c (m x n) = a (m x k) . b (k x n), row major */
+	extern int vec_multiply_float_matrix_to_matrix(float *c, size_t m, size_t n, size_t k, const float *a, const float *b);
+	extern int vec_multiply_double_matrix_to_matrix(double *c, size_t m, size_t n, size_t k, const double *a, const double *b);
+
+	/* Prefix scans */
+#define VEC_SCAN_SUM 0
+#define VEC_SCAN_MIN 1
+#define VEC_SCAN_MAX 2
+	extern int vec_scan_float_identity(float *carry, size_t s, int op);
+	extern int vec_scan_float_multi_vector(float *a, size_t s, size_t n, const float *v, int op, int exclusive, float *carry);
+	extern int vec_scan_float_combine(float *a, size_t s, size_t n, const float *c, int op);
+	extern int vec_scan_double_identity(double *carry, size_t s, int op);
+	extern int vec_scan_double_multi_vector(double *a, size_t s, size_t n, const double *v, int op, int exclusive, double *carry);
+	extern int vec_scan_double_combine(double *a, size_t s, size_t n, const double *c, int op);
+
+	/* FIR filter */
+#define VEC_FILTER_AUTO 0
+#define VEC_FILTER_DIRECT 1
+#define VEC_FILTER_FFT 2
+	extern int vec_filter_float_multi_vector(float *a, size_t s, size_t n, const float *v, size_t nk, const float *k, float *history, int method);
+	extern int vec_filter_double_multi_vector(double *a, size_t s, size_t n, const double *v, size_t nk, const double *k, double *history, int method);
+
+	/* Polyphase resampling by up / down */
+	extern int vec_resample_float_filter(float *h, size_t nh, size_t up, size_t down);
+	extern int vec_resample_float_multi_vector(float *a, size_t *na, size_t s, size_t n, const float *v, size_t up, size_t down, size_t nh, const float *h, float *history, size_t *phase);
+	extern int vec_resample_double_filter(double *h, size_t nh, size_t up, size_t down);
+	extern int vec_resample_double_multi_vector(double *a, size_t *na, size_t s, size_t n, const double *v, size_t up, size_t down, size_t nh, const double *h, double *history, size_t *phase);
+
+	/* Histograms, added to counts[component * nb + bin] */
+	extern int vec_histogram_float_uniform(size_t *counts, size_t nb, float lo, float hi, size_t s, size_t n, const float *v);
+	extern int vec_histogram_float_edges(size_t *counts, size_t nb, const float *edges, size_t s, size_t n, const float *v);
+	extern int vec_histogram_double_uniform(size_t *counts, size_t nb, double lo, double hi, size_t s, size_t n, const double *v);
+	extern int vec_histogram_double_edges(size_t *counts, size_t nb, const double *edges, size_t s, size_t n, const double *v);
+
+	/* Nearest neighbours */
+	extern int vec_knn_float_points(size_t *index, float *distance, size_t k, size_t d, size_t nq, const float *q, size_t nr, const float *r);
+	extern int vec_knn_double_points(size_t *index, double *distance, size_t k, size_t d, size_t nq, const double *q, size_t nr, const double *r);
   
 #ifdef __cplusplus
 	}
@@ -0,0 +1,1283 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Vector operations, written once for both element types.
+ *
+ * This file is not a public header.  vec.c includes it once per element
+ * type after defining
+ *   VEC_REAL            the element type (float or double),
+ *   VEC_REAL_NAME       the element type as a string literal,
+ *   VEC_FUNC(op, rest)  the public name vec_<op>_<type>_<rest>.
+ */
+
+#define VEC_FUNC_NAME(op, rest) "vec_" #op "_" VEC_REAL_NAME "_" #rest
+
+/* The operands of an element-wise operation, for its parts (see
+   vec_run_parts). */
+struct VEC_FUNC(elementwise, job) {
+	VEC_REAL *a;
+	size_t s;
+	size_t n;
+	const VEC_REAL *m;	/* or v1 */
+	const VEC_REAL *b;
+	size_t bs;
+	const VEC_REAL *v;	/* or v2 */
+	size_t offset;
+	size_t stride;
+	int transpose;
+};
+
+static void VEC_FUNC(slice, part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t i;
+
+	for (i = first; i < first + count; ++i) {
+		size_t j = t->offset + i * t->stride;
+		t->a[i] = t->v[j];
+	}
+}
+
+int VEC_FUNC(slice, vector)(VEC_REAL *a, const VEC_REAL *v, size_t offset, size_t length, size_t stride) {
+	if (a && v && length > 0 && stride > 0) {
+		struct VEC_FUNC(elementwise, job) t = { a, 1, length, NULL, NULL, 0, v, offset, stride, 0 };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts(length, length, VEC_FUNC(slice, part), &t);
+		vec_profile_end(VEC_PROFILE_COMPUTE, length, 2 * length * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		if (!a) {
+			vec_error_handler(1, VEC_FUNC_NAME(slice, vector) ": destination null");
+		}
+		if (!v) {
+			vec_error_handler(1, VEC_FUNC_NAME(slice, vector) ": source null");
+		}
+		if (length == 0) {
+			vec_error_handler(1, VEC_FUNC_NAME(slice, vector) ": length is 0");
+		}
+		if (stride == 0) {
+			vec_error_handler(1, VEC_FUNC_NAME(slice, vector) ": stride is 0");
+		}
+		return 1;
+	}
+}
+
+/* Elements offset + i * stride (i < length) of a sparse vector, as a
+   sparse vector of length `length'.  a and index must hold nnz1. */
+int VEC_FUNC(slice, sparse_vector)(size_t *nnz, size_t *index, VEC_REAL *a, size_t nnz1, const size_t *index1, const VEC_REAL *v, size_t offset, size_t length, size_t stride) {
+	if (nnz && (nnz1 == 0 || (index && a && index1 && v)) && stride > 0) {
+		size_t i, k = 0;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (i = 0; i < nnz1; ++i) {
+			size_t j = index1[i];
+			if (j >= offset && (j - offset) % stride == 0 && (j - offset) / stride < length) {
+				index[k] = (j - offset) / stride;
+				a[k] = v[i];
+				++k;
+			}
+		}
+		*nnz = k;
+		vec_profile_end(VEC_PROFILE_COMPUTE, nnz1, nnz1 * (sizeof(size_t) + sizeof(VEC_REAL)) + k * (sizeof(size_t) + sizeof(VEC_REAL)));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(slice, sparse_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/* Records [first, first + count) of s elements, the last one short if
+   n is not a multiple of s. */
+static void VEC_FUNC(add, multi_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t i = first * t->s, end = (first + count) * t->s;
+
+	if (end > t->n) {
+		end = t->n;
+	}
+	for (; i < end; ++i) {
+		t->a[i] = t->m[i] + t->v[i];
+	}
+}
+
+int VEC_FUNC(add, multi_vector_to_multi_vector)(VEC_REAL *a, size_t s, size_t n1, const VEC_REAL *v1, size_t n2, const VEC_REAL *v2) {
+	if (a && s > 0 && n1 > 0 && v1 && n2 > 0 && v2) {
+		size_t n = (n1 < n2) ? n1 : n2;
+		struct VEC_FUNC(elementwise, job) t = { a, s, n, v1, NULL, 0, v2, 0, 0, 0 };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts((n + s - 1) / s, n, VEC_FUNC(add, multi_part), &t);
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, 3 * n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(add, multi_vector_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+static void VEC_FUNC(add, single_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t i, j;
+
+	for (j = first; j < first + count; ++j) {
+		for (i = 0; i < t->s; ++i) {
+			size_t k = j * t->s + i;
+			if (k < t->n) {
+				t->a[k] = t->m[i] + t->v[k];
+			}
+		}
+	}
+}
+
+int VEC_FUNC(add, single_vector_to_multi_vector)(VEC_REAL *a, size_t s, size_t n1, const VEC_REAL *v1, size_t n2, const VEC_REAL *v2) {
+	if (a && s > 0 && n1 >= s && v1 && n2 / s >= n1 / s && v2) {
+		struct VEC_FUNC(elementwise, job) t = { a, s, n2, v1, NULL, 0, v2, 0, 0, 0 };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts((n2 + s - 1) / s, n2, VEC_FUNC(add, single_part), &t);
+		vec_profile_end(VEC_PROFILE_COMPUTE, n2, 2 * n2 * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(add, single_vector_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/* a = v1 + (the sparse vector nnz, index, v2), for the n elements of
+   v1.  a may be v1. */
+int VEC_FUNC(add, sparse_vector_to_vector)(VEC_REAL *a, size_t n, const VEC_REAL *v1, size_t nnz, const size_t *index, const VEC_REAL *v2) {
+	if (a && n > 0 && v1 && (nnz == 0 || (index && v2))) {
+		size_t i;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		if (a != v1) {
+			memcpy(a, v1, n * sizeof(VEC_REAL));
+		}
+		for (i = 0; i < nnz && index[i] < n; ++i) {
+			a[index[i]] += v2[i];
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, nnz, 3 * nnz * sizeof(VEC_REAL) + nnz * sizeof(size_t));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(add, sparse_vector_to_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/* The sum of two sparse vectors, merged by index; sums that are exactly
+   zero are dropped.  a and index must hold nnz1 + nnz2. */
+int VEC_FUNC(add, sparse_vector_to_sparse_vector)(size_t *nnz, size_t *index, VEC_REAL *a, size_t nnz1, const size_t *index1, const VEC_REAL *v1, size_t nnz2, const size_t *index2, const VEC_REAL *v2) {
+	if (nnz && (nnz1 + nnz2 == 0 || (index && a)) && (nnz1 == 0 || (index1 && v1)) && (nnz2 == 0 || (index2 && v2))) {
+		size_t i = 0, j = 0, k = 0;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		while (i < nnz1 || j < nnz2) {
+			VEC_REAL x;
+			size_t m;
+
+			if (j >= nnz2 || (i < nnz1 && index1[i] < index2[j])) {
+				m = index1[i];
+				x = v1[i++];
+			}
+			else if (i >= nnz1 || index2[j] < index1[i]) {
+				m = index2[j];
+				x = v2[j++];
+			}
+			else {
+				m = index1[i];
+				x = v1[i++] + v2[j++];
+			}
+			if (x != 0) {
+				index[k] = m;
+				a[k] = x;
+				++k;
+			}
+		}
+		*nnz = k;
+		vec_profile_end(VEC_PROFILE_COMPUTE, nnz1 + nnz2, (nnz1 + nnz2 + k) * (sizeof(size_t) + sizeof(VEC_REAL)));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(add, sparse_vector_to_sparse_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * a = m . v (+ b) for the nr records of s elements of v, the loop of
+ * multiply and affine.  The coefficient of input i in output j is
+ * m[i * is + j * js]; record k takes its matrix at m + k * ms and its
+ * translation at b + k * bs.  The sums are formed in the order of i and
+ * rounded as multiply, then add, would.  Called with constant s, is and
+ * js (VEC_DISPATCH_DIMENSION), the loops over a record are unrolled;
+ * records up to VEC_FIXED_DIMENSIONS are read, and a matrix shared by
+ * all records (ms == 0) copied, into local arrays first, so that the
+ * stores into a can not change them and they stay in registers.
+ */
+VEC_INLINE void VEC_FUNC(transform, records)(VEC_REAL *a, size_t s, size_t nr, const VEC_REAL *m, size_t ms, size_t is, size_t js, int translate, const VEC_REAL *b, size_t bs, const VEC_REAL *v) {
+	VEC_REAL w[VEC_FIXED_DIMENSIONS * VEC_FIXED_DIMENSIONS];
+	VEC_REAL x[VEC_FIXED_DIMENSIONS];
+	const VEC_REAL *vk;
+	size_t i, j, k;
+
+	if (ms == 0 && s <= VEC_FIXED_DIMENSIONS) {
+		VEC_UNROLL
+		for (i = 0; i < s; ++i) {
+			VEC_UNROLL
+			for (j = 0; j < s; ++j) {
+				w[i * s + j] = m[i * is + j * js];
+			}
+		}
+		m = w;
+		is = s;
+		js = 1;
+	}
+	for (k = 0; k < nr; ++k) {
+		const VEC_REAL *mk = m + k * ms;
+
+		vk = v + k * s;
+		if (s <= VEC_FIXED_DIMENSIONS) {
+			VEC_UNROLL
+			for (i = 0; i < s; ++i) {
+				x[i] = vk[i];
+			}
+			vk = x;
+		}
+		VEC_UNROLL
+		for (j = 0; j < s; ++j) {
+			VEC_REAL sum = 0;
+			VEC_UNROLL
+			for (i = 0; i < s; ++i) {
+				sum += mk[i * is + j * js] * vk[i];
+			}
+			a[k * s + j] = translate ? sum + b[k * bs + j] : sum;
+		}
+	}
+}
+
+static void VEC_FUNC(multiply, multi_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t s = t->s;
+	VEC_REAL *a = t->a + first * s;
+	const VEC_REAL *m = t->m + first * s * s;
+	const VEC_REAL *v = t->v + first * s;
+
+#define VEC_TRANSFORM(S) (t->transpose == 0 ? \
+	VEC_FUNC(transform, records)(a, S, count, m, (S) * (S), S, 1, 0, NULL, 0, v) : \
+	VEC_FUNC(transform, records)(a, S, count, m, (S) * (S), 1, S, 0, NULL, 0, v))
+	VEC_DISPATCH_DIMENSION(s, VEC_TRANSFORM)
+#undef VEC_TRANSFORM
+}
+
+int VEC_FUNC(multiply, multi_matrix_to_multi_vector)(VEC_REAL *a, size_t s, size_t nm, const VEC_REAL *m, size_t nv, const VEC_REAL *v, int transpose) {
+	if (a && s > 0 && nm / (s * s) >= nv / s && m && nv / s > 0 && v) {
+		size_t k;
+		struct VEC_FUNC(elementwise, job) t = { a, s, nv, m, NULL, 0, v, 0, 0, transpose };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts(nv / s, nv, VEC_FUNC(multiply, multi_part), &t);
+		for (k = nv / s * s; k < nv; ++k) {
+			a[k] = 0;
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, nv, (nv * s + 2 * nv) * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(multiply, multi_matrix_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+static void VEC_FUNC(multiply, single_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t s = t->s;
+	VEC_REAL *a = t->a + first * s;
+	const VEC_REAL *m = t->m;
+	const VEC_REAL *v = t->v + first * s;
+
+#define VEC_TRANSFORM(S) (t->transpose == 0 ? \
+	VEC_FUNC(transform, records)(a, S, count, m, 0, S, 1, 0, NULL, 0, v) : \
+	VEC_FUNC(transform, records)(a, S, count, m, 0, 1, S, 0, NULL, 0, v))
+	VEC_DISPATCH_DIMENSION(s, VEC_TRANSFORM)
+#undef VEC_TRANSFORM
+}
+
+int VEC_FUNC(multiply, single_matrix_to_multi_vector)(VEC_REAL *a, size_t s, size_t nm, const VEC_REAL *m, size_t nv, const VEC_REAL *v, int transpose) {
+	if (a && s > 0 && nm >= s * s && m && nv / s >= nm / (s * s) && v) {
+		size_t k;
+		struct VEC_FUNC(elementwise, job) t = { a, s, nv, m, NULL, 0, v, 0, 0, transpose };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts(nv / s, nv, VEC_FUNC(multiply, single_part), &t);
+		for (k = nv / s * s; k < nv; ++k) {
+			a[k] = 0;
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, nv, 2 * nv * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(multiply, single_matrix_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * Affine transform a = m . v + b, fused so that each vector is read and
+ * written once.  b holds one translation of s elements, shared by all
+ * vectors, or one per vector.
+ */
+
+static void VEC_FUNC(affine, single_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t s = t->s;
+	VEC_REAL *a = t->a + first * s;
+	const VEC_REAL *m = t->m;
+	const VEC_REAL *v = t->v + first * s;
+	const VEC_REAL *b = t->b + first * t->bs;
+
+#define VEC_TRANSFORM(S) (t->transpose == 0 ? \
+	VEC_FUNC(transform, records)(a, S, count, m, 0, S, 1, 1, b, t->bs, v) : \
+	VEC_FUNC(transform, records)(a, S, count, m, 0, 1, S, 1, b, t->bs, v))
+	VEC_DISPATCH_DIMENSION(s, VEC_TRANSFORM)
+#undef VEC_TRANSFORM
+}
+
+int VEC_FUNC(affine, single_matrix_to_multi_vector)(VEC_REAL *a, size_t s, size_t nm, const VEC_REAL *m, size_t nb, const VEC_REAL *b, size_t nv, const VEC_REAL *v, int transpose) {
+	if (a && s > 0 && nm >= s * s && m && (nb == s || nb >= nv) && b && nv % s == 0 && v) {
+		size_t bs = nb == s ? 0 : s;
+		struct VEC_FUNC(elementwise, job) t = { a, s, nv, m, b, bs, v, 0, 0, transpose };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts(nv / s, nv, VEC_FUNC(affine, single_part), &t);
+		vec_profile_end(VEC_PROFILE_COMPUTE, nv, (2 * nv + (bs ? nv : s)) * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(affine, single_matrix_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+static void VEC_FUNC(affine, multi_part)(void *context, size_t first, size_t count) {
+	const struct VEC_FUNC(elementwise, job) *t = (const struct VEC_FUNC(elementwise, job) *)context;
+	size_t s = t->s;
+	VEC_REAL *a = t->a + first * s;
+	const VEC_REAL *m = t->m + first * s * s;
+	const VEC_REAL *v = t->v + first * s;
+	const VEC_REAL *b = t->b + first * t->bs;
+
+#define VEC_TRANSFORM(S) (t->transpose == 0 ? \
+	VEC_FUNC(transform, records)(a, S, count, m, (S) * (S), S, 1, 1, b, t->bs, v) : \
+	VEC_FUNC(transform, records)(a, S, count, m, (S) * (S), 1, S, 1, b, t->bs, v))
+	VEC_DISPATCH_DIMENSION(s, VEC_TRANSFORM)
+#undef VEC_TRANSFORM
+}
+
+int VEC_FUNC(affine, multi_matrix_to_multi_vector)(VEC_REAL *a, size_t s, size_t nm, const VEC_REAL *m, size_t nb, const VEC_REAL *b, size_t nv, const VEC_REAL *v, int transpose) {
+	if (a && s > 0 && m && nm / (s * s) >= nv / s && (nb == s || nb >= nv) && b && nv % s == 0 && v) {
+		size_t bs = nb == s ? 0 : s;
+		struct VEC_FUNC(elementwise, job) t = { a, s, nv, m, b, bs, v, 0, 0, transpose };
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		vec_run_parts(nv / s, nv, VEC_FUNC(affine, multi_part), &t);
+		vec_profile_end(VEC_PROFILE_COMPUTE, nv, (nv * s + 2 * nv + (bs ? nv : s)) * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(affine, multi_matrix_to_multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * Prefix scans.  carry holds the running sum (or minimum, or maximum)
+ * of each of the s components, so that a long vector can be scanned
+ * piece by piece: it is read before the first element and updated past
+ * the last.  The pieces must start on a record boundary.
+ */
+
+int VEC_FUNC(scan, identity)(VEC_REAL *carry, size_t s, int op) {
+	if (carry && (op == VEC_SCAN_SUM || op == VEC_SCAN_MIN || op == VEC_SCAN_MAX)) {
+		const VEC_REAL x = op == VEC_SCAN_SUM ? 0 : op == VEC_SCAN_MIN ? HUGE_VAL : -HUGE_VAL;
+		size_t j;
+
+		for (j = 0; j < s; ++j) {
+			carry[j] = x;
+		}
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(scan, identity) ": bad parameters");
+		return 1;
+	}
+}
+
+/* One step of a scan: c op x */
+#define VEC_SCAN_STEP(op, c, x) \
+	((op) == VEC_SCAN_SUM ? (c) + (x) : (op) == VEC_SCAN_MIN ? ((x) < (c) ? (x) : (c)) : ((x) > (c) ? (x) : (c)))
+
+int VEC_FUNC(scan, multi_vector)(VEC_REAL *a, size_t s, size_t n, const VEC_REAL *v, int op, int exclusive, VEC_REAL *carry) {
+	if (a && s > 0 && n % s == 0 && (v || n == 0) && carry && (op == VEC_SCAN_SUM || op == VEC_SCAN_MIN || op == VEC_SCAN_MAX)) {
+		size_t j, k;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		/* a may be v; each element is read before it is written */
+		if (s == 1) {
+			VEC_REAL c = carry[0];
+			for (k = 0; k < n; ++k) {
+				const VEC_REAL x = v[k];
+				const VEC_REAL y = VEC_SCAN_STEP(op, c, x);
+				a[k] = exclusive ? c : y;
+				c = y;
+			}
+			carry[0] = c;
+		}
+		else {
+			for (k = 0; k < n; k += s) {
+				for (j = 0; j < s; ++j) {
+					const VEC_REAL c = carry[j];
+					const VEC_REAL x = v[k + j];
+					const VEC_REAL y = VEC_SCAN_STEP(op, c, x);
+					a[k + j] = exclusive ? c : y;
+					carry[j] = y;
+				}
+			}
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, 2 * n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(scan, multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/* a = c op a, with c repeated for each record; the second pass of a
+   block-parallel scan, where c is the carry into the block.  Unlike the
+   scan itself, this has no dependency between elements, so the loops
+   are written per operation to be vectorized. */
+int VEC_FUNC(scan, combine)(VEC_REAL *a, size_t s, size_t n, const VEC_REAL *c, int op) {
+	if ((a || n == 0) && s > 0 && n % s == 0 && c && (op == VEC_SCAN_SUM || op == VEC_SCAN_MIN || op == VEC_SCAN_MAX)) {
+		size_t j, k;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		if (s == 1) {
+			const VEC_REAL c0 = c[0];
+			switch (op) {
+			case VEC_SCAN_SUM:
+				for (k = 0; k < n; ++k) {
+					a[k] = c0 + a[k];
+				}
+				break;
+			case VEC_SCAN_MIN:
+				for (k = 0; k < n; ++k) {
+					a[k] = a[k] < c0 ? a[k] : c0;
+				}
+				break;
+			default:
+				for (k = 0; k < n; ++k) {
+					a[k] = a[k] > c0 ? a[k] : c0;
+				}
+				break;
+			}
+		}
+		else {
+			for (k = 0; k < n; k += s) {
+				for (j = 0; j < s; ++j) {
+					a[k + j] = VEC_SCAN_STEP(op, c[j], a[k + j]);
+				}
+			}
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, 2 * n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(scan, combine) ": bad parameters");
+		return 1;
+	}
+}
+
+#undef VEC_SCAN_STEP
+
+/*
+ * Matrix product, blocked after Goto and van de Geijn.  A KC x NC block
+ * of the right matrix and an MC x KC block of the left matrix are
+ * packed, zero-padded, into slivers of NR columns and MR rows, so that
+ * the micro kernel reads both with unit stride and keeps its MR x NR
+ * sums in registers.  KC x NR of the right matrix stays in L1 and
+ * MC x KC of the left matrix in L2.
+ */
+
+#ifndef VEC_GEMM_MR
+#define VEC_GEMM_MR 4	/* the micro kernel is written for 4 x 4 */
+#define VEC_GEMM_NR 4
+#define VEC_GEMM_MC 64
+#define VEC_GEMM_KC 256
+#define VEC_GEMM_NC 1024
+#endif
+
+static void VEC_FUNC(pack, matrix_rows)(VEC_REAL *p, const VEC_REAL *a, size_t lda, size_t mc, size_t kc) {
+	size_t i, l, r;
+
+	for (i = 0; i < mc; i += VEC_GEMM_MR) {
+		for (l = 0; l < kc; ++l) {
+			for (r = 0; r < VEC_GEMM_MR; ++r) {
+				*p++ = (i + r < mc) ? a[(i + r) * lda + l] : 0;
+			}
+		}
+	}
+}
+
+static void VEC_FUNC(pack, matrix_columns)(VEC_REAL *p, const VEC_REAL *b, size_t ldb, size_t kc, size_t nc) {
+	size_t j, l, r;
+
+	for (j = 0; j < nc; j += VEC_GEMM_NR) {
+		for (l = 0; l < kc; ++l) {
+			const VEC_REAL *row = b + l * ldb + j;
+			for (r = 0; r < VEC_GEMM_NR; ++r) {
+				*p++ = (j + r < nc) ? row[r] : 0;
+			}
+		}
+	}
+}
+
+/* The mr x nr corner of c (row length ldc) is set to, or with
+   accumulate incremented by, the product of an MR-row sliver a and an
+   NR-column sliver b of depth kc.  The sums are kept in separate
+   variables, which compilers keep in (vector) registers. */
+static void VEC_FUNC(multiply, packed_tile)(VEC_REAL *c, size_t ldc, size_t mr, size_t nr, size_t kc, const VEC_REAL *a, const VEC_REAL *b, int accumulate) {
+	VEC_REAL c00 = 0, c01 = 0, c02 = 0, c03 = 0;
+	VEC_REAL c10 = 0, c11 = 0, c12 = 0, c13 = 0;
+	VEC_REAL c20 = 0, c21 = 0, c22 = 0, c23 = 0;
+	VEC_REAL c30 = 0, c31 = 0, c32 = 0, c33 = 0;
+	VEC_REAL t[VEC_GEMM_MR][VEC_GEMM_NR];
+	size_t i, j, l;
+
+	for (l = 0; l < kc; ++l) {
+		VEC_REAL a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+		VEC_REAL b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3];
+
+		c00 += a0 * b0; c01 += a0 * b1; c02 += a0 * b2; c03 += a0 * b3;
+		c10 += a1 * b0; c11 += a1 * b1; c12 += a1 * b2; c13 += a1 * b3;
+		c20 += a2 * b0; c21 += a2 * b1; c22 += a2 * b2; c23 += a2 * b3;
+		c30 += a3 * b0; c31 += a3 * b1; c32 += a3 * b2; c33 += a3 * b3;
+		a += VEC_GEMM_MR;
+		b += VEC_GEMM_NR;
+	}
+	if (mr == VEC_GEMM_MR && nr == VEC_GEMM_NR && !accumulate) {
+		c[0] = c00; c[1] = c01; c[2] = c02; c[3] = c03;
+		c += ldc;
+		c[0] = c10; c[1] = c11; c[2] = c12; c[3] = c13;
+		c += ldc;
+		c[0] = c20; c[1] = c21; c[2] = c22; c[3] = c23;
+		c += ldc;
+		c[0] = c30; c[1] = c31; c[2] = c32; c[3] = c33;
+		return;
+	}
+	t[0][0] = c00; t[0][1] = c01; t[0][2] = c02; t[0][3] = c03;
+	t[1][0] = c10; t[1][1] = c11; t[1][2] = c12; t[1][3] = c13;
+	t[2][0] = c20; t[2][1] = c21; t[2][2] = c22; t[2][3] = c23;
+	t[3][0] = c30; t[3][1] = c31; t[3][2] = c32; t[3][3] = c33;
+	for (i = 0; i < mr; ++i) {
+		for (j = 0; j < nr; ++j) {
+			c[i * ldc + j] = accumulate ? c[i * ldc + j] + t[i][j] : t[i][j];
+		}
+	}
+}
+
+/* c (m x n) = a (m x k) . b (k x n), all row major.  Rows of c depend
+   only on the same rows of a, so callers may split the rows among
+   threads. */
+int VEC_FUNC(multiply, matrix_to_matrix)(VEC_REAL *c, size_t m, size_t n, size_t k, const VEC_REAL *a, const VEC_REAL *b) {
+	if (c && a && b && m > 0 && n > 0 && k > 0) {
+		size_t nc_max = (n < VEC_GEMM_NC) ? n : VEC_GEMM_NC;
+		size_t kc_max = (k < VEC_GEMM_KC) ? k : VEC_GEMM_KC;
+		VEC_REAL *pa = (VEC_REAL *)malloc((VEC_GEMM_MC + VEC_GEMM_MR) * kc_max * sizeof(VEC_REAL));
+		VEC_REAL *pb = (VEC_REAL *)malloc((nc_max + VEC_GEMM_NR) * kc_max * sizeof(VEC_REAL));
+		size_t ic, jc, pc, ir, jr;
+
+		if (!pa || !pb) {
+			free(pa);
+			free(pb);
+			vec_error_handler(1, VEC_FUNC_NAME(multiply, matrix_to_matrix) ": out of memory");
+			return 1;
+		}
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (jc = 0; jc < n; jc += VEC_GEMM_NC) {
+			size_t nc = (n - jc < VEC_GEMM_NC) ? n - jc : VEC_GEMM_NC;
+
+			for (pc = 0; pc < k; pc += VEC_GEMM_KC) {
+				size_t kc = (k - pc < VEC_GEMM_KC) ? k - pc : VEC_GEMM_KC;
+
+				VEC_FUNC(pack, matrix_columns)(pb, b + pc * n + jc, n, kc, nc);
+				for (ic = 0; ic < m; ic += VEC_GEMM_MC) {
+					size_t mc = (m - ic < VEC_GEMM_MC) ? m - ic : VEC_GEMM_MC;
+
+					VEC_FUNC(pack, matrix_rows)(pa, a + ic * k + pc, k, mc, kc);
+					for (jr = 0; jr < nc; jr += VEC_GEMM_NR) {
+						size_t nr = (nc - jr < VEC_GEMM_NR) ? nc - jr : VEC_GEMM_NR;
+
+						for (ir = 0; ir < mc; ir += VEC_GEMM_MR) {
+							size_t mr = (mc - ir < VEC_GEMM_MR) ? mc - ir : VEC_GEMM_MR;
+
+							VEC_FUNC(multiply, packed_tile)(c + (ic + ir) * n + jc + jr, n, mr, nr, kc, pa + ir * kc, pb + jr * kc, pc > 0);
+						}
+					}
+				}
+			}
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, m * n, (m * k + k * n + m * n) * sizeof(VEC_REAL));
+		free(pa);
+		free(pb);
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(multiply, matrix_to_matrix) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * k nearest neighbours by brute force.  Squared distances are taken as
+ * |q|^2 + (|r|^2 - 2 q.r), where the parenthesized part for a block of
+ * queries and a tile of reference points is one blocked matrix product
+ * (above) of the queries extended by 1 and the transposed tile
+ * extended by |r|^2.  Each query keeps its k best candidates in a
+ * max-heap in its part of the output.
+ */
+
+#ifndef VEC_KNN_QUERIES
+#define VEC_KNN_QUERIES 64	/* queries per block */
+#define VEC_KNN_POINTS 256	/* reference points per tile */
+#endif
+
+/* Whether (da, ia) is farther than (db, ib); ties go by index, so that
+   the result does not depend on the blocking.  NaN is farther than any
+   other distance. */
+static int VEC_FUNC(knn, farther)(VEC_REAL da, size_t ia, VEC_REAL db, size_t ib) {
+	if (da != da || db != db) {
+		return db == db || (da != da && ia > ib);
+	}
+	return da > db || (da == db && ia > ib);
+}
+
+static void VEC_FUNC(knn, sift_down)(size_t *index, VEC_REAL *distance, size_t n, size_t i) {
+	for (;;) {
+		size_t l = 2 * i + 1, m = i;
+		size_t t;
+		VEC_REAL x;
+
+		if (l < n && VEC_FUNC(knn, farther)(distance[l], index[l], distance[m], index[m])) {
+			m = l;
+		}
+		if (l + 1 < n && VEC_FUNC(knn, farther)(distance[l + 1], index[l + 1], distance[m], index[m])) {
+			m = l + 1;
+		}
+		if (m == i) {
+			return;
+		}
+		t = index[i]; index[i] = index[m]; index[m] = t;
+		x = distance[i]; distance[i] = distance[m]; distance[m] = x;
+		i = m;
+	}
+}
+
+/* Offers point j at squared distance x to a heap that has seen the
+   points before j. */
+static void VEC_FUNC(knn, offer)(size_t *index, VEC_REAL *distance, size_t k, size_t j, VEC_REAL x) {
+	if (j < k) {
+		size_t i = j;
+
+		while (i > 0 && VEC_FUNC(knn, farther)(x, j, distance[(i - 1) / 2], index[(i - 1) / 2])) {
+			index[i] = index[(i - 1) / 2];
+			distance[i] = distance[(i - 1) / 2];
+			i = (i - 1) / 2;
+		}
+		index[i] = j;
+		distance[i] = x;
+	}
+	else if (VEC_FUNC(knn, farther)(distance[0], index[0], x, j)) {
+		index[0] = j;
+		distance[0] = x;
+		VEC_FUNC(knn, sift_down)(index, distance, k, 0);
+	}
+}
+
+/* For each of the nq queries q (d elements each), the indices of the k
+   nearest of the nr points r and their squared distances, nearest
+   first, are stored in index and distance (k per query).  Queries are
+   independent, so callers may split them among threads. */
+int VEC_FUNC(knn, points)(size_t *index, VEC_REAL *distance, size_t k, size_t d, size_t nq, const VEC_REAL *q, size_t nr, const VEC_REAL *r) {
+	if (index && distance && q && r && k > 0 && d > 0 && k <= nr) {
+		size_t tile = (nr < VEC_KNN_POINTS) ? nr : VEC_KNN_POINTS;
+		VEC_REAL *qa = (VEC_REAL *)malloc(VEC_KNN_QUERIES * (d + 1) * sizeof(VEC_REAL));
+		VEC_REAL *qn = (VEC_REAL *)malloc(VEC_KNN_QUERIES * sizeof(VEC_REAL));
+		VEC_REAL *rt = (VEC_REAL *)malloc(tile * (d + 1) * sizeof(VEC_REAL));
+		VEC_REAL *x = (VEC_REAL *)malloc(VEC_KNN_QUERIES * tile * sizeof(VEC_REAL));
+		size_t qb, rb, i, j, l;
+
+		if (!qa || !qn || !rt || !x) {
+			free(qa);
+			free(qn);
+			free(rt);
+			free(x);
+			vec_error_handler(1, VEC_FUNC_NAME(knn, points) ": out of memory");
+			return 1;
+		}
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (qb = 0; qb < nq; qb += VEC_KNN_QUERIES) {
+			size_t nqb = (nq - qb < VEC_KNN_QUERIES) ? nq - qb : VEC_KNN_QUERIES;
+
+			for (i = 0; i < nqb; ++i) {
+				const VEC_REAL *p = q + (qb + i) * d;
+
+				qn[i] = 0;
+				for (l = 0; l < d; ++l) {
+					qa[i * (d + 1) + l] = p[l];
+					qn[i] += p[l] * p[l];
+				}
+				qa[i * (d + 1) + d] = 1;
+			}
+			for (rb = 0; rb < nr; rb += tile) {
+				size_t nrb = (nr - rb < tile) ? nr - rb : tile;
+
+				for (j = 0; j < nrb; ++j) {
+					const VEC_REAL *p = r + (rb + j) * d;
+					VEC_REAL rn = 0;
+
+					for (l = 0; l < d; ++l) {
+						rt[l * nrb + j] = -2 * p[l];
+						rn += p[l] * p[l];
+					}
+					rt[d * nrb + j] = rn;
+				}
+				VEC_FUNC(multiply, matrix_to_matrix)(x, nqb, nrb, d + 1, qa, rt);
+				for (i = 0; i < nqb; ++i) {
+					const VEC_REAL *xi = x + i * nrb;
+					size_t *hi = index + (qb + i) * k;
+					VEC_REAL *hd = distance + (qb + i) * k;
+					/* later points lose ties, so only nearer ones enter a full
+					   heap; the first k always enter, even at inf or NaN */
+					VEC_REAL top = (rb < k) ? HUGE_VAL : hd[0];
+
+					for (j = 0; j < nrb; ++j) {
+						VEC_REAL y = qn[i] + xi[j];
+
+						if (rb + j < k || y < top || top != top) {
+							VEC_FUNC(knn, offer)(hi, hd, k, rb + j, y < 0 ? 0 : y);
+							if (rb + j + 1 >= k) {
+								top = hd[0];
+							}
+						}
+					}
+				}
+			}
+		}
+		/* heap sort, nearest first */
+		for (i = 0; i < nq; ++i) {
+			size_t *hi = index + i * k;
+			VEC_REAL *hd = distance + i * k;
+
+			for (j = k - 1; j > 0; --j) {
+				size_t t = hi[0];
+				VEC_REAL y = hd[0];
+
+				hi[0] = hi[j]; hi[j] = t;
+				hd[0] = hd[j]; hd[j] = y;
+				VEC_FUNC(knn, sift_down)(hi, hd, j, 0);
+			}
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, nq * nr, (nq + nr * ((nq + VEC_KNN_QUERIES - 1) / VEC_KNN_QUERIES)) * d * sizeof(VEC_REAL));
+		free(qa);
+		free(qn);
+		free(rt);
+		free(x);
+		return 0;
+	}
+	else {
+		if (k > nr) {
+			vec_error_handler(1, VEC_FUNC_NAME(knn, points) ": k is greater than the number of points");
+		}
+		else {
+			vec_error_handler(1, VEC_FUNC_NAME(knn, points) ": bad parameters");
+		}
+		return 1;
+	}
+}
+
+/*
+ * FIR filter, a[t] = k[0] v[t] + k[1] v[t - 1] + ... + k[nk - 1] v[t - nk + 1]
+ * for each of the s components.  history holds the nk - 1 records before
+ * v (zeros at the start of a signal) and is updated to the last nk - 1
+ * records, so that a long signal can be filtered piece by piece.
+ *
+ * Short kernels are applied directly, four outputs at a time.  Long ones
+ * go through overlap-save FFT convolution: segments of L = 2^p >= 4 nk
+ * inputs give L - nk + 1 outputs each.  The kernel is real, so two
+ * segments ride in the real and imaginary parts of one transform.
+ */
+
+#ifndef VEC_FILTER_DIRECT_MAX
+#define VEC_FILTER_DIRECT_MAX 48	/* longest kernel applied directly */
+#endif
+
+/* Twiddle factors e^(-i pi j / h) of each stage h = 1, 2, 4, ..., n / 2,
+   stored from h - 1 on. */
+static void VEC_FUNC(fft, tables)(VEC_REAL *c, VEC_REAL *sn, size_t n) {
+	const double pi = 3.14159265358979323846;
+	size_t h, j;
+
+	for (h = 1; h < n; h *= 2) {
+		for (j = 0; j < h; ++j) {
+			c[h - 1 + j] = (VEC_REAL)cos(pi * j / h);
+			sn[h - 1 + j] = (VEC_REAL)-sin(pi * j / h);
+		}
+	}
+}
+
+/* In-place radix-2 transform of n = 2^p complex numbers; unscaled. */
+static void VEC_FUNC(fft, transform)(VEC_REAL *re, VEC_REAL *im, size_t n, const VEC_REAL *c, const VEC_REAL *sn, int inverse) {
+	const VEC_REAL sign = inverse ? -1 : 1;
+	size_t h, i, j, bit;
+
+	for (i = 0, j = 0; i < n; ++i) {
+		if (i < j) {
+			VEC_REAL t = re[i];
+			re[i] = re[j];
+			re[j] = t;
+			t = im[i];
+			im[i] = im[j];
+			im[j] = t;
+		}
+		for (bit = n >> 1; bit > 0 && (j & bit); bit >>= 1) {
+			j ^= bit;
+		}
+		j |= bit;
+	}
+	for (h = 1; h < n; h *= 2) {
+		const VEC_REAL *wc = c + h - 1;
+		const VEC_REAL *ws = sn + h - 1;
+		for (i = 0; i < n; i += 2 * h) {
+			VEC_REAL *rp = re + i, *ip = im + i;
+			VEC_REAL *rq = re + i + h, *iq = im + i + h;
+			for (j = 0; j < h; ++j) {
+				const VEC_REAL wr = wc[j], wi = sign * ws[j];
+				const VEC_REAL tr = wr * rq[j] - wi * iq[j];
+				const VEC_REAL ti = wr * iq[j] + wi * rq[j];
+				rq[j] = rp[j] - tr;
+				iq[j] = ip[j] - ti;
+				rp[j] += tr;
+				ip[j] += ti;
+			}
+		}
+	}
+}
+
+/* Input t of component j, where t < 0 reaches into the history and
+   t >= nr past the end reads as zero. */
+#define VEC_FILTER_INPUT(t) \
+	((t) < 0 ? history[(size_t)((ptrdiff_t)(nk - 1) + (t)) * s + j] : (size_t)(t) < nr ? v[(size_t)(t) * s + j] : 0)
+
+static void VEC_FUNC(filter, direct)(VEC_REAL *a, size_t s, size_t nr, const VEC_REAL *v, size_t nk, const VEC_REAL *k, const VEC_REAL *history) {
+	size_t i, j, t;
+
+	for (j = 0; j < s; ++j) {
+		/* outputs that reach into the history */
+		for (t = 0; t < nr && t + 1 < nk; ++t) {
+			VEC_REAL sum = 0;
+			for (i = 0; i < nk; ++i) {
+				sum += k[i] * VEC_FILTER_INPUT((ptrdiff_t)t - (ptrdiff_t)i);
+			}
+			a[t * s + j] = sum;
+		}
+		for (; t + 4 <= nr; t += 4) {
+			const VEC_REAL *p = v + t * s + j;
+			VEC_REAL sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+			for (i = 0; i < nk; ++i) {
+				const VEC_REAL *q = p - i * s;
+				sum0 += k[i] * q[0];
+				sum1 += k[i] * q[s];
+				sum2 += k[i] * q[2 * s];
+				sum3 += k[i] * q[3 * s];
+			}
+			a[t * s + j] = sum0;
+			a[(t + 1) * s + j] = sum1;
+			a[(t + 2) * s + j] = sum2;
+			a[(t + 3) * s + j] = sum3;
+		}
+		for (; t < nr; ++t) {
+			const VEC_REAL *p = v + t * s + j;
+			VEC_REAL sum = 0;
+			for (i = 0; i < nk; ++i) {
+				sum += k[i] * p[-(ptrdiff_t)(i * s)];
+			}
+			a[t * s + j] = sum;
+		}
+	}
+}
+
+static int VEC_FUNC(filter, fft)(VEC_REAL *a, size_t s, size_t nr, const VEC_REAL *v, size_t nk, const VEC_REAL *k, const VEC_REAL *history) {
+	size_t n = 1, b, i, j, t, u;
+	VEC_REAL *buffer;
+	VEC_REAL *re, *im, *hr, *hi, *c, *sn;
+
+	while (n < 4 * nk) {
+		n *= 2;
+	}
+	b = n - nk + 1;
+	buffer = (VEC_REAL *)malloc(6 * n * sizeof(VEC_REAL));
+	if (!buffer) {
+		return 1;
+	}
+	re = buffer;
+	im = re + n;
+	hr = im + n;
+	hi = hr + n;
+	c = hi + n;
+	sn = c + n;
+	VEC_FUNC(fft, tables)(c, sn, n);
+	for (u = 0; u < n; ++u) {
+		/* the 1 / n of the inverse transform goes into the kernel */
+		hr[u] = u < nk ? k[u] / (VEC_REAL)n : 0;
+		hi[u] = 0;
+	}
+	VEC_FUNC(fft, transform)(hr, hi, n, c, sn, 0);
+
+	for (j = 0; j < s; ++j) {
+		for (t = 0; t < nr; t += 2 * b) {
+			const ptrdiff_t t0 = (ptrdiff_t)t - (ptrdiff_t)(nk - 1);
+			const ptrdiff_t t1 = t0 + (ptrdiff_t)b;
+			for (u = 0; u < n; ++u) {
+				re[u] = VEC_FILTER_INPUT(t0 + (ptrdiff_t)u);
+				im[u] = VEC_FILTER_INPUT(t1 + (ptrdiff_t)u);
+			}
+			VEC_FUNC(fft, transform)(re, im, n, c, sn, 0);
+			for (u = 0; u < n; ++u) {
+				const VEC_REAL x = re[u] * hr[u] - im[u] * hi[u];
+				im[u] = re[u] * hi[u] + im[u] * hr[u];
+				re[u] = x;
+			}
+			VEC_FUNC(fft, transform)(re, im, n, c, sn, 1);
+			for (i = 0; i < b && t + i < nr; ++i) {
+				a[(t + i) * s + j] = re[nk - 1 + i];
+			}
+			for (i = 0; i < b && t + b + i < nr; ++i) {
+				a[(t + b + i) * s + j] = im[nk - 1 + i];
+			}
+		}
+	}
+	free(buffer);
+	return 0;
+}
+
+#undef VEC_FILTER_INPUT
+
+int VEC_FUNC(filter, multi_vector)(VEC_REAL *a, size_t s, size_t n, const VEC_REAL *v, size_t nk, const VEC_REAL *k, VEC_REAL *history, int method) {
+	if (a && s > 0 && n % s == 0 && (v || n == 0) && a != v && nk > 0 && k && (history || nk == 1) && (method == VEC_FILTER_AUTO || method == VEC_FILTER_DIRECT || method == VEC_FILTER_FFT)) {
+		size_t nr = n / s;
+		size_t keep = (nk - 1) * s;
+
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		if (method == VEC_FILTER_DIRECT || (method == VEC_FILTER_AUTO && nk <= VEC_FILTER_DIRECT_MAX)) {
+			VEC_FUNC(filter, direct)(a, s, nr, v, nk, k, history);
+		}
+		else if (VEC_FUNC(filter, fft)(a, s, nr, v, nk, k, history) != 0) {
+			vec_profile_end(VEC_PROFILE_COMPUTE, 0, 0);
+			vec_error_handler(1, VEC_FUNC_NAME(filter, multi_vector) ": out of memory");
+			return 1;
+		}
+		if (keep > 0 && n >= keep) {
+			memcpy(history, v + n - keep, keep * sizeof(VEC_REAL));
+		}
+		else if (keep > 0) {
+			memmove(history, history + n, (keep - n) * sizeof(VEC_REAL));
+			memcpy(history + keep - n, v, n * sizeof(VEC_REAL));
+		}
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, 2 * n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(filter, multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * Polyphase resampling by up / down.  The input is conceptually
+ * upsampled by inserting up - 1 zeros after each sample, filtered with
+ * h (nh taps at the upsampled rate), and every down-th sample kept;
+ * only the taps that meet nonzero samples are computed.  With
+ * q = ceil(nh / up) taps per phase, history holds the q - 1 records
+ * before v, and *phase the upsampled position of the next output
+ * relative to v[0] (0 at the start of a signal), so that a long signal
+ * can be resampled piece by piece.  *na is set to the number of
+ * elements written to a, at most (ceil((n / s * up - *phase) / down)) * s.
+ */
+
+/* Blackman-windowed sinc lowpass for up / down: cutoff at the lower
+   Nyquist frequency, gain up. */
+int VEC_FUNC(resample, filter)(VEC_REAL *h, size_t nh, size_t up, size_t down) {
+	if (h && nh > 0 && up > 0 && down > 0) {
+		const double pi = 3.14159265358979323846;
+		const double fc = 1.0 / (up > down ? up : down);
+		const double c = (nh - 1) / 2.0;
+		size_t k;
+
+		for (k = 0; k < nh; ++k) {
+			double x = fc * (k - c);
+			double sinc = x == 0 ? 1 : sin(pi * x) / (pi * x);
+			double w = nh > 1 ? 0.42 - 0.5 * cos(2 * pi * k / (nh - 1)) + 0.08 * cos(4 * pi * k / (nh - 1)) : 1;
+			h[k] = (VEC_REAL)(up * fc * sinc * w);
+		}
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(resample, filter) ": bad parameters");
+		return 1;
+	}
+}
+
+/* x[0] h[0] + x[stride] h[1] + ... in four partial sums, so that the
+   products pair up in vector registers. */
+static VEC_REAL VEC_FUNC(resample, dot)(const VEC_REAL *h, const VEC_REAL *x, size_t stride, size_t q) {
+	VEC_REAL sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	size_t j = 0;
+
+	if (stride == 1) {
+		for (; j + 4 <= q; j += 4) {
+			sum0 += h[j] * x[j];
+			sum1 += h[j + 1] * x[j + 1];
+			sum2 += h[j + 2] * x[j + 2];
+			sum3 += h[j + 3] * x[j + 3];
+		}
+	}
+	else {
+		for (; j + 4 <= q; j += 4) {
+			sum0 += h[j] * x[j * stride];
+			sum1 += h[j + 1] * x[(j + 1) * stride];
+			sum2 += h[j + 2] * x[(j + 2) * stride];
+			sum3 += h[j + 3] * x[(j + 3) * stride];
+		}
+	}
+	for (; j < q; ++j) {
+		sum0 += h[j] * x[j * stride];
+	}
+	return (sum0 + sum1) + (sum2 + sum3);
+}
+
+int VEC_FUNC(resample, multi_vector)(VEC_REAL *a, size_t *na, size_t s, size_t n, const VEC_REAL *v, size_t up, size_t down, size_t nh, const VEC_REAL *h, VEC_REAL *history, size_t *phase) {
+	if (a && na && s > 0 && n % s == 0 && (v || n == 0) && up > 0 && down > 0 && nh > 0 && h && phase && (history || nh <= up)) {
+		const size_t nr = n / s;
+		const size_t q = (nh + up - 1) / up;
+		const size_t keep = (q - 1) * s;
+		/* the phase filters, reversed so that they run forward in time,
+		   and the records around the start of v */
+		VEC_REAL *bank = (VEC_REAL *)malloc((q * up + 2 * keep + 1) * sizeof(VEC_REAL));
+		VEC_REAL *head;
+		size_t pos = *phase, count = 0, p, j;
+
+		if (!bank) {
+			vec_error_handler(1, VEC_FUNC_NAME(resample, multi_vector) ": out of memory");
+			return 1;
+		}
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (p = 0; p < up; ++p) {
+			for (j = 0; j < q; ++j) {
+				size_t k = p + (q - 1 - j) * up;
+				bank[p * q + j] = k < nh ? h[k] : 0;
+			}
+		}
+		head = bank + q * up;
+		if (keep > 0) {
+			memcpy(head, history, keep * sizeof(VEC_REAL));
+			for (j = 0; j < keep; ++j) {
+				head[keep + j] = j < n ? v[j] : 0;
+			}
+		}
+		for (; pos < nr * up; pos += down, ++count) {
+			const size_t i = pos / up;
+			const VEC_REAL *f = bank + (pos % up) * q;
+			/* records i - q + 1 to i */
+			const VEC_REAL *x = i + 1 < q ? head + i * s : v + (i + 1 - q) * s;
+			size_t c;
+			for (c = 0; c < s; ++c) {
+				a[count * s + c] = VEC_FUNC(resample, dot)(f, x + c, s, q);
+			}
+		}
+		*phase = pos - nr * up;
+		*na = count * s;
+		if (keep > 0 && n >= keep) {
+			memcpy(history, v + n - keep, keep * sizeof(VEC_REAL));
+		}
+		else if (keep > 0) {
+			memmove(history, history + n, (keep - n) * sizeof(VEC_REAL));
+			memcpy(history + keep - n, v, n * sizeof(VEC_REAL));
+		}
+		free(bank);
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, (n + count * s) * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(resample, multi_vector) ": bad parameters");
+		return 1;
+	}
+}
+
+/*
+ * Histograms of each of the s components, added to counts (nb bins per
+ * component, component after component).  Bin b is [e_b, e_b+1), the
+ * last one [e_nb-1, e_nb]; elements outside the range and NaNs are not
+ * counted.  A block of bin indices is computed first, then counted into
+ * private counters with a spare bin for the elements not counted, so
+ * that neither loop branches.
+ */
+
+#ifndef VEC_HISTOGRAM_BLOCK
+#define VEC_HISTOGRAM_BLOCK 256	/* bin indices per block */
+#endif
+
+static void VEC_FUNC(histogram, count)(size_t *local, size_t nb, size_t s, size_t m, const int *index) {
+	size_t i, c;
+
+	if (s == 1) {
+		for (i = 0; i < m; ++i) {
+			++local[index[i]];
+		}
+	}
+	else {
+		for (i = 0, c = 0; i < m; ++i) {
+			++local[c * (nb + 1) + index[i]];
+			if (++c == s) {
+				c = 0;
+			}
+		}
+	}
+}
+
+static void VEC_FUNC(histogram, add)(size_t *counts, const size_t *local, size_t nb, size_t s) {
+	size_t b, c;
+
+	for (c = 0; c < s; ++c) {
+		for (b = 0; b < nb; ++b) {
+			counts[c * nb + b] += local[c * (nb + 1) + b];
+		}
+	}
+}
+
+int VEC_FUNC(histogram, uniform)(size_t *counts, size_t nb, VEC_REAL lo, VEC_REAL hi, size_t s, size_t n, const VEC_REAL *v) {
+	if (counts && nb > 0 && nb < (size_t)1 << 30 && lo < hi && s > 0 && n % s == 0 && (v || n == 0)) {
+		const size_t block = VEC_HISTOGRAM_BLOCK > s ? VEC_HISTOGRAM_BLOCK - VEC_HISTOGRAM_BLOCK % s : s;
+		const VEC_REAL scale = (VEC_REAL)nb / (hi - lo);
+		const VEC_REAL bins = (VEC_REAL)nb;
+		const int last = (int)nb - 1, none = (int)nb;
+		size_t *local = (size_t *)calloc((nb + 1) * s, sizeof(size_t));
+		int *index = (int *)malloc(block * sizeof(int));
+		size_t k, i;
+
+		if (!local || !index) {
+			free(local);
+			free(index);
+			vec_error_handler(1, VEC_FUNC_NAME(histogram, uniform) ": out of memory");
+			return 1;
+		}
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (k = 0; k < n; k += block) {
+			const size_t m = n - k < block ? n - k : block;
+			const VEC_REAL *p = v + k;
+			for (i = 0; i < m; ++i) {
+				const VEC_REAL x = p[i];
+				const VEC_REAL t = (x - lo) * scale;
+				/* t may round up to nb for x just below hi */
+				index[i] = t >= 0 && t < bins ? (int)t : x >= lo && x <= hi ? last : none;
+			}
+			VEC_FUNC(histogram, count)(local, nb, s, m, index);
+		}
+		VEC_FUNC(histogram, add)(counts, local, nb, s);
+		free(local);
+		free(index);
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(histogram, uniform) ": bad parameters");
+		return 1;
+	}
+}
+
+int VEC_FUNC(histogram, edges)(size_t *counts, size_t nb, const VEC_REAL *edges, size_t s, size_t n, const VEC_REAL *v) {
+	if (counts && nb > 0 && nb < (size_t)1 << 30 && edges && edges[0] < edges[nb] && s > 0 && n % s == 0 && (v || n == 0)) {
+		const size_t block = VEC_HISTOGRAM_BLOCK > s ? VEC_HISTOGRAM_BLOCK - VEC_HISTOGRAM_BLOCK % s : s;
+		const VEC_REAL lo = edges[0], hi = edges[nb];
+		size_t *local = (size_t *)calloc((nb + 1) * s, sizeof(size_t));
+		int *index = (int *)malloc(block * sizeof(int));
+		size_t k, i;
+
+		if (!local || !index) {
+			free(local);
+			free(index);
+			vec_error_handler(1, VEC_FUNC_NAME(histogram, edges) ": out of memory");
+			return 1;
+		}
+		vec_profile_begin(VEC_PROFILE_COMPUTE);
+		for (k = 0; k < n; k += block) {
+			const size_t m = n - k < block ? n - k : block;
+			const VEC_REAL *p = v + k;
+			for (i = 0; i < m; ++i) {
+				const VEC_REAL x = p[i];
+				if (x >= lo && x <= hi) {
+					/* the last edge not above x */
+					size_t first = 0, count = nb;
+					while (count > 1) {
+						size_t half = count / 2;
+						if (edges[first + half] <= x) {
+							first += half;
+							count -= half;
+						}
+						else {
+							count = half;
+						}
+					}
+					index[i] = (int)first;
+				}
+				else {
+					index[i] = (int)nb;
+				}
+			}
+			VEC_FUNC(histogram, count)(local, nb, s, m, index);
+		}
+		VEC_FUNC(histogram, add)(counts, local, nb, s);
+		free(local);
+		free(index);
+		vec_profile_end(VEC_PROFILE_COMPUTE, n, n * sizeof(VEC_REAL));
+		return 0;
+	}
+	else {
+		vec_error_handler(1, VEC_FUNC_NAME(histogram, edges) ": bad parameters");
+		return 1;
+	}
+}
+
+#undef VEC_FUNC_NAME
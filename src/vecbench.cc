@@ -0,0 +1,411 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <valarray>
+#include <vector>
+#include <time.h>
+#include "vec++.hh"
+#include "veckdtree.hh"
+
+static std::valarray<int> *sizes = 0;
+static std::valarray<int> *dimensions = 0;
+static int repetitions = 5;
+static int warmups = 1;
+static const char *filter = 0;
+
+void help() {
+  std::cerr << "usage: vecbench [-n{SIZES}] [-s{DIMENSIONS}] [-r{REPETITIONS}]\n"
+    "\t[-w{WARMUPS}] [-k{NAME}]\n"
+    "\tvecbench measures the vector stream readers, writers and vector\n"
+    "\toperations on synthetic data, and reports ns/element and GB/s.\n"
+    "\t-n{SIZES}: Numbers of elements, separated by ':'.\n"
+    "\t(Default: 1000:100000:1000000)\n"
+    "\t-s{DIMENSIONS}: Record dimensions, separated by ':'. (Default: 1:3:4)\n"
+    "\t-r{REPETITIONS}: Timed repetitions per case. (Default: 5)\n"
+    "\t-w{WARMUPS}: Untimed repetitions per case. (Default: 1)\n"
+    "\t-k{NAME}: Runs only the cases whose names contain {NAME}.\n";
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Deterministic pseudo-random numbers, so that runs are comparable.
+template <typename real> void fill_synthetic(std::vector<real> &v) {
+  unsigned long x = 12345;
+  for (size_t i = 0; i < v.size(); ++i) {
+    x = x * 1103515245UL + 12345UL;
+    v[i] = static_cast<real>(((x >> 16) & 0x7fff) / 327.68 - 50.0);
+  }
+}
+
+// One benchmark case; run() performs the measured operation once.
+class bench_case {
+public:
+  virtual ~bench_case() {
+  }
+  virtual void run() = 0;
+};
+
+// Times c and prints the mean and best ns/element, the throughput of the
+// best run for the given number of bytes read and written, and the
+// relative standard deviation.
+static void report(const std::string &name, size_t n, size_t s,
+		   size_t bytes, bench_case &c) {
+  if (filter && name.find(filter) == std::string::npos) {
+    return;
+  }
+  for (int i = 0; i < warmups; ++i) {
+    c.run();
+  }
+  std::vector<double> t(repetitions);
+  for (int i = 0; i < repetitions; ++i) {
+    double t0 = now();
+    c.run();
+    t[i] = now() - t0;
+  }
+  double sum = 0;
+  double min = t[0];
+  for (int i = 0; i < repetitions; ++i) {
+    sum += t[i];
+    if (t[i] < min) {
+      min = t[i];
+    }
+  }
+  double avr = sum / repetitions;
+  double sq = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    sq += (t[i] - avr) * (t[i] - avr);
+  }
+  double dev = repetitions > 1 ? std::sqrt(sq / (repetitions - 1)) : 0;
+  std::printf("%-36s %10lu %3lu %10.3f %10.3f %8.3f %6.1f%%\n",
+	      name.c_str(), static_cast<unsigned long>(n),
+	      static_cast<unsigned long>(s), avr * 1e9 / n, min * 1e9 / n,
+	      bytes / min * 1e-9, avr > 0 ? dev / avr * 100 : 0);
+  std::fflush(stdout);
+}
+
+template <typename real> class read_case : public bench_case {
+  FILE *_fin;
+  bool _binary;
+public:
+  read_case(FILE *fin, bool binary) : _fin(fin), _binary(binary) {
+  }
+  void run() {
+    size_t n;
+    real *v;
+    std::rewind(_fin);
+    if (_binary) {
+      pid::new_vector_binary(&n, &v, _fin);
+    }
+    else {
+      pid::new_vector(&n, &v, _fin);
+    }
+    pid::delete_vector(v);
+  }
+};
+
+template <typename real> class write_case : public bench_case {
+  FILE *_fout;
+  const std::vector<real> &_v;
+  size_t _s;
+  bool _binary;
+public:
+  write_case(FILE *fout, const std::vector<real> &v, size_t s, bool binary)
+    : _fout(fout), _v(v), _s(s), _binary(binary) {
+  }
+  void run() {
+    std::rewind(_fout);
+    if (_binary) {
+      pid::put_vector_binary(_v.size(), &_v[0], _fout);
+    }
+    else {
+      pid::put_vector(_v.size(), &_v[0], _s, _fout);
+    }
+    std::fflush(_fout);
+  }
+};
+
+template <typename real> class slice_case : public bench_case {
+  std::vector<real> &_a;
+  const std::vector<real> &_v;
+  size_t _s;
+public:
+  slice_case(std::vector<real> &a, const std::vector<real> &v, size_t s)
+    : _a(a), _v(v), _s(s) {
+  }
+  void run() {
+    pid::slice_vector(&_a[0], &_v[0], 0, _v.size() / _s, _s);
+  }
+};
+
+template <typename real> class add_case : public bench_case {
+  std::vector<real> &_a;
+  const std::vector<real> &_v1;
+  const std::vector<real> &_v2;
+  size_t _s;
+  bool _single;
+public:
+  add_case(std::vector<real> &a, const std::vector<real> &v1,
+	   const std::vector<real> &v2, size_t s, bool single)
+    : _a(a), _v1(v1), _v2(v2), _s(s), _single(single) {
+  }
+  void run() {
+    if (_single) {
+      pid::add_single_vector_to_multi_vector(&_a[0], _s, _s, &_v1[0],
+					     _v2.size(), &_v2[0]);
+    }
+    else {
+      pid::add_multi_vector_to_multi_vector(&_a[0], _s, _v1.size(), &_v1[0],
+					    _v2.size(), &_v2[0]);
+    }
+  }
+};
+
+template <typename real> class multiply_case : public bench_case {
+  std::vector<real> &_a;
+  const std::vector<real> &_m;
+  const std::vector<real> &_v;
+  size_t _s;
+  bool _single;
+public:
+  multiply_case(std::vector<real> &a, const std::vector<real> &m,
+		const std::vector<real> &v, size_t s, bool single)
+    : _a(a), _m(m), _v(v), _s(s), _single(single) {
+  }
+  void run() {
+    if (_single) {
+      pid::multiply_single_matrix_to_multi_vector(&_a[0], _s, _s * _s,
+						  &_m[0], _v.size(), &_v[0],
+						  0);
+    }
+    else {
+      pid::multiply_multi_matrix_to_multi_vector(&_a[0], _s, _m.size(),
+						 &_m[0], _v.size(), &_v[0],
+						 false);
+    }
+  }
+};
+
+class kdtree_build_case : public bench_case {
+  FILE *_fout;
+  const std::vector<double> &_v;
+  size_t _s;
+public:
+  kdtree_build_case(FILE *fout, const std::vector<double> &v, size_t s)
+    : _fout(fout), _v(v), _s(s) {
+  }
+  void run() {
+    std::rewind(_fout);
+    pid::kdtree::write(_v.size() / _s, _s, &_v[0], _fout);
+    std::fflush(_fout);
+  }
+};
+
+class kdtree_query_case : public bench_case {
+  const pid::kdtree &_tree;
+  const std::vector<double> &_q;
+  std::vector<pid::kdtree::neighbour> _result;
+public:
+  kdtree_query_case(const pid::kdtree &tree, const std::vector<double> &q)
+    : _tree(tree), _q(q) {
+  }
+  void run() {
+    size_t s = _tree.dimension();
+    for (size_t i = 0; i < _q.size(); i += s) {
+      _tree.nearest(&_q[i], 1, _result);
+    }
+  }
+};
+
+static size_t file_size(FILE *f) {
+  std::fseek(f, 0, SEEK_END);
+  size_t size = std::ftell(f);
+  std::rewind(f);
+  return size;
+}
+
+template <typename real> void run_cases(const char *type, size_t n,
+					size_t s) {
+  std::string t(type);
+  size_t e = sizeof(real);
+  n -= n % s;
+  if (n == 0) {
+    return;
+  }
+
+  std::vector<real> v1(n), v2(n), a(n), m(n * s);
+  fill_synthetic(v1);
+  fill_synthetic(v2);
+  fill_synthetic(m);
+
+  FILE *text = std::tmpfile();
+  FILE *binary = std::tmpfile();
+  if (!text || !binary) {
+    std::cerr << "vecbench: error: can't create temporary files\n";
+    std::exit(1);
+  }
+  pid::put_vector(n, &v1[0], s, text);
+  pid::put_vector_binary(n, &v1[0], binary);
+  std::fflush(text);
+  std::fflush(binary);
+  size_t text_bytes = file_size(text);
+  size_t binary_bytes = file_size(binary);
+
+  if (s == 1) {
+    read_case<real> rt(text, false);
+    report("new_" + t + "_vector (text)", n, s, text_bytes, rt);
+    read_case<real> rb(binary, true);
+    report("new_" + t + "_vector (binary)", n, s, binary_bytes, rb);
+  }
+  FILE *out = std::tmpfile();
+  write_case<real> wt(out, v1, s, false);
+  report("put_" + t + "_vector (text)", n, s, text_bytes, wt);
+  if (s == 1) {
+    write_case<real> wb(out, v1, s, true);
+    report("put_" + t + "_vector (binary)", n, s, binary_bytes, wb);
+  }
+  std::fclose(out);
+
+  slice_case<real> sl(a, v1, s);
+  report("slice_" + t + "_vector", n, s, 2 * (n / s) * e, sl);
+  add_case<real> am(a, v1, v2, s, false);
+  report("add_" + t + "_multi_vector", n, s, 3 * n * e, am);
+  add_case<real> as(a, v1, v2, s, true);
+  report("add_" + t + "_single_vector", n, s, 2 * n * e, as);
+  if (s > 1) {
+    multiply_case<real> mm(a, m, v1, s, false);
+    report("multiply_" + t + "_multi_matrix", n, s, (n * s + 2 * n) * e, mm);
+    multiply_case<real> ms(a, m, v1, s, true);
+    report("multiply_" + t + "_single_matrix", n, s, 2 * n * e, ms);
+  }
+
+  std::fclose(text);
+  std::fclose(binary);
+}
+
+// The k-d tree is built from and queried with points of dimension s.
+void run_kdtree_cases(size_t n, size_t s) {
+  n -= n % s;
+  if (n == 0) {
+    return;
+  }
+  std::vector<double> v(n), q(n);
+  fill_synthetic(v);
+  fill_synthetic(q);
+  std::reverse(q.begin(), q.end());
+
+  FILE *index = std::tmpfile();
+  if (!index) {
+    std::cerr << "vecbench: error: can't create temporary files\n";
+    std::exit(1);
+  }
+  kdtree_build_case b(index, v, s);
+  b.run();
+  report("kdtree_build", n, s, file_size(index) + n * sizeof(double), b);
+  pid::kdtree tree;
+  if (!tree.map(fileno(index))) {
+    std::cerr << "vecbench: error: can't map the k-d tree index\n";
+    std::exit(1);
+  }
+  kdtree_query_case kq(tree, q);
+  report("kdtree_nearest", n, s, n * sizeof(double), kq);
+  tree.unmap();
+  std::fclose(index);
+}
+
+void parse_option(char *option) {
+  switch (*option) {
+  case 'n':
+    delete sizes;
+    pid::parse_multiple_parameters(&sizes, pid::string_to_int(), option + 1);
+    break;
+  case 's':
+    delete dimensions;
+    pid::parse_multiple_parameters(&dimensions, pid::string_to_int(),
+				   option + 1);
+    break;
+  case 'r':
+    repetitions = std::atoi(option + 1);
+    if (repetitions < 1) {
+      repetitions = 1;
+    }
+    break;
+  case 'w':
+    warmups = std::atoi(option + 1);
+    break;
+  case 'k':
+    filter = option + 1;
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "vecbench: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  while (--argc) {
+    ++argv;
+    if (**argv == '-') {
+      parse_option(*argv + 1);
+    }
+    else {
+      std::cerr << "vecbench: warning: ignoring argument: " << *argv << '\n';
+    }
+  }
+  if (!sizes) {
+    char s[] = "1000:100000:1000000";
+    pid::parse_multiple_parameters(&sizes, pid::string_to_int(), s);
+  }
+  if (!dimensions) {
+    char s[] = "1:3:4";
+    pid::parse_multiple_parameters(&dimensions, pid::string_to_int(), s);
+  }
+
+  std::printf("%-36s %10s %3s %10s %10s %8s %7s\n", "case", "elements",
+	      "dim", "ns/elem", "best", "GB/s", "stddev");
+  for (size_t i = 0; i < sizes->size(); ++i) {
+    for (size_t j = 0; j < dimensions->size(); ++j) {
+      if ((*sizes)[i] <= 0 || (*dimensions)[j] <= 0) {
+	continue;
+      }
+      run_cases<double>("double", (*sizes)[i], (*dimensions)[j]);
+      run_cases<float>("float", (*sizes)[i], (*dimensions)[j]);
+      if ((*dimensions)[j] > 1) {
+	run_kdtree_cases((*sizes)[i], (*dimensions)[j]);
+      }
+    }
+  }
+  delete sizes;
+  delete dimensions;
+  return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "vecd.hh"
+
+void help() {
+  std::cerr << "usage: vecc {TOOL} [{OPTIONS}] [{FILENAMES}]\n"
+    "\tvecc runs {TOOL} (vcat, slice, add, ...) in the resident server\n"
+    "\tvecd, with the same options, files, stdin, stdout and stderr as\n"
+    "\tthe tool itself.  If vecd is not running, vecc runs the tool\n"
+    "\tdirectly.\n"
+    "\tThe server listens on $VECD_SOCKET, $XDG_RUNTIME_DIR/vecd, or\n"
+    "\t/tmp/vecd-{UID}/socket.  A server of another user is not used.\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    help();
+    std::exit(0);
+  }
+
+  struct sockaddr_un addr;
+  std::string path = pid::vecd_socket_path();
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  bool connected = s >= 0 && pid::vecd_socket_address(path, &addr) &&
+    connect(s, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+  if (connected && !pid::vecd_peer_is_owner(s)) {
+    std::cerr << "vecc: warning: not using the server of another user on: "
+	      << path << '\n';
+    connected = false;
+  }
+  if (!connected) {
+    execvp(argv[1], argv + 1);
+    std::cerr << "vecc: error: can't run: " << argv[1] << '\n';
+    std::exit(127);
+  }
+
+  std::vector<std::string> strings;
+  std::vector<char> cwd(4096);
+  if (!getcwd(&cwd[0], cwd.size())) {
+    std::cerr << "vecc: error: can't get the working directory\n";
+    std::exit(1);
+  }
+  strings.push_back(&cwd[0]);
+  for (int i = 1; i < argc; ++i) {
+    strings.push_back(argv[i]);
+  }
+  int fds[pid::vecd_job_fds] = { 0, 1, 2 };
+  if (!pid::vecd_send_job(s, strings, fds)) {
+    std::cerr << "vecc: error: can't send the job to vecd\n";
+    std::exit(1);
+  }
+
+  int code;
+  if (!pid::vecd_read_all(s, reinterpret_cast<char *>(&code), sizeof(code))) {
+    std::cerr << "vecc: error: vecd closed the connection\n";
+    std::exit(1);
+  }
+  close(s);
+  return code;
+}
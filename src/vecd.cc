@@ -0,0 +1,366 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <valarray>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "vec++.hh"
+#include "vecd.hh"
+#include "vecexpr.hh"
+#include "veckdtree.hh"
+#include "vecpool.hh"
+
+// The tools are compiled into the server as they are.  Each one lives in
+// its own namespace, and its main() is renamed so that the server can
+// call it.  All headers the tools include are included above, so their
+// own #include lines are no-ops here.
+#define main vcat_main
+namespace vcat_tool {
+#include "vcat.cc"
+}
+#undef main
+#define main vectorize_main
+namespace vectorize_tool {
+#include "vectorize.cc"
+}
+#undef main
+#define main slice_main
+namespace slice_tool {
+#include "slice.cc"
+}
+#undef main
+#define main gslice_main
+namespace gslice_tool {
+#include "gslice.cc"
+}
+#undef main
+#define main add_main
+namespace add_tool {
+#include "add.cc"
+}
+#undef main
+#define main multiply_main
+namespace multiply_tool {
+#include "multiply.cc"
+}
+#undef main
+#define main statistics_main
+namespace statistics_tool {
+#include "statistics.cc"
+}
+#undef main
+#define main splice_main
+namespace splice_tool {
+#include "splice.cc"
+}
+#undef main
+#define main knn_main
+namespace knn_tool {
+#include "knn.cc"
+}
+#undef main
+#define main kdtree_main
+namespace kdtree_tool {
+#include "kdtree.cc"
+}
+#undef main
+#define main kdquery_main
+namespace kdquery_tool {
+#include "kdquery.cc"
+}
+#undef main
+#define main scan_main
+namespace scan_tool {
+#include "scan.cc"
+}
+#undef main
+#define main filter_main
+namespace filter_tool {
+#include "filter.cc"
+}
+#undef main
+#define main resample_main
+namespace resample_tool {
+#include "resample.cc"
+}
+#undef main
+#define main histogram_main
+namespace histogram_tool {
+#include "histogram.cc"
+}
+#undef main
+#define main vmap_main
+namespace vmap_tool {
+#include "vmap.cc"
+}
+#undef main
+
+struct tool {
+  const char *name;
+  int (*main)(int argc, char **argv);
+};
+
+static const tool tools[] = {
+  { "vcat", vcat_tool::vcat_main },
+  { "vectorize", vectorize_tool::vectorize_main },
+  { "slice", slice_tool::slice_main },
+  { "gslice", gslice_tool::gslice_main },
+  { "add", add_tool::add_main },
+  { "multiply", multiply_tool::multiply_main },
+  { "statistics", statistics_tool::statistics_main },
+  { "splice", splice_tool::splice_main },
+  { "knn", knn_tool::knn_main },
+  { "kdtree", kdtree_tool::kdtree_main },
+  { "kdquery", kdquery_tool::kdquery_main },
+  { "scan", scan_tool::scan_main },
+  { "filter", filter_tool::filter_main },
+  { "resample", resample_tool::resample_main },
+  { "histogram", histogram_tool::histogram_main },
+  { "vmap", vmap_tool::vmap_main },
+  { 0, 0 }
+};
+
+static bool verbose = false;
+static std::string socket_path;
+static int child_pipe[2];
+
+void help() {
+  std::cerr << "usage: vecd [-v] [-S{SOCKET}]\n"
+    "\tvecd keeps the vector stream tools resident and runs the jobs sent\n"
+    "\tby vecc, so that each job costs a fork instead of a process start.\n"
+    "\t-v: Verbose mode. Logs each job to stderr.\n"
+    "\t-S{SOCKET}: Listens on {SOCKET}. (Default: $VECD_SOCKET,\n"
+    "\t$XDG_RUNTIME_DIR/vecd, or /tmp/vecd-{UID}/socket)\n"
+    "\tOnly jobs of the same user are run.\n";
+}
+
+static void on_child(int) {
+  int e = errno;
+  char c = 0;
+  if (write(child_pipe[1], &c, 1) < 0) {
+    // the pipe is full; a wake-up is pending anyway
+  }
+  errno = e;
+}
+
+static void on_terminate(int) {
+  unlink(socket_path.c_str());
+  _exit(0);
+}
+
+// Runs in the forked child: takes over the client's descriptors and
+// working directory and calls the tool.  Never returns.
+static void run_job(int sock) {
+  std::vector<std::string> strings;
+  int fds[pid::vecd_job_fds];
+
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  close(child_pipe[0]);
+  close(child_pipe[1]);
+  if (!pid::vecd_receive_job(sock, &strings, fds) || strings.size() < 2) {
+    std::cerr << "vecd: warning: bad job\n";
+    _exit(125);
+  }
+  close(sock);
+  for (int i = 0; i < pid::vecd_job_fds; ++i) {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  if (chdir(strings[0].c_str()) != 0) {
+    std::cerr << "vecd: warning: can't change directory to: " << strings[0]
+	      << '\n';
+  }
+
+  // The tools would write to the server's $VEC_OUTPUT, not the client's
+  // stdout.
+  unsetenv("VEC_OUTPUT");
+
+  const tool *t = tools;
+  while (t->name && strings[1] != t->name) {
+    ++t;
+  }
+  if (!t->name) {
+    std::cerr << "vecd: error: unknown tool: " << strings[1] << '\n';
+    std::exit(127);
+  }
+  std::vector<char *> argv;
+  for (size_t i = 1; i < strings.size(); ++i) {
+    argv.push_back(&strings[i][0]);
+  }
+  argv.push_back(0);
+  std::exit(t->main(argv.size() - 1, &argv[0]));
+}
+
+// Sends the exit status of each finished job to its client.
+static void reap(std::map<pid_t, int> &jobs) {
+  int status;
+  pid_t p;
+  while ((p = waitpid(-1, &status, WNOHANG)) > 0) {
+    std::map<pid_t, int>::iterator j = jobs.find(p);
+    if (j == jobs.end()) {
+      continue;
+    }
+    int code = WIFEXITED(status) ? WEXITSTATUS(status)
+      : 128 + WTERMSIG(status);
+    if (verbose) {
+      std::cerr << "vecd: job " << p << " exited with " << code << '\n';
+    }
+    pid::vecd_write_all(j->second, reinterpret_cast<char *>(&code),
+			sizeof(code));
+    close(j->second);
+    jobs.erase(j);
+  }
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case 'v':
+    verbose = true;
+    break;
+  case 'S':
+    socket_path = option + 1;
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "vecd: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  socket_path = pid::vecd_socket_path();
+  while (--argc) {
+    ++argv;
+    if (**argv == '-') {
+      parse_option(*argv + 1);
+    }
+    else {
+      std::cerr << "vecd: warning: ignoring argument: " << *argv << '\n';
+    }
+  }
+
+  struct sockaddr_un addr;
+  if (!pid::vecd_socket_address(socket_path, &addr)) {
+    std::cerr << "vecd: error: socket path too long: " << socket_path << '\n';
+    std::exit(1);
+  }
+  if (!pid::vecd_make_socket_directory(socket_path)) {
+    std::cerr << "vecd: error: not a private directory: "
+	      << pid::vecd_private_directory() << '\n';
+    std::exit(1);
+  }
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socket_path.c_str());
+  if (s < 0 || bind(s, reinterpret_cast<struct sockaddr *>(&addr),
+		    sizeof(addr)) != 0 || listen(s, 64) != 0) {
+    std::cerr << "vecd: error: can't listen on: " << socket_path << '\n';
+    std::exit(1);
+  }
+  if (pipe(child_pipe) != 0) {
+    std::cerr << "vecd: error: can't create pipe\n";
+    std::exit(1);
+  }
+  fcntl(child_pipe[0], F_SETFL, O_NONBLOCK);
+  fcntl(child_pipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(s, F_SETFD, FD_CLOEXEC);
+
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_child;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, 0);
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_terminate);
+  signal(SIGTERM, on_terminate);
+  if (verbose) {
+    std::cerr << "vecd: listening on " << socket_path << '\n';
+  }
+
+  // The server never touches its own stdio buffers, so the children
+  // start with clean ones.
+  std::map<pid_t, int> jobs;
+  for (;;) {
+    struct pollfd p[2];
+    p[0].fd = s;
+    p[0].events = POLLIN;
+    p[1].fd = child_pipe[0];
+    p[1].events = POLLIN;
+    if (poll(p, 2, -1) < 0) {
+      if (errno == EINTR) {
+	continue;
+      }
+      std::cerr << "vecd: error: poll failed\n";
+      break;
+    }
+    if (p[1].revents) {
+      char buf[64];
+      while (read(child_pipe[0], buf, sizeof(buf)) > 0) {
+      }
+      reap(jobs);
+    }
+    if (p[0].revents) {
+      int c = accept(s, 0, 0);
+      if (c < 0) {
+	continue;
+      }
+      if (!pid::vecd_peer_is_owner(c)) {
+	std::cerr << "vecd: warning: refusing a job of another user\n";
+	close(c);
+	continue;
+      }
+      pid_t child = fork();
+      if (child == 0) {
+	close(s);
+	for (std::map<pid_t, int>::iterator j = jobs.begin(); j != jobs.end();
+	     ++j) {
+	  close(j->second);
+	}
+	run_job(c);
+      }
+      else if (child < 0) {
+	std::cerr << "vecd: warning: can't fork\n";
+	close(c);
+      }
+      else {
+	jobs[child] = c;
+      }
+    }
+  }
+  unlink(socket_path.c_str());
+  return 1;
+}
@@ -0,0 +1,214 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Wire protocol shared by the resident server vecd and its client vecc.
+//
+// A job is one message on a Unix domain stream socket: a 4-byte length
+// followed by NUL-terminated strings (working directory, tool name,
+// arguments).  The client's stdin, stdout and stderr travel with the
+// message as SCM_RIGHTS.  The server answers with the 4-byte exit status
+// of the job (128 + signal number if the job was killed).
+
+#ifndef __VECD_HH
+#define __VECD_HH
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pid {
+
+  const int vecd_job_fds = 3;
+  const size_t vecd_maximum_job_size = 65536;
+
+  // Where the default socket goes without $XDG_RUNTIME_DIR.
+  inline std::string vecd_private_directory() {
+    char s[64];
+    std::sprintf(s, "/tmp/vecd-%ld", static_cast<long>(getuid()));
+    return s;
+  }
+
+  // $VECD_SOCKET, $XDG_RUNTIME_DIR/vecd, or /tmp/vecd-{UID}/socket.
+  inline std::string vecd_socket_path() {
+    const char *e = std::getenv("VECD_SOCKET");
+    if (e && *e) {
+      return e;
+    }
+    const char *r = std::getenv("XDG_RUNTIME_DIR");
+    if (r && *r) {
+      return std::string(r) + "/vecd";
+    }
+    return vecd_private_directory() + "/socket";
+  }
+
+  // Creates the private directory if path is in it, and checks that it
+  // is a directory of this user that nobody else can enter.
+  inline bool vecd_make_socket_directory(const std::string &path) {
+    std::string d = vecd_private_directory();
+    if (path.compare(0, d.size() + 1, d + '/') != 0) {
+      return true;
+    }
+    if (mkdir(d.c_str(), 0700) != 0 && errno != EEXIST) {
+      return false;
+    }
+    struct stat st;
+    return lstat(d.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+      st.st_uid == getuid() && (st.st_mode & 077) == 0;
+  }
+
+  // Whether the other end of sock runs as this user.  The descriptors
+  // of a job must only go to, or come from, the same user.
+  inline bool vecd_peer_is_owner(int sock) {
+    struct ucred cred;
+    socklen_t length = sizeof(cred);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 &&
+      cred.uid == getuid();
+  }
+
+  inline bool vecd_socket_address(const std::string &path,
+				  struct sockaddr_un *addr) {
+    if (path.size() >= sizeof(addr->sun_path)) {
+      return false;
+    }
+    std::memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    std::strcpy(addr->sun_path, path.c_str());
+    return true;
+  }
+
+  inline bool vecd_write_all(int sock, const char *p, size_t n) {
+    while (n > 0) {
+      ssize_t r = write(sock, p, n);
+      if (r < 0 && errno == EINTR) {
+	continue;
+      }
+      if (r <= 0) {
+	return false;
+      }
+      p += r;
+      n -= r;
+    }
+    return true;
+  }
+
+  inline bool vecd_read_all(int sock, char *p, size_t n) {
+    while (n > 0) {
+      ssize_t r = read(sock, p, n);
+      if (r < 0 && errno == EINTR) {
+	continue;
+      }
+      if (r <= 0) {
+	return false;
+      }
+      p += r;
+      n -= r;
+    }
+    return true;
+  }
+
+  inline bool vecd_send_job(int sock, const std::vector<std::string> &strings,
+			    const int *fds) {
+    std::string payload;
+    for (size_t i = 0; i < strings.size(); ++i) {
+      payload += strings[i];
+      payload += '\0';
+    }
+    unsigned int n = payload.size();
+    if (n > vecd_maximum_job_size) {
+      return false;
+    }
+
+    // The length goes with the descriptors; the strings follow.
+    struct iovec iov;
+    iov.iov_base = &n;
+    iov.iov_len = sizeof(n);
+    char control[CMSG_SPACE(sizeof(int) * vecd_job_fds)];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * vecd_job_fds);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * vecd_job_fds);
+    ssize_t r;
+    do {
+      r = sendmsg(sock, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r != sizeof(n)) {
+      return false;
+    }
+    return vecd_write_all(sock, payload.data(), payload.size());
+  }
+
+  inline bool vecd_receive_job(int sock, std::vector<std::string> *strings,
+			       int *fds) {
+    unsigned int n;
+    struct iovec iov;
+    iov.iov_base = &n;
+    iov.iov_len = sizeof(n);
+    char control[CMSG_SPACE(sizeof(int) * vecd_job_fds)];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t r;
+    do {
+      r = recvmsg(sock, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (r != sizeof(n) || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	cmsg->cmsg_type != SCM_RIGHTS ||
+	cmsg->cmsg_len != CMSG_LEN(sizeof(int) * vecd_job_fds)) {
+      return false;
+    }
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * vecd_job_fds);
+    if (n == 0 || n > vecd_maximum_job_size) {
+      return false;
+    }
+
+    std::vector<char> payload(n);
+    if (!vecd_read_all(sock, &payload[0], n) || payload[n - 1] != '\0') {
+      return false;
+    }
+    strings->clear();
+    for (size_t i = 0; i < n; i += strings->back().size() + 1) {
+      strings->push_back(&payload[i]);
+    }
+    return true;
+  }
+
+}
+
+#endif
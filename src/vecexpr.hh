@@ -0,0 +1,610 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Element-wise expressions over vectors, for vmap.
+//
+// An expression is compiled once into a program for a stack machine
+// whose values are blocks of elements rather than single elements.
+// Each instruction runs one tight loop over a block, so decoding costs
+// once per block, and the loops are plain array arithmetic that the
+// compiler vectorizes.
+//
+// Grammar (lowest precedence first):
+//   list    := expr {',' expr}
+//   expr    := compare ['?' expr ':' expr]
+//   compare := sum [('<' | '<=' | '>' | '>=' | '==' | '!=') sum]
+//   sum     := product {('+' | '-') product}
+//   product := unary {('*' | '/') unary}
+//   unary   := '-' unary | power
+//   power   := primary ['^' unary]
+//   primary := number | 'pi' | input ['[' component ']']
+//            | function '(' expr {',' expr} ')' | '(' expr ')'
+// The inputs are the letters a to z, one per file.  A bare input stands
+// for the component of its record that the expression computes.
+
+#ifndef __VECEXPR_HH
+#define __VECEXPR_HH
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace pid {
+
+  class expression {
+  public:
+    enum opcode {
+      op_constant, op_input,
+      op_negate, op_abs, op_sqrt, op_exp, op_log, op_log10, op_sin, op_cos,
+      op_tan, op_asin, op_acos, op_atan, op_floor, op_ceil, op_round,
+      op_add, op_subtract, op_multiply, op_divide, op_pow, op_atan2,
+      op_hypot, op_min, op_max, op_less, op_less_equal, op_greater,
+      op_greater_equal, op_equal, op_not_equal,
+      op_select
+    };
+
+    struct instruction {
+      opcode op;
+      size_t input;		// op_input: the input (0 for a)
+      size_t component;		// op_input: the component, or bare
+      size_t constant;		// op_constant: the index of its block
+      double value;		// op_constant
+    };
+
+    static const size_t bare = static_cast<size_t>(-1);
+    static const size_t block = 256;
+
+    // Number of operands.
+    static int arity(opcode op) {
+      return op <= op_input ? 0 : op < op_add ? 1 : op < op_select ? 2 : 3;
+    }
+
+  private:
+    std::vector<std::vector<instruction> > _programs;
+    size_t _depth;
+    size_t _constants;
+    size_t _inputs;
+    std::vector<bool> _bare_inputs;
+    bool _bare;
+    bool _indexed;
+
+    const char *_text;
+    const char *_p;
+    std::string _error;
+    std::vector<instruction> *_code;
+
+    void fail(const std::string &message) {
+      if (_error.empty()) {
+	char column[32];
+	std::sprintf(column, " at column %ld",
+		     static_cast<long>(_p - _text + 1));
+	_error = message + column;
+      }
+    }
+
+    void skip_space() {
+      while (std::isspace(static_cast<unsigned char>(*_p))) {
+	++_p;
+      }
+    }
+
+    bool accept(const char *token) {
+      skip_space();
+      size_t n = std::strlen(token);
+      if (std::strncmp(_p, token, n) != 0) {
+	return false;
+      }
+      // "<" is not the start of "<="
+      if (n == 1 && (*token == '<' || *token == '>' || *token == '=' ||
+		     *token == '!') && _p[1] == '=') {
+	return false;
+      }
+      _p += n;
+      return true;
+    }
+
+    void expect(const char *token) {
+      if (!accept(token)) {
+	fail(std::string("expected '") + token + "'");
+      }
+    }
+
+    void emit_constant(double value) {
+      instruction i = { op_constant, 0, 0, 0, value };
+      _code->push_back(i);
+    }
+
+    // Emits op, or folds it into a constant if its operands are.
+    void emit(opcode op) {
+      int k = arity(op);
+      std::vector<instruction> &code = *_code;
+      bool folded = code.size() >= static_cast<size_t>(k);
+      for (int j = 1; folded && j <= k; ++j) {
+	folded = code[code.size() - j].op == op_constant;
+      }
+      if (folded) {
+	double x[3] = { 0, 0, 0 }, a;
+	for (int j = 0; j < k; ++j) {
+	  x[j] = code[code.size() - k + j].value;
+	}
+	apply<1>(op, &a, &x[0], &x[1], &x[2]);
+	code.resize(code.size() - k);
+	emit_constant(a);
+	return;
+      }
+      instruction i = { op, 0, 0, 0, 0 };
+      code.push_back(i);
+    }
+
+    void parse_primary() {
+      skip_space();
+      if (std::isdigit(static_cast<unsigned char>(*_p)) || *_p == '.') {
+	char *end;
+	double value = std::strtod(_p, &end);
+	if (end == _p) {
+	  fail("bad number");
+	  return;
+	}
+	_p = end;
+	emit_constant(value);
+	return;
+      }
+      if (accept("(")) {
+	parse_expression();
+	expect(")");
+	return;
+      }
+      const char *start = _p;
+      while (std::islower(static_cast<unsigned char>(*_p)) ||
+	     std::isdigit(static_cast<unsigned char>(*_p))) {
+	++_p;
+      }
+      std::string name(start, _p);
+      if (name.empty()) {
+	fail(*_p ? "unexpected '" + std::string(1, *_p) + "'"
+	     : std::string("unexpected end"));
+	return;
+      }
+      if (name == "pi") {
+	emit_constant(M_PI);
+	return;
+      }
+      skip_space();
+      if (name.size() == 1 && *_p != '(') {
+	instruction i = { op_input, static_cast<size_t>(name[0] - 'a'), bare,
+			  0, 0 };
+	if (accept("[")) {
+	  skip_space();
+	  char *end;
+	  long c = std::strtol(_p, &end, 10);
+	  if (end == _p || c < 0) {
+	    fail("bad component");
+	    return;
+	  }
+	  _p = end;
+	  expect("]");
+	  i.component = c;
+	  _indexed = true;
+	}
+	else {
+	  _bare = true;
+	}
+	if (i.input + 1 > _inputs) {
+	  _inputs = i.input + 1;
+	  _bare_inputs.resize(_inputs);
+	}
+	if (i.component == bare) {
+	  _bare_inputs[i.input] = true;
+	}
+	_code->push_back(i);
+	return;
+      }
+      parse_call(name);
+    }
+
+    void parse_call(const std::string &name) {
+      static const struct {
+	const char *name;
+	opcode op;
+      } functions[] = {
+	{ "abs", op_abs }, { "sqrt", op_sqrt }, { "exp", op_exp },
+	{ "log", op_log }, { "log10", op_log10 }, { "sin", op_sin },
+	{ "cos", op_cos }, { "tan", op_tan }, { "asin", op_asin },
+	{ "acos", op_acos }, { "atan", op_atan }, { "floor", op_floor },
+	{ "ceil", op_ceil }, { "round", op_round }, { "pow", op_pow },
+	{ "atan2", op_atan2 }, { "hypot", op_hypot }, { "min", op_min },
+	{ "max", op_max }, { "clamp", op_select }, { 0, op_constant }
+      };
+      size_t f = 0;
+      while (functions[f].name && name != functions[f].name) {
+	++f;
+      }
+      if (!functions[f].name) {
+	fail("unknown function '" + name + "'");
+	return;
+      }
+      opcode op = functions[f].op;
+      int k = arity(op);
+      expect("(");
+      for (int j = 0; j < k; ++j) {
+	if (j > 0) {
+	  expect(",");
+	}
+	parse_expression();
+	if (op == op_select && j == 1) {
+	  // clamp(x, lo, hi) is min(max(x, lo), hi)
+	  emit(op_max);
+	}
+      }
+      expect(")");
+      emit(op == op_select ? op_min : op);
+    }
+
+    void parse_power() {
+      parse_primary();
+      if (accept("^")) {
+	parse_unary();
+	emit(op_pow);
+      }
+    }
+
+    void parse_unary() {
+      if (accept("-")) {
+	parse_unary();
+	emit(op_negate);
+      }
+      else {
+	parse_power();
+      }
+    }
+
+    void parse_product() {
+      parse_unary();
+      for (;;) {
+	if (accept("*")) {
+	  parse_unary();
+	  emit(op_multiply);
+	}
+	else if (accept("/")) {
+	  parse_unary();
+	  emit(op_divide);
+	}
+	else {
+	  return;
+	}
+      }
+    }
+
+    void parse_sum() {
+      parse_product();
+      for (;;) {
+	if (accept("+")) {
+	  parse_product();
+	  emit(op_add);
+	}
+	else if (accept("-")) {
+	  parse_product();
+	  emit(op_subtract);
+	}
+	else {
+	  return;
+	}
+      }
+    }
+
+    void parse_compare() {
+      static const struct {
+	const char *token;
+	opcode op;
+      } compares[] = {
+	{ "<=", op_less_equal }, { ">=", op_greater_equal },
+	{ "==", op_equal }, { "!=", op_not_equal }, { "<", op_less },
+	{ ">", op_greater }, { 0, op_constant }
+      };
+      parse_sum();
+      for (size_t c = 0; compares[c].token; ++c) {
+	if (accept(compares[c].token)) {
+	  parse_sum();
+	  emit(compares[c].op);
+	  return;
+	}
+      }
+    }
+
+    void parse_expression() {
+      if (!_error.empty()) {
+	return;
+      }
+      parse_compare();
+      if (accept("?")) {
+	parse_expression();
+	expect(":");
+	parse_expression();
+	emit(op_select);
+      }
+    }
+
+    // Numbers the constant blocks and finds the depth of the stack.
+    void finish() {
+      _depth = 0;
+      _constants = 0;
+      for (size_t p = 0; p < _programs.size(); ++p) {
+	size_t sp = 0;
+	for (size_t i = 0; i < _programs[p].size(); ++i) {
+	  instruction &in = _programs[p][i];
+	  if (in.op == op_constant) {
+	    in.constant = _constants++;
+	  }
+	  sp += 1 - arity(in.op);
+	  if (sp > _depth) {
+	    _depth = sp;
+	  }
+	}
+      }
+    }
+
+  public:
+    expression() : _depth(0), _constants(0), _inputs(0), _bare(false),
+		   _indexed(false) {}
+
+    // Compiles a list of expressions; on failure, returns false and
+    // leaves a message in *error.
+    bool compile(const char *text, std::string *error) {
+      _programs.clear();
+      _inputs = 0;
+      _bare_inputs.clear();
+      _bare = _indexed = false;
+      _text = _p = text;
+      _error.clear();
+      do {
+	_programs.push_back(std::vector<instruction>());
+	_code = &_programs.back();
+	parse_expression();
+      } while (_error.empty() && accept(","));
+      skip_space();
+      if (*_p) {
+	fail("unexpected '" + std::string(1, *_p) + "'");
+      }
+      if (!_error.empty()) {
+	*error = _error;
+	return false;
+      }
+      finish();
+      return true;
+    }
+
+    // Builds the single expression x0 op x1 op ... op x(n-1) of bare
+    // inputs, evaluated from the left, with x0 negated if asked.
+    void reduce(opcode op, size_t n, bool negate_first) {
+      _programs.assign(1, std::vector<instruction>());
+      _inputs = n;
+      _bare_inputs.assign(n, true);
+      _bare = true;
+      _indexed = false;
+      for (size_t k = 0; k < n; ++k) {
+	instruction in = { op_input, k, bare, 0, 0 };
+	instruction o = { k > 0 ? op : op_negate, 0, 0, 0, 0 };
+	_programs[0].push_back(in);
+	if (k > 0 || negate_first) {
+	  _programs[0].push_back(o);
+	}
+      }
+      finish();
+    }
+
+    // Number of expressions in the list.
+    size_t size() const { return _programs.size(); }
+    const std::vector<instruction> &program(size_t p) const {
+      return _programs[p];
+    }
+    // Values on the stack at most, and constant blocks.
+    size_t depth() const { return _depth; }
+    size_t constants() const { return _constants; }
+    // Number of inputs, up to the last letter used.
+    size_t inputs() const { return _inputs; }
+    // Whether bare inputs, and inputs with components, are used.
+    bool has_bare_inputs() const { return _bare; }
+    bool has_indexed_inputs() const { return _indexed; }
+    bool has_bare_input(size_t k) const {
+      return k < _inputs && _bare_inputs[k];
+    }
+
+    // a[i] = op(x[i], y[i], z[i]) for i in [0, n); a is none of the
+    // operands.  n is a constant, as gcc -O2 vectorizes only the loops
+    // it needs no remainder for.
+    template <size_t n, typename real> static void apply(opcode op,
+							 real *__restrict a,
+							 const real *__restrict x,
+							 const real *__restrict y,
+							 const real *__restrict z) {
+      size_t i;
+      switch (op) {
+#define VEC_EXPR_LOOP(e) for (i = 0; i < n; ++i) { a[i] = (e); } break
+      case op_negate: VEC_EXPR_LOOP(-x[i]);
+      case op_abs: VEC_EXPR_LOOP(std::fabs(x[i]));
+      case op_sqrt: VEC_EXPR_LOOP(std::sqrt(x[i]));
+      case op_exp: VEC_EXPR_LOOP(std::exp(x[i]));
+      case op_log: VEC_EXPR_LOOP(std::log(x[i]));
+      case op_log10: VEC_EXPR_LOOP(std::log10(x[i]));
+      case op_sin: VEC_EXPR_LOOP(std::sin(x[i]));
+      case op_cos: VEC_EXPR_LOOP(std::cos(x[i]));
+      case op_tan: VEC_EXPR_LOOP(std::tan(x[i]));
+      case op_asin: VEC_EXPR_LOOP(std::asin(x[i]));
+      case op_acos: VEC_EXPR_LOOP(std::acos(x[i]));
+      case op_atan: VEC_EXPR_LOOP(std::atan(x[i]));
+      case op_floor: VEC_EXPR_LOOP(std::floor(x[i]));
+      case op_ceil: VEC_EXPR_LOOP(std::ceil(x[i]));
+      case op_round: VEC_EXPR_LOOP(std::round(x[i]));
+      case op_add: VEC_EXPR_LOOP(x[i] + y[i]);
+      case op_subtract: VEC_EXPR_LOOP(x[i] - y[i]);
+      case op_multiply: VEC_EXPR_LOOP(x[i] * y[i]);
+      case op_divide: VEC_EXPR_LOOP(x[i] / y[i]);
+      case op_pow: VEC_EXPR_LOOP(std::pow(x[i], y[i]));
+      case op_atan2: VEC_EXPR_LOOP(std::atan2(x[i], y[i]));
+      case op_hypot: VEC_EXPR_LOOP(std::hypot(x[i], y[i]));
+      case op_min: VEC_EXPR_LOOP(y[i] < x[i] ? y[i] : x[i]);
+      case op_max: VEC_EXPR_LOOP(x[i] < y[i] ? y[i] : x[i]);
+      case op_less: VEC_EXPR_LOOP(x[i] < y[i]);
+      case op_less_equal: VEC_EXPR_LOOP(x[i] <= y[i]);
+      case op_greater: VEC_EXPR_LOOP(x[i] > y[i]);
+      case op_greater_equal: VEC_EXPR_LOOP(x[i] >= y[i]);
+      case op_equal: VEC_EXPR_LOOP(x[i] == y[i]);
+      case op_not_equal: VEC_EXPR_LOOP(x[i] != y[i]);
+      case op_select:
+	// both loaded first, so that the loop has no branch
+	for (i = 0; i < n; ++i) {
+	  real u = y[i], w = z[i];
+	  a[i] = x[i] != 0 ? u : w;
+	}
+	break;
+#undef VEC_EXPR_LOOP
+      default:
+	break;
+      }
+    }
+  };
+
+  // Runs the programs of an expression over blocks of records.  Holds the
+  // stack and the constant blocks, so each thread needs its own.
+  template <typename real> class expression_evaluator {
+    const expression &_e;
+    std::vector<real> _constants;
+    std::vector<real> _stack;
+    std::vector<const real *> _values;
+
+  public:
+    explicit expression_evaluator(const expression &e)
+      : _e(e), _constants(e.constants() * expression::block),
+	_stack(2 * e.depth() * expression::block), _values(e.depth()) {
+      for (size_t p = 0; p < e.size(); ++p) {
+	const std::vector<expression::instruction> &code = e.program(p);
+	for (size_t i = 0; i < code.size(); ++i) {
+	  if (code[i].op == expression::op_constant) {
+	    std::fill_n(&_constants[code[i].constant * expression::block],
+			expression::block, static_cast<real>(code[i].value));
+	  }
+	}
+      }
+    }
+
+  private:
+    // Evaluates program p on n elements and writes the results to a[0],
+    // a[stride], ...  load(in, r, m, t) returns the elements [r, r + m)
+    // of the input of instruction in, either in place or copied to t.
+    template <typename Load> void run(size_t p, size_t n, Load load, real *a,
+				      size_t stride) {
+      const std::vector<expression::instruction> &code = _e.program(p);
+      const size_t B = expression::block;
+      for (size_t r = 0; r < n; r += B) {
+	size_t m = std::min(B, n - r);
+	size_t sp = 0;
+	for (size_t i = 0; i < code.size(); ++i) {
+	  const expression::instruction &in = code[i];
+	  switch (in.op) {
+	  case expression::op_constant:
+	    _values[sp++] = &_constants[in.constant * B];
+	    break;
+	  case expression::op_input:
+	    _values[sp] = load(in, r, m, &_stack[2 * B * sp]);
+	    ++sp;
+	    break;
+	  default: {
+	    int k = expression::arity(in.op);
+	    sp -= k;
+	    // Each slot has two blocks; a result goes to the one its first
+	    // operand is not in, so that no operand overlaps it.
+	    real *slot = &_stack[2 * B * sp];
+	    const real *x = _values[sp];
+	    real *t = x == slot ? slot + B : slot;
+	    // A short block is computed whole, beyond its m elements.
+	    expression::apply<expression::block>(in.op, t, x,
+						 k > 1 ? _values[sp + 1] : x,
+						 k > 2 ? _values[sp + 2] : x);
+	    _values[sp++] = t;
+	    break;
+	  }
+	  }
+	}
+	const real *v = _values[0];
+	real *o = a + r * stride;
+	for (size_t j = 0; j < m; ++j) {
+	  o[j * stride] = v[j];
+	}
+      }
+    }
+
+  public:
+    // Evaluates program p on records [first, first + n) and writes the
+    // results to a[0], a[stride], ...  Input k has records of sizes[k]
+    // elements at inputs[k]; its bare references are to component c.
+    void run(size_t p, size_t c, const real *const *inputs,
+	     const size_t *sizes, size_t first, size_t n, real *a,
+	     size_t stride) {
+      run(p, n, [&](const expression::instruction &in, size_t r, size_t m,
+		    real *t) -> const real * {
+	    size_t s = sizes[in.input];
+	    size_t l = in.component == expression::bare ? c : in.component;
+	    const real *v = inputs[in.input] + (first + r) * s + l;
+	    if (s == 1 && m == expression::block) {
+	      return v;
+	    }
+	    for (size_t j = 0; j < m; ++j) {
+	      t[j] = v[j * s];
+	    }
+	    return t;
+	  }, a, stride);
+    }
+
+    // Evaluates program p on the elements [first, first + n) of records
+    // of s components, broadcasting the inputs, and writes the results to
+    // a.  Component j of record r of input k is at inputs[k][r *
+    // records[k] + j * components[k]]; a stride of 0 repeats the first.
+    void run_broadcast(size_t p, const real *const *inputs,
+		       const size_t *records, const size_t *components,
+		       size_t s, size_t first, size_t n, real *a) {
+      run(p, n, [&](const expression::instruction &in, size_t r, size_t m,
+		    real *t) -> const real * {
+	    size_t rs = records[in.input], cs = components[in.input];
+	    size_t e = first + r;
+	    if (rs == s && cs == 1 && m == expression::block) {
+	      return inputs[in.input] + e;
+	    }
+	    const real *v = inputs[in.input] + (e / s) * rs;
+	    size_t j = e % s;
+	    for (size_t i = 0; i < m; ++i) {
+	      t[i] = v[j * cs];
+	      if (++j == s) {
+		j = 0;
+		v += rs;
+	      }
+	    }
+	    return t;
+	  }, a, 1);
+    }
+  };
+
+}
+
+#endif
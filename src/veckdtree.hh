@@ -0,0 +1,307 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// k-d tree index of a point set, kept in a sidecar file that is mapped
+// into memory as it is.
+//
+// Layout (machine dependent, like the binary vector format):
+//   "VCTRKDT1", number of points n, dimension d, leaf size (size_t each),
+//   the points in tree order (n * d doubles),
+//   the original index of each point (n size_t),
+//   the split dimension of each point (n bytes).
+// The tree is implicit: the points [lo, hi) form a subtree whose root is
+// the point at mid = lo + (hi - lo) / 2, split on its dimension, with
+// the subtrees [lo, mid) and [mid + 1, hi).  Ranges of at most the leaf
+// size are scanned.
+
+#ifndef __VECKDTREE_HH
+#define __VECKDTREE_HH
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vec.h"
+
+namespace pid {
+
+  class kdtree {
+  public:
+    // (squared distance, original index); ordered by distance, then
+    // index, as vec_knn_*_points orders ties.
+    typedef std::pair<double, size_t> neighbour;
+
+    // a < b, with NaN after every number, so that points with NaN
+    // coordinates still leave a strict weak order.
+    static bool before(double a, double b) {
+      return a < b || (a == a && b != b);
+    }
+
+    // The order of neighbours, NaN distances last.
+    static bool nearer(const neighbour &a, const neighbour &b) {
+      return before(a.first, b.first) ||
+	(!before(b.first, a.first) && a.second < b.second);
+    }
+
+    static const size_t header_size = 8 + 3 * sizeof(size_t);
+    static const size_t default_leaf_size = 8;
+
+  private:
+    void *_map;
+    size_t _map_size;
+    size_t _n;
+    size_t _d;
+    size_t _leaf;
+    const double *_points;
+    const size_t *_index;
+    const unsigned char *_split;
+
+    kdtree(const kdtree &);
+    kdtree &operator = (const kdtree &);
+
+    // Sorts order[lo, hi) into tree order.
+    static void build(size_t d, const double *v, size_t leaf,
+		      std::vector<size_t> &order,
+		      std::vector<unsigned char> &split, size_t lo, size_t hi) {
+      while (hi - lo > leaf) {
+	// split on the dimension of the largest extent
+	size_t dim = 0;
+	double extent = -1;
+	for (size_t l = 0; l < d; ++l) {
+	  double a = v[order[lo] * d + l], b = a;
+	  for (size_t i = lo + 1; i < hi; ++i) {
+	    double x = v[order[i] * d + l];
+	    a = std::min(a, x);
+	    b = std::max(b, x);
+	  }
+	  if (b - a > extent) {
+	    extent = b - a;
+	    dim = l;
+	  }
+	}
+	size_t mid = lo + (hi - lo) / 2;
+	std::nth_element(order.begin() + lo, order.begin() + mid,
+			 order.begin() + hi, [&](size_t i, size_t j) {
+			   return before(v[i * d + dim], v[j * d + dim]);
+			 });
+	split[mid] = static_cast<unsigned char>(dim);
+	build(d, v, leaf, order, split, lo, mid);
+	lo = mid + 1;
+      }
+    }
+
+    double distance(const double *q, size_t i) const {
+      const double *p = _points + i * _d;
+      double x = 0;
+      for (size_t l = 0; l < _d; ++l) {
+	x += (q[l] - p[l]) * (q[l] - p[l]);
+      }
+      return x;
+    }
+
+    void offer(std::vector<neighbour> &heap, size_t k, neighbour c) const {
+      if (heap.size() < k) {
+	heap.push_back(c);
+	std::push_heap(heap.begin(), heap.end(), nearer);
+      }
+      else if (nearer(c, heap.front())) {
+	std::pop_heap(heap.begin(), heap.end(), nearer);
+	heap.back() = c;
+	std::push_heap(heap.begin(), heap.end(), nearer);
+      }
+    }
+
+    void nearest(const double *q, size_t k, std::vector<neighbour> &heap,
+		 size_t lo, size_t hi) const {
+      while (hi - lo > _leaf) {
+	size_t mid = lo + (hi - lo) / 2;
+	offer(heap, k, neighbour(distance(q, mid), _index[mid]));
+	double diff = q[_split[mid]] - _points[mid * _d + _split[mid]];
+	if (diff < 0) {
+	  nearest(q, k, heap, lo, mid);
+	  if (heap.size() == k && diff * diff > heap.front().first) {
+	    return;
+	  }
+	  lo = mid + 1;
+	}
+	else {
+	  nearest(q, k, heap, mid + 1, hi);
+	  if (heap.size() == k && diff * diff > heap.front().first) {
+	    return;
+	  }
+	  hi = mid;
+	}
+      }
+      for (size_t i = lo; i < hi; ++i) {
+	offer(heap, k, neighbour(distance(q, i), _index[i]));
+      }
+    }
+
+    void within(const double *q, double r2, std::vector<neighbour> &out,
+		size_t lo, size_t hi) const {
+      while (hi - lo > _leaf) {
+	size_t mid = lo + (hi - lo) / 2;
+	double x = distance(q, mid);
+	if (x <= r2) {
+	  out.push_back(neighbour(x, _index[mid]));
+	}
+	double diff = q[_split[mid]] - _points[mid * _d + _split[mid]];
+	if (diff * diff <= r2) {
+	  within(q, r2, out, lo, mid);
+	  lo = mid + 1;
+	}
+	else if (diff < 0) {
+	  hi = mid;
+	}
+	else {
+	  lo = mid + 1;
+	}
+      }
+      for (size_t i = lo; i < hi; ++i) {
+	double x = distance(q, i);
+	if (x <= r2) {
+	  out.push_back(neighbour(x, _index[i]));
+	}
+      }
+    }
+
+  public:
+    kdtree()
+      : _map(0), _map_size(0), _n(0), _d(0), _leaf(0), _points(0), _index(0),
+	_split(0) {
+    }
+
+    ~kdtree() {
+      unmap();
+    }
+
+    // Writes the index of the n points v (d doubles each) to fout.
+    // Returns false on a write error.
+    static bool write(size_t n, size_t d, const double *v, FILE *fout,
+		      size_t leaf = default_leaf_size) {
+      if (d == 0 || d > 255 || leaf == 0) {
+	return false;
+      }
+      std::vector<size_t> order(n);
+      for (size_t i = 0; i < n; ++i) {
+	order[i] = i;
+      }
+      std::vector<unsigned char> split(n);
+      vec_profile_begin(VEC_PROFILE_COMPUTE);
+      build(d, v, leaf, order, split, 0, n);
+      vec_profile_end(VEC_PROFILE_COMPUTE, n * d, 2 * n * d * sizeof(double));
+
+      vec_profile_begin(VEC_PROFILE_WRITE);
+      size_t header[3] = { n, d, leaf };
+      bool ok = std::fwrite("VCTRKDT1", 1, 8, fout) == 8 &&
+	std::fwrite(header, sizeof(size_t), 3, fout) == 3;
+      for (size_t i = 0; ok && i < n; ++i) {
+	ok = std::fwrite(v + order[i] * d, sizeof(double), d, fout) == d;
+      }
+      ok = ok && (n == 0 || std::fwrite(&order[0], sizeof(size_t), n, fout)
+		  == n);
+      ok = ok && (n == 0 || std::fwrite(&split[0], 1, n, fout) == n);
+      ok = std::fflush(fout) == 0 && ok;
+      vec_profile_end(VEC_PROFILE_WRITE, n * d,
+		      header_size + n * (d * sizeof(double) + sizeof(size_t)
+					 + 1));
+      return ok;
+    }
+
+    // Maps the index in the file fd.  Returns false if it is not an
+    // index or is truncated.
+    bool map(int fd) {
+      unmap();
+      struct stat st;
+      if (fstat(fd, &st) != 0 ||
+	  static_cast<size_t>(st.st_size) < header_size) {
+	return false;
+      }
+      size_t size = st.st_size;
+      void *m = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (m == MAP_FAILED) {
+	return false;
+      }
+      const char *p = static_cast<const char *>(m);
+      size_t header[3];
+      std::memcpy(header, p + 8, sizeof(header));
+      size_t n = header[0], d = header[1];
+      if (std::memcmp(p, "VCTRKDT1", 8) != 0 || d == 0 || header[2] == 0 ||
+	  size != header_size + n * (d * sizeof(double) + sizeof(size_t) + 1)) {
+	munmap(m, size);
+	return false;
+      }
+      _map = m;
+      _map_size = size;
+      _n = n;
+      _d = d;
+      _leaf = header[2];
+      _points = reinterpret_cast<const double *>(p + header_size);
+      _index = reinterpret_cast<const size_t *>(p + header_size
+						+ n * d * sizeof(double));
+      _split = reinterpret_cast<const unsigned char *>(_index + n);
+      return true;
+    }
+
+    void unmap() {
+      if (_map) {
+	munmap(_map, _map_size);
+      }
+      _map = 0;
+      _map_size = 0;
+      _n = 0;
+    }
+
+    size_t size() const {
+      return _n;
+    }
+
+    size_t dimension() const {
+      return _d;
+    }
+
+    // The min(k, size()) nearest points to q, nearest first.
+    void nearest(const double *q, size_t k,
+		 std::vector<neighbour> &result) const {
+      result.clear();
+      if (k > 0 && _n > 0) {
+	nearest(q, k, result, 0, _n);
+      }
+      std::sort_heap(result.begin(), result.end(), nearer);
+    }
+
+    // The points within distance r of q, nearest first.
+    void within(const double *q, double r,
+		std::vector<neighbour> &result) const {
+      result.clear();
+      if (r >= 0 && _n > 0) {
+	within(q, r * r, result, 0, _n);
+      }
+      std::sort(result.begin(), result.end());
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Work-stealing thread pool for the tools.  Link with -lpthread.
+
+#ifndef __VECPOOL_HH
+#define __VECPOOL_HH
+
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sched.h>
+#include <vec.h>
+
+namespace pid {
+
+  // Number of threads for "-j" without a number.
+  inline size_t default_thread_count() {
+    size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+  }
+
+  // For a tool about to read vectors that `threads` threads will share:
+  // each is read on one thread but used by all, so unless $VEC_NUMA
+  // chose otherwise, their pages are spread over the NUMA nodes.
+  inline void interleave_shared_vectors(size_t threads) {
+    if (threads > 1 && !std::getenv("VEC_NUMA")) {
+      vec_set_numa_policy(VEC_NUMA_INTERLEAVE);
+    }
+  }
+
+  // Where the workers of a parallel loop run.  On a host with several
+  // NUMA nodes, unless the policy is VEC_NUMA_OFF, worker w of `threads`
+  // is pinned to a CPU of node w * nodes / threads among the CPUs the
+  // process may use (vec_numa_worker_cpu), so that the memory a worker
+  // first touches stays on its node; elsewhere the workers are left to
+  // the scheduler.
+  class worker_placement {
+  public:
+    explicit worker_placement(size_t threads) : pinned_(false) {
+      if (sched_getaffinity(0, sizeof(allowed_), &allowed_) != 0) {
+	return;
+      }
+      for (size_t w = 0; w < threads; ++w) {
+	int cpu = vec_numa_worker_cpu(w, threads);
+	if (cpu < 0) {
+	  return;
+	}
+	cpus_.push_back(cpu);
+      }
+      pinned_ = true;
+    }
+
+    // Pins the calling thread as worker w.
+    void pin(size_t w) const {
+      if (pinned_) {
+	cpu_set_t s;
+	CPU_ZERO(&s);
+	CPU_SET(cpus_[w], &s);
+	sched_setaffinity(0, sizeof(s), &s);
+      }
+    }
+
+    // Gives the calling thread back the CPUs it had.
+    void unpin() const {
+      if (pinned_) {
+	sched_setaffinity(0, sizeof(allowed_), &allowed_);
+      }
+    }
+
+  private:
+    bool pinned_;
+    cpu_set_t allowed_;
+    std::vector<int> cpus_;
+  };
+
+  // Runs job(i) for each i in [0, n) on up to `threads` threads and
+  // returns when all are done.  Each thread owns a deque of indices,
+  // dealt round-robin, and takes from its front (lowest index first);
+  // an idle thread steals from the back of another thread's deque, so
+  // that uneven jobs keep all threads busy.  The threads are placed by
+  // worker_placement; as the deal is the same on every call, a worker
+  // gets back the parts of a vector it touched in an earlier loop of
+  // the same size, unless they were stolen.
+  template <typename Job> void parallel_for(size_t threads, size_t n,
+					    Job job) {
+    if (threads > n) {
+      threads = n;
+    }
+    if (threads <= 1) {
+      for (size_t i = 0; i < n; ++i) {
+	job(i);
+      }
+      return;
+    }
+
+    struct queue {
+      std::mutex m;
+      std::deque<size_t> q;
+    };
+    std::vector<queue> queues(threads);
+    for (size_t i = 0; i < n; ++i) {
+      queues[i % threads].q.push_back(i);
+    }
+
+    worker_placement placement(threads);
+    auto work = [&](size_t w) {
+      placement.pin(w);
+      for (;;) {
+	size_t i = n;
+	{
+	  std::lock_guard<std::mutex> l(queues[w].m);
+	  if (!queues[w].q.empty()) {
+	    i = queues[w].q.front();
+	    queues[w].q.pop_front();
+	  }
+	}
+	for (size_t k = 1; i == n && k < threads; ++k) {
+	  queue &victim = queues[(w + k) % threads];
+	  std::lock_guard<std::mutex> l(victim.m);
+	  if (!victim.q.empty()) {
+	    i = victim.q.back();
+	    victim.q.pop_back();
+	  }
+	}
+	if (i == n) {
+	  // No job is ever added, so every deque stays empty from now on.
+	  return;
+	}
+	job(i);
+      }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t w = 1; w < threads; ++w) {
+      pool.push_back(std::thread(work, w));
+    }
+    work(0);
+    placement.unpin();
+    for (size_t w = 0; w < pool.size(); ++w) {
+      pool[w].join();
+    }
+  }
+
+  // Runs job(i, fout) for each i in [0, n) like parallel_for, where fout
+  // is an in-memory stream, and copies the outputs to `out` in the order
+  // of i while the remaining jobs run.  A job returns 0 on success.  The
+  // first failing job (in the order of i) stops the output; its index is
+  // returned, or n if all jobs succeeded.
+  template <typename Job> size_t parallel_for_ordered(size_t threads,
+						      size_t n, Job job,
+						      FILE *out) {
+    if (threads <= 1 || n <= 1) {
+      for (size_t i = 0; i < n; ++i) {
+	if (job(i, out) != 0) {
+	  return i;
+	}
+      }
+      return n;
+    }
+
+    struct result {
+      bool done;
+      int status;
+      char *data;
+      size_t size;
+    };
+    std::vector<result> results(n);
+    for (size_t i = 0; i < n; ++i) {
+      results[i].done = false;
+      results[i].data = 0;
+      results[i].size = 0;
+    }
+    std::mutex m;
+    std::condition_variable ready;
+    size_t failed = n;
+
+    auto run = [&](size_t i) {
+      {
+	std::lock_guard<std::mutex> l(m);
+	if (i > failed) {
+	  // Its output would never be written.
+	  results[i].done = true;
+	  results[i].status = 0;
+	  ready.notify_all();
+	  return;
+	}
+      }
+      char *data = 0;
+      size_t size = 0;
+      FILE *fout = open_memstream(&data, &size);
+      int status = fout ? job(i, fout) : 1;
+      if (fout) {
+	std::fclose(fout);
+      }
+      std::lock_guard<std::mutex> l(m);
+      results[i].done = true;
+      results[i].status = status;
+      results[i].data = data;
+      results[i].size = size;
+      if (status != 0 && i < failed) {
+	failed = i;
+      }
+      ready.notify_all();
+    };
+
+    size_t next = 0;
+    std::thread workers([&]() {
+	parallel_for(threads, n, run);
+      });
+    while (next < n) {
+      result r;
+      {
+	std::unique_lock<std::mutex> l(m);
+	ready.wait(l, [&]() { return results[next].done; });
+	r = results[next];
+	results[next].data = 0;
+      }
+      if (r.status != 0) {
+	std::free(r.data);
+	break;
+      }
+      std::fwrite(r.data, 1, r.size, out);
+      std::free(r.data);
+      ++next;
+    }
+    workers.join();
+    for (size_t i = next; i < n; ++i) {
+      std::free(results[i].data);
+    }
+    std::fflush(out);
+    return next;
+  }
+
+}
+
+#endif
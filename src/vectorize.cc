@@ -26,28 +26,86 @@
 #include "vec.h"
 
 static bool binary_output = false;
+static bool streaming = false;
 
 static bool stop_parsing_options = false;
 static size_t stride = 0;
 
 void help() {
-	std::cerr << "usage: vectorize [-s{STRIDE}] [-B] [--] {FILENAME}\n"
+	std::cerr << "usage: vectorize [-s{STRIDE}] [-S] [-B] [-P] [--] {FILENAME}\n"
 		"\tvectorize reads text file {FILENAME} containing numerical array and\n"
 		"\twrites the array in vectorstream format to stdout.\n" 
 		"\t-s{STRIDE}: Specifies stride. {STRIDE} must be equal to or greater\n"
 		"\tthan 0.\n"
+		"\t-S: Streaming. Writes the elements as they are read, with the\n"
+		"\tnumber of elements after them, so that the input need not fit\n"
+		"\tin memory.\n"
 		"\t-B: DO NOT USE. Binary output. Machine dependent.\n"
+		"\t-P: Profile. Prints read, compute and write times to stderr.\n"
 		"\t-: stdin.\n";
 }
 
+// Writes the elements in pieces of whole rows as they are read, as a
+// vector of unknown length.
+void stream_istream(std::istream &is) {
+	const size_t row = stride > 1 ? stride : 1;
+	const size_t piece = (4096 / row + 1) * row;
+	std::vector<double> v;
+	v.reserve(piece);
+	size_t n = 0;
+
+	if (!binary_output) {
+		pid::vec_put_header_to_file(stdout);
+		pid::vec_put_hint_to_file("dimension", stride, stdout);
+		pid::vec_put_stream_begin_to_file(stdout);
+	}
+	else {
+		pid::vec_put_stream_begin_to_file_binary(stdout);
+	}
+	for (;;) {
+		double x;
+		pid::vec_profile_begin(VEC_PROFILE_READ);
+		v.clear();
+		while (v.size() < piece && is >> x) {
+			v.push_back(x);
+		}
+		pid::vec_profile_end(VEC_PROFILE_READ, v.size(), 0);
+		if (v.empty()) {
+			break;
+		}
+		if (!binary_output) {
+			pid::vec_put_double_stream_to_file(v.size(), &v[0], stride, stdout);
+		}
+		else {
+			pid::vec_put_double_stream_to_file_binary(v.size(), &v[0], stdout);
+		}
+		n += v.size();
+		if (v.size() < piece) {
+			break;
+		}
+	}
+	if (!binary_output) {
+		pid::vec_put_stream_end_to_file(n, stdout);
+	}
+	else {
+		pid::vec_put_stream_end_to_file_binary(n, stdout);
+	}
+}
+
 void process_istream(std::istream &is) {
+	if (streaming) {
+		stream_istream(is);
+		return;
+	}
 	std::vector<double> v;
+	pid::vec_profile_begin(VEC_PROFILE_READ);
 	while (is) {
 		double x;
 		is >> x;
 		v.push_back(x);
 	}
 	v.pop_back();
+	pid::vec_profile_end(VEC_PROFILE_READ, v.size(), 0);
 
 	double *vf = new double[v.size()];
 	double *i = vf;
@@ -92,9 +150,15 @@ void parse_option(const char *option) {
   case 's':
     stride = std::atoi(option + 1);
     break;
+  case 'S':
+    streaming = true;
+    break;
   case 'B':
     binary_output = true;
     break;
+  case 'P':
+    pid::vec_profile_start("vectorize");
+    break;
   case 'h':
     help();
     std::exit(0);
@@ -111,6 +175,7 @@ int main(int argc, char **argv) {
     std::exit(0);
   }
   int file_count = 0;
+  pid::vec_open_output();
   while (--argc) {
     ++argv;
     if (!stop_parsing_options && **argv == '-') {
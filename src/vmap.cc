@@ -0,0 +1,382 @@
+/*
+ *  VectorStream 1.8
+ *  Vector streaming library.
+ *  Copyright (C) 2002-2010 Ichiroh Kanaya
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "vec++.hh"
+#include "vecexpr.hh"
+#include "vecpool.hh"
+
+static bool binary_input = false;
+static bool binary_float_input = false;
+static bool binary_output = false;
+static bool binary_float_output = false;
+static bool binary_double_output = false;
+
+static bool stop_parsing_options = false;
+static size_t size_of_vector = 1;
+static bool size_given = false;
+static size_t threads = 1;
+
+static pid::expression expression;
+
+// Records read from chunk-indexed files at a time.
+static const size_t piece_length = 1 << 22;
+
+void help() {
+  std::cerr << "usage: vmap [-s{SIZE_OF_VECTOR}] [-j[N]] [-b[s]] [-B[s|d]] [-P] [--]\n"
+    "\t{EXPRESSION} [{FILENAME}...]\n"
+    "\tvmap computes {EXPRESSION} on the records of the files, which are\n"
+    "\tnamed a, b, c, ... in order (stdin is a if there is no file).\n"
+    "\tA bare name is the element of the component being computed, and\n"
+    "\ta[2] is component 2 of the record.  A single expression with bare\n"
+    "\tnames is computed on each component; a list of expressions, one\n"
+    "\tper component, makes new records, e.g. 'a[0] + a[1], a[2]'.\n"
+    "\tOperators: + - * / ^ < <= > >= == != ?: and parentheses.\n"
+    "\tFunctions: abs sqrt exp log log10 sin cos tan asin acos atan floor\n"
+    "\tceil round pow atan2 hypot min max clamp.  Constant: pi.\n"
+    "\t-s{SIZE_OF_VECTOR}: Number of components of the records of all\n"
+    "\tfiles. (Default: the dimension hint of each file, or 1)\n"
+    "\t-j[N]: Computes on N threads (Default: one per CPU).\n"
+    "\t-b: Binary input.  Chunk-indexed files are read piece by piece.\n"
+    "\t-bs: Binary input (single precision). Computed in single precision.\n"
+    "\t-B: DO NOT USE. Binary output. Machine dependent. Same precision\n"
+    "\tas the input.\n"
+    "\t-Bs: DO NOT USE. Binary output (single precision).\n"
+    "\t-Bd: DO NOT USE. Binary output (double precision).\n"
+    "\t-P: Profile. Prints read, compute and write times to stderr.\n"
+    "\t-: stdin.\n";
+}
+
+template <typename real> void put_vector_binary(size_t n, const real *v) {
+  if (binary_float_output) {
+    pid::put_vector_binary_as<float>(n, v, stdout);
+  }
+  else if (binary_double_output) {
+    pid::put_vector_binary_as<double>(n, v, stdout);
+  }
+  else {
+    pid::put_vector_binary(n, v, stdout);
+  }
+}
+
+// How the expression is laid over the records of the inputs.
+struct layout {
+  size_t m;			// components of an output record
+  bool flat;			// records of one element each
+};
+
+// Checks the components against the records of the inputs and decides
+// the layout.  A single expression with bare names only is computed on
+// the elements as they are, as if the records had one component.
+layout lay_out(const std::vector<size_t> &sizes) {
+  layout l;
+  bool each = expression.size() == 1 && expression.has_bare_inputs();
+  l.m = each ? 0 : expression.size();
+  l.flat = each && !expression.has_indexed_inputs();
+  for (size_t k = 0; k < expression.inputs(); ++k) {
+    if (!expression.has_bare_input(k)) {
+      continue;
+    }
+    if (each && l.m == 0) {
+      l.m = sizes[k];
+    }
+    if ((each && sizes[k] != l.m) || (!each && sizes[k] < l.m)) {
+      std::cerr << "vmap: error: " << char('a' + k) << " has records of "
+		<< sizes[k] << ", not " << l.m << '\n';
+      std::exit(1);
+    }
+  }
+  for (size_t p = 0; p < expression.size(); ++p) {
+    const std::vector<pid::expression::instruction> &code
+      = expression.program(p);
+    for (size_t i = 0; i < code.size(); ++i) {
+      if (code[i].op == pid::expression::op_input &&
+	  code[i].component != pid::expression::bare &&
+	  code[i].component >= sizes[code[i].input]) {
+	std::cerr << "vmap: error: " << char('a' + code[i].input) << '['
+		  << code[i].component << "] is beyond its records of "
+		  << sizes[code[i].input] << '\n';
+	std::exit(1);
+      }
+    }
+  }
+  return l;
+}
+
+// Computes n records from the inputs at v into a.
+template <typename real> void evaluate(const layout &l, size_t n,
+				       const std::vector<const real *> &v,
+				       const std::vector<size_t> &sizes,
+				       real *a) {
+  std::vector<size_t> s(sizes);
+  size_t m = l.m, programs = l.m;
+  if (l.flat) {
+    n *= l.m;
+    m = 1;
+    programs = 1;
+    std::fill(s.begin(), s.end(), 1);
+  }
+  if (threads > 1 && pid::vec_profile_is_enabled()) {
+    std::cerr << "vmap: warning: -P computes on one thread\n";
+    threads = 1;
+  }
+  size_t rows = (n + 4 * threads - 1) / (4 * threads);
+  rows = std::max<size_t>(rows, 16 * pid::expression::block);
+  size_t parts = (n + rows - 1) / rows;
+  size_t bytes = n * m * sizeof(real);
+  for (size_t k = 0; k < v.size(); ++k) {
+    bytes += n * s[k] * sizeof(real);
+  }
+  bool each = expression.size() == 1;
+  pid::vec_profile_begin(VEC_PROFILE_COMPUTE);
+  pid::parallel_for(threads, parts, [&](size_t part) {
+      pid::expression_evaluator<real> e(expression);
+      size_t first = part * rows;
+      size_t count = std::min(rows, n - first);
+      for (size_t j = 0; j < programs; ++j) {
+	e.run(each ? 0 : j, j, &v[0], &s[0], first, count, a + first * m + j,
+	      m);
+      }
+    });
+  pid::vec_profile_end(VEC_PROFILE_COMPUTE, n * m, bytes);
+}
+
+template <typename real> void put_result(size_t n, const real *a,
+					 size_t m) {
+  if (!binary_output) {
+    pid::vec_put_header_to_file(stdout);
+    pid::vec_put_hint_to_file("dimension", m, stdout);
+    pid::put_vector(n, a, m, stdout);
+  }
+  else {
+    put_vector_binary(n, a);
+  }
+}
+
+// Reads chunk-indexed files piece by piece, so that only the output
+// and one piece of each input are in memory.
+template <typename real> void process_chunked_files(std::vector<FILE *> &fins) {
+  size_t k = fins.size();
+  std::vector<size_t> sizes(k, size_of_vector);
+  size_t n = static_cast<size_t>(-1);
+  for (size_t i = 0; i < k; ++i) {
+    size_t N;
+    pid::vec_get_chunked_vector_length(fins[i], &N);
+    if (N % sizes[i] != 0) {
+      std::cerr << "vmap: error: " << N << " elements are not records of "
+		<< sizes[i] << '\n';
+      std::exit(1);
+    }
+    n = std::min(n, N / sizes[i]);
+  }
+  layout l = lay_out(sizes);
+  std::vector<real> a(std::max<size_t>(n * l.m, 1));
+  for (size_t first = 0; first < n; first += piece_length) {
+    size_t count = std::min(piece_length, n - first);
+    std::vector<const real *> v(k);
+    for (size_t i = 0; i < k; ++i) {
+      size_t got;
+      real *w;
+      pid::new_vector_range_chunked(first * sizes[i], count * sizes[i], &got,
+				    &w, fins[i]);
+      v[i] = w;
+    }
+    evaluate(l, count, v, sizes, &a[first * l.m]);
+    for (size_t i = 0; i < k; ++i) {
+      std::free(const_cast<real *>(v[i]));
+    }
+  }
+  put_result(n * l.m, &a[0], l.m);
+  std::fflush(stdout);
+}
+
+template <typename real> void process_files(std::vector<FILE *> &fins) {
+  size_t k = fins.size();
+  bool chunked = binary_input;
+  for (size_t i = 0; chunked && i < k; ++i) {
+    chunked = pid::vec_is_chunked_file(fins[i]);
+  }
+  if (chunked) {
+    process_chunked_files<real>(fins);
+    return;
+  }
+
+  std::vector<size_t> sizes(k, size_of_vector);
+  std::vector<size_t> N(k);
+  std::vector<real *> w(k);
+  bool nil = false;
+  for (size_t i = 0; i < k; ++i) {
+    if (!binary_input) {
+      size_t hint = pid::dimension_hint(fins[i]);
+      if (!size_given && hint > 0) {
+	sizes[i] = hint;
+      }
+      pid::new_vector(&N[i], &w[i], fins[i]);
+    }
+    else {
+      pid::new_vector_binary(&N[i], &w[i], fins[i]);
+    }
+    if (N[i] == static_cast<size_t>(-1)) {
+      nil = true;
+    }
+    else if (N[i] % sizes[i] != 0) {
+      std::cerr << "vmap: error: " << N[i] << " elements are not records of "
+		<< sizes[i] << '\n';
+      std::exit(1);
+    }
+  }
+  if (nil) {
+    pid::put_nil(stdout);
+  }
+  else {
+    size_t n = static_cast<size_t>(-1);
+    for (size_t i = 0; i < k; ++i) {
+      n = std::min(n, N[i] / sizes[i]);
+    }
+    layout l = lay_out(sizes);
+    std::vector<real> a(std::max<size_t>(n * l.m, 1));
+    std::vector<const real *> v(w.begin(), w.end());
+    evaluate(l, n, v, sizes, &a[0]);
+    put_result(n * l.m, &a[0], l.m);
+  }
+  for (size_t i = 0; i < k; ++i) {
+    pid::vec_scan_messages_from_file_and_put_to_file(fins[i], stdout);
+    std::free(w[i]);
+  }
+  std::fflush(stdout);
+}
+
+void process(const std::vector<const char *> &filenames) {
+  std::vector<FILE *> fins;
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    const char *filename = filenames[i];
+    if (filename[0] == '-' && filename[1] == '\0') {
+      fins.push_back(stdin);
+      continue;
+    }
+    FILE *fin = pid::open_file(filename);
+    if (!fin) {
+      std::cerr << "vmap: error: can't open: " << filename << '\n';
+      std::exit(1);
+    }
+    fins.push_back(fin);
+  }
+  if (fins.empty()) {
+    fins.push_back(stdin);
+  }
+  if (expression.inputs() > fins.size()) {
+    std::cerr << "vmap: error: no file for "
+	      << char('a' + expression.inputs() - 1) << '\n';
+    std::exit(1);
+  }
+
+  if (binary_float_input) {
+    process_files<float>(fins);
+  }
+  else {
+    process_files<double>(fins);
+  }
+  for (size_t i = 0; i < fins.size(); ++i) {
+    if (fins[i] != stdin) {
+      std::fclose(fins[i]);
+    }
+  }
+}
+
+void parse_option(const char *option) {
+  switch (*option) {
+  case '-':
+    stop_parsing_options = true;
+    break;
+  case 's':
+    size_of_vector = std::atoi(option + 1);
+    size_given = true;
+    if (size_of_vector < 1) {
+      std::cerr << "vmap: error: size of vector must be greater than 0.\n";
+      std::exit(1);
+    }
+    break;
+  case 'j':
+    threads = std::atoi(option + 1);
+    if (threads == 0) {
+      threads = pid::default_thread_count();
+    }
+    break;
+  case 'b':
+    binary_input = true;
+    if (*++option == 's') {
+      binary_float_input = true;
+    }
+    break;
+  case 'B':
+    binary_output = true;
+    if (*++option == 's') {
+      binary_float_output = true;
+    }
+    else if (*option == 'd') {
+      binary_double_output = true;
+    }
+    break;
+  case 'P':
+    pid::vec_profile_start("vmap");
+    break;
+  case 'h':
+    help();
+    std::exit(0);
+    break;
+  default:
+    std::cerr << "vmap: warning: ignoring option: " << option << '\n';
+    break;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *text = 0;
+  std::vector<const char *> filenames;
+  pid::open_output();
+  while (--argc) {
+    ++argv;
+    if (!stop_parsing_options && **argv == '-' && *(*argv + 1) != '\0') {
+      parse_option(*argv + 1);
+    }
+    else if (!text) {
+      text = *argv;
+    }
+    else {
+      filenames.push_back(*argv);
+    }
+  }
+  if (!text) {
+    help();
+    std::exit(0);
+  }
+  std::string error;
+  if (!expression.compile(text, &error)) {
+    std::cerr << "vmap: error: " << error << '\n';
+    std::exit(1);
+  }
+  process(filenames);
+  return 0;
+}